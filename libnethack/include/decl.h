@@ -363,6 +363,7 @@ extern struct sinfo {
     struct memfile binary_save;
     boolean binary_save_allocated;
     int expected_recovery_count;
+    enum nh_log_format log_format;           /* of the log we have open */
     long last_save_backup_location_location; /* bytes from start of file */
     long save_backup_location;               /* bytes from start of file */
     long binary_save_location;               /* bytes from start of file */
@@ -371,6 +372,10 @@ extern struct sinfo {
     long emergency_recover_location;         /* bytes from start of file */
     boolean input_was_just_replayed;
     boolean ok_to_diff;
+    boolean in_save_check_process; /* forked to check a save; must not touch
+                                      the log or the interface */
+    boolean copy_unchanged_levels; /* savegame() may copy levels from the
+                                      binary save it's relative to */
 } program_state;
 
 #define panic(...) panic_core(__FILE__, __LINE__, __VA_ARGS__)
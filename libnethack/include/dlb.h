@@ -51,6 +51,7 @@ typedef struct dlb_handle {
 
 boolean dlb_init(void);
 void dlb_cleanup(void);
+void dlb_reinit_after_fork(void);
 
 dlb *dlb_fopen(const char *, const char *);
 int dlb_fclose(DLB_P);
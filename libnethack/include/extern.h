@@ -880,6 +880,9 @@ extern void mwrite64(struct memfile *mf, int64_t value);
 extern void store_mf(int fd, struct memfile *mf);
 extern void mtag(struct memfile *mf, long tagdata,
                  enum memfile_tagtype tagtype);
+extern long mtagpos(const struct memfile *mf, long tagdata,
+                    enum memfile_tagtype tagtype);
+extern void mcopyrelative(struct memfile *mf, long len);
 extern void mhint_mon_coordinates(struct memfile *mf);
 extern void mdiffflush(struct memfile *mf, boolean eof);
 extern void mdiffapply(char *diff, long difflen, struct memfile *diff_base,
@@ -1522,6 +1525,7 @@ extern void savegame(struct memfile *mf);
 extern void save_coords(struct memfile *mf, const coord *c, int n);
 extern void savelev(struct memfile *mf, xchar levnum);
 extern void freelev(xchar levnum);
+extern void note_levels_saved(void);
 extern void savefruitchn(struct memfile *mf);
 extern void freedynamicdata(void);
 extern int8_t save_encode_8(int8_t, int, int);
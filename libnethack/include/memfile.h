@@ -6,7 +6,9 @@
 #ifndef MEMFILE_H
 # define MEMFILE_H
 
-# define MEMFILE_HASHTABLE_SIZE 1009
+/* Size of the tag table of a memfile that isn't relative to anything; must be
+   a power of 2. */
+# define MEMFILE_TAGS_INITIAL 1024
 
 /* SAVEBREAK (4.3-beta1 -> 4.3-beta2): these constants are only needed to parse
    the old -beta1 diff format. */
@@ -128,12 +130,12 @@ enum memfile_tagtype {
     MTAG_AUTOPICKUP_RULES,  /* 40 */
     MTAG_DUNGEON_TOPOLOGY,
     MTAG_SPELLBOOK,
+    MTAG_LEVEL_END,
 };
 struct memfile_tag {
-    struct memfile_tag *next;
     long tagdata;
     enum memfile_tagtype tagtype;
-    int pos;
+    int pos;                /* -1 for an empty slot in the tag table */
 };
 struct memfile {
     /* The basic information: the buffer, its length, and the file position */
@@ -184,14 +186,17 @@ struct memfile {
        coordinate is in the byte afterwards). */
     int mon_coord_hint;
 
-    /* Tags to help in diffing. This is a hashtable for efficiency, using
-       chaining in the case of collisions. */
-    struct memfile_tag *tags[MEMFILE_HASHTABLE_SIZE];
+    /* Tags to help in diffing. This is an open-addressed hashtable (using
+       linear probing) in a single allocation, with a power-of-2 number of
+       slots, tagcap; tagcount of them are in use. */
+    struct memfile_tag *tags;
+    int tagcap;
+    int tagcount;
 
     /* Where we are "semantically", for debug purposes. (It's possible this
        could someday be used to construct better error messages, too, but so
-       far it isn't.) */
-    struct memfile_tag *last_tag;
+       far it isn't.) This has pos -1 if there's no tag yet. */
+    struct memfile_tag last_tag;
 };
 
 #endif
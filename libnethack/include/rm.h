@@ -502,6 +502,11 @@ struct level {
     int max_regions;
 
     d_level z;
+
+    /* Not saved: whether this level is unchanged since the binary save was
+       last brought up to date, meaning that savegame() can copy it from there
+       rather than saving it again. */
+    boolean in_binary_save;
 };
 
 extern struct level *levels[MAXLINFO];  /* structure describing all levels */
@@ -525,5 +530,9 @@ extern struct level *level;             /* pointer to an entry in levels */
 # define m_buried_at(x,y) \
              (MON_BURIED_AT(x,y) ? level->monsters[x][y] : NULL)
 
+/* Must be used when changing a level other than the current level, or when
+   the current level stops being current (see copy_unchanged_level). */
+# define mark_level_changed(lev) ((lev)->in_binary_save = FALSE)
+
 #endif /* RM_H */
 
@@ -49,6 +49,10 @@ nh_lib_init(const struct nh_window_procs *procs, const char *const *paths)
 
     u.uhp = 1;  /* prevent RIP on early quits */
 
+    /* Open the data library now rather than when the first game starts, so
+       that a server process can do this before it has a client waiting. */
+    dlb_init();
+
 #ifdef AIMAKE_BUILDOS_linux
     /* SIGRTMIN+{1,2} are used by the lock monitoring code. This means that we
        could end up with spurious signals due to race conditions after a game
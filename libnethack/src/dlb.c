@@ -418,6 +418,21 @@ dlb_cleanup(void)
     }
 }
 
+/* For use in a child process after fork(). The library files' handles are shared
+   with the parent, file offsets included, so reading through them here would
+   move the parent's position out from under it. Abandon them (closing them
+   could seek the shared descriptor, too) and open handles of our own. */
+void
+dlb_reinit_after_fork(void)
+{
+    if (dlb_initialized) {
+        memset((char *)&dlb_libs[0], 0, sizeof (dlb_libs));
+        dlb_initialized = FALSE;
+    }
+
+    dlb_init();
+}
+
 dlb *
 dlb_fopen(const char *name, const char *mode)
 {
@@ -1520,6 +1520,7 @@ deliver_object(struct obj *obj, xchar dnum, xchar dlevel, int where)
         lev = mklev(&levnum);
         reset_rndmonst(NON_PM);
     }
+    mark_level_changed(lev);
 
     obj_extract_self(obj);
 
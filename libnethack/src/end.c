@@ -10,7 +10,7 @@
 #include <math.h>
 
 #ifndef AIMAKE_BUILDOS_MSWin32
-/* For nonfatal_dump_core() */
+/* For nonfatal_dump_core(), terminate() */
 # include <unistd.h>
 #endif
 
@@ -1087,6 +1087,13 @@ container_contents(struct obj *list, boolean identified, boolean all_containers)
 noreturn void
 terminate(enum nh_play_status playstatus)
 {
+#ifndef AIMAKE_BUILDOS_MSWin32
+    /* A save check process has no interface to return to; the process that
+       forked it finds out what happened from the exit status. */
+    if (program_state.in_save_check_process)
+        _exit(EXIT_FAILURE);
+#endif
+
     /* don't bother to try to release memory if we're in panic mode, to avoid
        trouble in case that happens to be due to memory problems */
     if (!program_state.panicking) {
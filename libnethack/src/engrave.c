@@ -379,6 +379,7 @@ make_engr_at(struct level *lev, int x, int y, const char *s, long e_time,
     if (!s || !*s)
         return;
 
+    mark_level_changed(lev);
     engr_len = strlen(s);
 
     if ((ep = engr_at(lev, x, y)) != 0)
@@ -1307,6 +1308,7 @@ rest_engravings(struct memfile *mf, struct level *lev)
 void
 del_engr(struct engr *ep, struct level *lev)
 {
+    mark_level_changed(lev);
     if (ep == lev->lev_engr) {
         lev->lev_engr = ep->nxt_engr;
     } else {
@@ -55,6 +55,7 @@ new_light_source(struct level *lev, xchar x, xchar y, int range, int type,
         return;
     }
 
+    mark_level_changed(lev);
     ls = malloc(sizeof (light_source));
 
     ls->next = lev->lev_lights;
@@ -79,6 +80,8 @@ del_light_source(struct level *lev, int type, void *id)
     light_source *curr, *prev;
     intptr_t tmp_id;
 
+    mark_level_changed(lev);
+
     /* need to be prepared for dealing a with light source which has only been
        partially restored during a level change (in particular: chameleon vs
        prot. from shape changers) */
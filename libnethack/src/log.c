@@ -6,6 +6,7 @@
 #include "hack.h"
 #include "patchlevel.h"
 #include "iomodes.h"
+#include "dlb.h"
 #include <zlib.h>
 /* stdint.h, inttypes.h let us printf long longs portably */
 #define __STDC_FORMAT_MACROS
@@ -14,6 +15,21 @@
 #include <limits.h>
 #include <errno.h>
 #include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef AIMAKE_BUILDOS_MSWin32
+/* For the save check process */
+# include <signal.h>
+# include <unistd.h>
+# include <sys/wait.h>
+#endif
+
+#ifdef AIMAKE_BUILDOS_linux
+/* For waiting for the logfile to change while watching */
+# include <poll.h>
+# include <sys/inotify.h>
+#endif
 
 /* #define DEBUG */
 
@@ -21,16 +37,40 @@
 
 static void log_reset(void);
 static void log_binary(const char *buf, int buflen);
+static void log_save_data(const char *buf, int buflen, const char *dict,
+                          int dictlen);
+static int log_data_strlen(const char *in);
+static void log_data_decode(const char *in, char *out, int outlen);
+static void backup_dictionary_decode(const char *in, char *out, int outlen);
 static long get_log_offset(void);
 static long get_log_last_newline(int);
+static char *lgetline_view(int);
 static char *lgetline_malloc(int);
+static boolean lskipline(int);
+static boolean lpeek(int fd, long offset, void *buffer, int len);
+static void log_window_discard(void);
+static void log_window_written(int fd);
 
 static enum nh_log_status read_log_header(
-    int fd, struct nh_game_info *si, int *recovery_count, boolean do_locking);
+    int fd, struct nh_game_info *si, int *recovery_count,
+    enum nh_log_format *format, boolean do_locking);
 
 static void load_gamestate_from_binary_save(boolean maybe_old_version);
 static void log_replay_save_line(void);
 
+static void collect_save_check(boolean can_recover);
+static void backup_index_add(long offset, long moves);
+static void backup_index_clear(void);
+static void set_save_check_options(void);
+static int save_check_int_option(const char *name, int def, int min, int max);
+static void note_full_check(void);
+static boolean full_check_due(boolean is_backup);
+static boolean stale_level_check_async(boolean full);
+static boolean binary_save_intact(void);
+static boolean check_new_binary_save(struct memfile *diff_base,
+                                     boolean full, boolean levels_copied);
+static void adopt_binary_save(boolean reload);
+
 static boolean full_read(int fd, void *buffer, int len);
 static boolean full_write(int fd, const void *buffer, int len);
 
@@ -48,6 +88,30 @@ static_assert(SECOND_LOGLINE_LEN < COLNO, "SECOND_LOGLINE_LEN too long");
 
 #define STATUS_LEN 4
 #define STATUS_LEN_STR "4"
+
+/* The first word of the log says what format it's in. Both words are the same
+   length, so that the fixed-length fields after them stay where they are. */
+#define LOG_MAGIC_TEXT   "NHGAME"
+#define LOG_MAGIC_BINARY "NHGAMB"
+#define LOG_MAGIC_LEN_STR "6"
+
+static const char *
+log_format_magic(enum nh_log_format format)
+{
+    return format == LF_BINARY ? LOG_MAGIC_BINARY : LOG_MAGIC_TEXT;
+}
+
+static enum nh_log_format
+log_format_from_magic(const char *magic)
+{
+    if (!strcmp(magic, LOG_MAGIC_TEXT))
+        return LF_TEXT;
+    else if (!strcmp(magic, LOG_MAGIC_BINARY))
+        return LF_BINARY;
+    else
+        return LF_INVALID;
+}
+
 const char *
 status_string(enum nh_log_status state) {
     switch (state) {
@@ -180,6 +244,13 @@ log_recover_core(long offset, boolean canreturn, const char *message,
     struct nh_menulist menu;
     boolean ok = TRUE;
 
+#ifndef AIMAKE_BUILDOS_MSWin32
+    /* A save check process can't recover anything; the process that forked it
+       will do that, based on its exit status. */
+    if (program_state.in_save_check_process)
+        _exit(EXIT_FAILURE);
+#endif
+
     program_state.emergency_recover_location = 0;
 
     if (program_state.followmode != FM_PLAY && message) {
@@ -295,8 +366,8 @@ log_recover_core(long offset, boolean canreturn, const char *message,
 
         struct nh_game_info si;
         int recovery_count;
-        if (read_log_header(program_state.logfile, &si, &recovery_count, FALSE)
-            == LS_INVALID) {
+        if (read_log_header(program_state.logfile, &si, &recovery_count,
+                            &program_state.log_format, FALSE) == LS_INVALID) {
             /* If this happens, we don't have a recovery count to compare
                against. */
             raw_printf("The save file is too badly corrupted to recover!\n");
@@ -309,8 +380,10 @@ log_recover_core(long offset, boolean canreturn, const char *message,
         /* Increase the recovery count. */
 
         program_state.expected_recovery_count++;
-        buf = msgprintf("NHGAME %" STATUS_LEN_STR "." STATUS_LEN_STR
-                        "s %08x %d.%03d.%03d\x0a", status_string(LS_SAVED),
+        buf = msgprintf("%s %" STATUS_LEN_STR "." STATUS_LEN_STR
+                        "s %08x %d.%03d.%03d\x0a",
+                        log_format_magic(program_state.log_format),
+                        status_string(LS_SAVED),
                         program_state.expected_recovery_count,
                         VERSION_MAJOR, VERSION_MINOR, PATCHLEVEL);
 
@@ -322,6 +395,7 @@ log_recover_core(long offset, boolean canreturn, const char *message,
         }
 
         /* Truncate the file. */
+        log_window_discard();
         if (ftruncate(program_state.logfile, offset) < 0) {
             raw_printf("Could not truncate save file during recovery!\n");
             terminate(ERR_RESTORE_FAILED);
@@ -375,7 +449,8 @@ log_maybe_undo_quit(void)
     /* This runs before log_sync, so we need to update the recovery count
        information manually. */
     read_log_header(program_state.logfile, &unused,
-                    &program_state.expected_recovery_count, FALSE);
+                    &program_state.expected_recovery_count,
+                    &program_state.log_format, FALSE);
 
     lastline = get_log_last_newline(2);
     lseek(program_state.logfile, lastline, SEEK_SET);
@@ -436,19 +511,16 @@ log_desync(char found, char expected)
         panic("Could not upgrade to read lock on logfile");
 
     /* Can we find some future save point to restore to? */
-    while ((logline = lgetline_malloc(program_state.logfile))) {
+    while ((logline = lgetline_view(program_state.logfile))) {
 
         if (*logline == '~' || *logline == '*') {
 
             /* Yes. */
             if (!change_fd_lock(program_state.logfile, TRUE, LT_MONITOR, 2))
                 panic("Could not downgrade to monitor lock on logfile");
-            free(logline);
             /* TODO: get this to restart at the log offset, somehow */
             terminate(RESTART_PLAY);
         }
-
-        free(logline);
     }
 
     /* No. */
@@ -474,25 +546,75 @@ static const char b64d[256] = {
     41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51
 };
 
+/* The bound on the length of compressed data, plus 4 bytes for the identifier
+   of a preset dictionary. */
+static unsigned long
+log_compress_bound(int n)
+{
+    return compressBound(n) + 4;
+}
+
+/* Compresses len bytes from in, against the given preset dictionary unless
+   dict is NULL. Returns a buffer that must be freed, and sets *olen to the
+   length of the compressed data. */
+static unsigned char *
+log_compress(const unsigned char *in, int len, const char *dict, int dictlen,
+             unsigned long *olen)
+{
+    unsigned char *o;
+    z_stream zs;
+
+    *olen = log_compress_bound(len);
+    o = malloc(*olen);
+
+    if (!dict) {
+        if (compress2(o, olen, in, len, Z_BEST_COMPRESSION) != Z_OK)
+            panic("Could not compress input data!");
+    } else {
+        memset(&zs, 0, sizeof zs);
+        zs.next_in = (unsigned char *)in;
+        zs.avail_in = len;
+        zs.next_out = o;
+        zs.avail_out = *olen;
+
+        if (deflateInit(&zs, Z_BEST_COMPRESSION) != Z_OK ||
+            deflateSetDictionary(&zs, (const unsigned char *)dict,
+                                 dictlen) != Z_OK ||
+            deflate(&zs, Z_FINISH) != Z_STREAM_END)
+            panic("Could not compress input data!");
+
+        *olen = zs.total_out;
+        deflateEnd(&zs);
+    }
+
+    MARK_INITIALIZED(o, *olen);
+    return o;
+}
+
+/* The length prefix of compressed data is between dollars, or (if the data
+   was compressed against the save backup dictionary) ampersands. */
+static char
+compressed_prefix_char(const char *dict)
+{
+    return dict ? '&' : '$';
+}
+
 static int
 base64size(int n)
 {
-    return compressBound(n) * 4 / 3 + 4 + 12;   /* 12 for $4294967296$ */
+    return log_compress_bound(n) * 4 / 3 + 4 + 12;   /* 12 for $4294967296$ */
 }
 
 static void
-base64_encode_binary(const unsigned char *in, char *out, int len)
+base64_encode_binary(const unsigned char *in, char *out, int len,
+                     const char *dict, int dictlen)
 {
     int i, pos, rem;
-    unsigned long olen = compressBound(len);
-    unsigned char *o = malloc(olen);
-
-    if (compress2(o, &olen, in, len, Z_BEST_COMPRESSION) != Z_OK) {
-        panic("Could not compress input data!");
-    }
-    MARK_INITIALIZED(o, olen);
+    unsigned long olen;
+    unsigned char *o = log_compress(in, len, dict, dictlen, &olen);
+    char c = compressed_prefix_char(dict);
 
-    pos = sprintf(out, "$%d$", len);
+    pos = sprintf(out, "%c%d%c", c, len, c);
 
     if (pos + olen >= len) {
         pos = 0;
@@ -528,7 +650,7 @@ base64_encode_binary(const unsigned char *in, char *out, int len)
 static void
 base64_encode(const char *in, char *out)
 {
-    base64_encode_binary((const unsigned char *)in, out, strlen(in));
+    base64_encode_binary((const unsigned char *)in, out, strlen(in), NULL, 0);
 }
 
 static int
@@ -609,6 +731,502 @@ base64_decode(const char *in, char *out, int outlen)
     }
 }
 
+/***** Raw binary encoding *****/
+
+/* In binary logs, save diffs and backups are stored as raw bytes rather than
+   base 64. The data is prefixed by '#', its length in bytes (in decimal), and
+   ':'; as with base 64, compressed data is additionally prefixed by its
+   uncompressed length between dollars, e.g. `$100$#57:`.
+
+   The rest of the log code relies on lines never containing a newline, and
+   lgetline_view also treats a nul as the end of a line; so those bytes, and
+   the escape byte itself, are written as RAW_ESCAPE followed by the byte
+   XORed with RAW_ESCAPE_XOR. On compressed data, that costs about 1% (rather
+   than the 33% of base 64). */
+
+#define RAW_ESCAPE '\x1b'
+#define RAW_ESCAPE_XOR 0x40
+
+static boolean
+raw_needs_escape(unsigned char c)
+{
+    return c == '\0' || c == '\x0a' || c == RAW_ESCAPE;
+}
+
+/* The worst case is that every byte needs escaping. */
+static int
+raw_size(int n)
+{
+    /* 28 for $4294967296$#4294967296: */
+    return log_compress_bound(n) * 2 + 28;
+}
+
+static void
+raw_encode_binary(const unsigned char *in, char *out, int len,
+                  const char *dict, int dictlen)
+{
+    int i, pos;
+    unsigned long olen;
+    unsigned char *o = log_compress(in, len, dict, dictlen, &olen);
+    char c = compressed_prefix_char(dict);
+
+    if (olen >= len) {
+        pos = 0;
+        olen = len;
+    } else {
+        pos = sprintf(out, "%c%d%c", c, len, c);
+        in = o;
+    }
+
+    pos += sprintf(out + pos, "#%lu:", olen);
+
+    for (i = 0; i < olen; i++) {
+        if (raw_needs_escape(in[i])) {
+            out[pos++] = RAW_ESCAPE;
+            out[pos++] = in[i] ^ RAW_ESCAPE_XOR;
+        } else
+            out[pos++] = in[i];
+    }
+
+    free(o);
+
+    out[pos] = '\0';
+}
+
+/* Decodes raw binary data, in the format written by raw_encode_binary, into a
+   buffer of the given length. Unlike base64_decode, this doesn't nul-terminate
+   its output. */
+static void
+raw_decode(const char *in, char *out, int outlen)
+{
+    unsigned long ulen = 0, len;
+    unsigned long i;
+    char *o = out;
+    char *end;
+    boolean compressed = *in == '$';
+
+    if (compressed) {
+        ulen = strtoul(in + 1, &end, 10);
+        if (*end != '$')
+            error_reading_save("Bad length prefix in binary data at %ld\n");
+        in = end + 1;
+    }
+
+    if (*in != '#')
+        error_reading_save("Missing '#' in binary data at %ld\n");
+    len = strtoul(in + 1, &end, 10);
+    if (*end != ':')
+        error_reading_save("Bad length prefix in binary data at %ld\n");
+    in = end + 1;
+
+    if (compressed)
+        o = malloc(len);
+    else if (len > outlen)
+        error_reading_save("Binary data was too long at %ld\n");
+
+    for (i = 0; i < len; i++) {
+        if (*in == RAW_ESCAPE) {
+            in++;
+            if (!raw_needs_escape(*in ^ RAW_ESCAPE_XOR))
+                goto corrupted;
+            o[i] = *in++ ^ RAW_ESCAPE_XOR;
+        } else if (*in)
+            o[i] = *in++;
+        else
+            goto corrupted;
+    }
+
+    /* The data should run exactly to the end of the line. */
+    if (*in)
+        goto corrupted;
+
+    if (compressed) {
+        if (ulen > outlen) {
+            free(o);
+            error_reading_save("Compressed binary data was too long at %ld\n");
+        }
+        int errcode = uncompress((unsigned char *)out, &ulen,
+                                 (unsigned char *)o, len);
+
+        free(o);
+        if (errcode != Z_OK) {
+            raw_printf("Decompressing save file failed at %ld: %s\n",
+                       get_log_offset(),
+                       errcode == Z_MEM_ERROR ? "Out of memory" : errcode ==
+                       Z_BUF_ERROR ? "Invalid size" : errcode ==
+                       Z_DATA_ERROR ? "Corrupted file" : "(unknown error)");
+            error_reading_save("");
+        }
+
+        MARK_INITIALIZED(out, ulen);
+    }
+    return;
+
+corrupted:
+    if (compressed)
+        free(o);
+    error_reading_save("Corrupted binary data at %ld\n");
+}
+
+/* Returns TRUE if the given save diff or backup data is in the raw binary
+   encoding rather than base 64. Logs are read this way, rather than according
+   to the format in their header, so that a log can be read no matter which
+   encoding each line uses. */
+static boolean
+log_data_is_raw(const char *in)
+{
+    if (*in == '$' || *in == '&') {
+        in = strchr(in + 1, *in);
+        if (!in)
+            return FALSE;
+        in++;
+    }
+    return *in == '#';
+}
+
+/* The decoded length of save diff or backup data (or, for uncompressed base
+   64, an upper bound on it). */
+static int
+log_data_strlen(const char *in)
+{
+    if (*in == '$' || *in == '&' || *in == '#')
+        return atoi(in + 1);
+    return strlen(in);
+}
+
+/* The exact decoded length of save diff or backup data. (log_data_strlen is
+   only an upper bound for uncompressed base 64, which is good enough when
+   loading a save, but would add padding when copying one.) */
+static int
+log_data_exact_len(const char *in)
+{
+    int n;
+
+    if (*in == '$' || *in == '&' || *in == '#')
+        return log_data_strlen(in);
+
+    n = strlen(in);
+    return n / 4 * 3 - (n >= 1 && in[n - 1] == '=') -
+        (n >= 2 && in[n - 2] == '=');
+}
+
+static void
+log_data_decode(const char *in, char *out, int outlen)
+{
+    if (*in == '&')
+        backup_dictionary_decode(in, out, outlen);
+    else if (log_data_is_raw(in))
+        raw_decode(in, out, outlen);
+    else
+        base64_decode(in, out, outlen);
+}
+
+/***** Save backup dictionary *****/
+
+/* Save backups can be compressed against a preset dictionary: the start of the
+   first save backup in the log. The start of a save (the character, their
+   inventory and discoveries, the dungeon overview) changes only gradually over
+   a game, so this gives zlib something to match against from the very first
+   byte. This is controlled by NH4BACKUPDICTIONARY, and marked in the log by
+   putting the uncompressed length between ampersands rather than dollars.
+
+   The first save backup is always written without a dictionary, so that the
+   dictionary can be recovered from any log. zlib can only make use of 32KiB
+   of dictionary, so that's all we keep. */
+
+#define BACKUP_DICTIONARY_LEN 32768
+
+static boolean backup_dictionary_enabled;
+
+static struct {
+    int fd;             /* log the dictionary comes from; -1 if unknown */
+    long offset;        /* of the first save backup in that log */
+    char *buf;          /* NULL if not loaded yet */
+    int len;
+} backup_dictionary = {.fd = -1};
+
+static void
+backup_dictionary_clear(void)
+{
+    free(backup_dictionary.buf);
+    backup_dictionary.buf = NULL;
+    backup_dictionary.len = 0;
+    backup_dictionary.fd = -1;
+}
+
+/* Records where the dictionary is; it's loaded when first needed. */
+static void
+backup_dictionary_set_source(int fd, long offset)
+{
+    backup_dictionary_clear();
+    backup_dictionary.fd = fd;
+    backup_dictionary.offset = offset;
+}
+
+/* Loads the dictionary from the first save backup. This reads the log
+   directly, rather than via the read-ahead window, because it can be called
+   while decoding a line that's still in the window. */
+static void
+backup_dictionary_load(void)
+{
+    int fd = backup_dictionary.fd;
+    long o = lseek(fd, 0, SEEK_CUR);
+    long size = 0, used = 0;
+    char *line = NULL, *nl = NULL, *data;
+    int rv, len;
+
+    lseek(fd, backup_dictionary.offset, SEEK_SET);
+    while (!nl) {
+        if (used == size) {
+            size = size ? size * 2 : 65536;
+            line = realloc(line, size);
+            if (!line)
+                panic("Out of memory in backup_dictionary_load");
+        }
+        rv = read(fd, line + used, size - used);
+        if (rv < 0 && errno == EINTR)
+            continue;
+        if (rv <= 0)
+            break;
+        nl = memchr(line + used, '\x0a', rv);
+        used += rv;
+    }
+    lseek(fd, o, SEEK_SET);
+
+    if (!nl || nl - line <= 10 || *line != '*' || line[10] == '&') {
+        free(line);
+        return;
+    }
+
+    *nl = '\0';
+    data = line + 10;
+    len = log_data_exact_len(data);
+
+    /* base64_decode may write a couple of bytes of padding and a nul past
+       the end of the data, so leave it room to do so. */
+    backup_dictionary.buf = malloc(len + 3);
+    log_data_decode(data, backup_dictionary.buf, len + 3);
+    free(line);
+
+    backup_dictionary.len = min(len, BACKUP_DICTIONARY_LEN);
+    backup_dictionary.buf = realloc(backup_dictionary.buf,
+                                    backup_dictionary.len + 1);
+}
+
+/* Returns the dictionary, or NULL if it can't be found. */
+static const char *
+backup_dictionary_get(int *len)
+{
+    if (!backup_dictionary.buf && backup_dictionary.fd != -1)
+        backup_dictionary_load();
+
+    *len = backup_dictionary.len;
+    return backup_dictionary.buf;
+}
+
+/* Decodes data that was compressed against the dictionary. */
+static void
+backup_dictionary_decode(const char *in, char *out, int outlen)
+{
+    unsigned long ulen;
+    const char *dict;
+    char *end, *buf;
+    int dictlen, len, errcode;
+    z_stream zs;
+
+    ulen = strtoul(in + 1, &end, 10);
+    if (*end != '&')
+        error_reading_save("Bad length prefix in save backup at %ld\n");
+    if (ulen > outlen)
+        error_reading_save("Compressed save backup was too long at %ld\n");
+
+    dict = backup_dictionary_get(&dictlen);
+    if (!dict)
+        error_reading_save("No dictionary for save backup at %ld\n");
+
+    /* The compressed data is encoded the same way as uncompressed data. */
+    in = end + 1;
+    len = log_data_strlen(in);
+    buf = malloc(len + 3);
+    log_data_decode(in, buf, len + 3);
+
+    memset(&zs, 0, sizeof zs);
+    zs.next_in = (unsigned char *)buf;
+    zs.avail_in = len;
+    zs.next_out = (unsigned char *)out;
+    zs.avail_out = ulen;
+
+    errcode = inflateInit(&zs);
+    if (errcode == Z_OK) {
+        errcode = inflate(&zs, Z_FINISH);
+        if (errcode == Z_NEED_DICT) {
+            errcode = inflateSetDictionary(&zs, (const unsigned char *)dict,
+                                           dictlen);
+            if (errcode == Z_OK)
+                errcode = inflate(&zs, Z_FINISH);
+        }
+        inflateEnd(&zs);
+    }
+    free(buf);
+
+    if (errcode != Z_STREAM_END || zs.total_out != ulen)
+        error_reading_save("Could not decompress save backup at %ld\n");
+
+    MARK_INITIALIZED(out, ulen);
+}
+
+/***** Save backup policy *****/
+
+/* Each time the turnstate becomes neutral, we write either a save backup or a
+   save diff. Diffs are smaller, but anyone loading the log (e.g. log_sync, when
+   someone watches or replays a game) has to replay every diff since the last
+   backup, and the backup may be a long seek away from the diff they want. The
+   decision is made by a policy, chosen via NH4BACKUPPOLICY:
+
+   "size" (the default) writes a backup once the diffs since the last backup
+   take up more space than a backup would; that's the rule we've always used.
+
+   "adaptive" also weighs the cost of replaying the chain of diffs: it writes a
+   backup once replaying the chain would cost more than NH4BACKUPREPLAYLIMIT
+   loads of the save (bytes decoded, counting the save each diff rebuilds), or
+   once the chain exceeds the share of the log that NH4BACKUPDISKBUDGET (a
+   percentage) allows to be spent on backups. A lower budget gives a smaller
+   log; a higher budget gives shorter seeks and less replaying. */
+
+struct backup_policy_state {
+    long save_size;             /* of the save we're about to log */
+    long backup_disk_size;      /* of the last save backup, in the log */
+    long chain_disk_size;       /* of the backup and diffs after it */
+    long chain_diffs;           /* number of diffs after the last backup */
+    long long chain_replay_cost;/* bytes rebuilt replaying those diffs */
+};
+
+struct backup_policy {
+    const char *name;
+    boolean (*want_backup)(const struct backup_policy_state *);
+};
+
+static boolean
+backup_policy_size(const struct backup_policy_state *bps)
+{
+    return bps->save_size < bps->chain_disk_size;
+}
+
+static int backup_replay_limit;
+static int backup_disk_budget;
+
+static boolean
+backup_policy_adaptive(const struct backup_policy_state *bps)
+{
+    if (bps->chain_replay_cost >=
+        (long long)backup_replay_limit * bps->save_size)
+        return TRUE;
+
+    /* Backups may use up backup_disk_budget% of the log, so the diffs after
+       each one may use up (100 - backup_disk_budget)%. */
+    return (long long)(bps->chain_disk_size - bps->backup_disk_size) *
+        backup_disk_budget >=
+        (long long)bps->backup_disk_size * (100 - backup_disk_budget);
+}
+
+static const struct backup_policy backup_policies[] = {
+    {"size", backup_policy_size},
+    {"adaptive", backup_policy_adaptive},
+};
+
+static const struct backup_policy *backup_policy = backup_policies;
+
+/* The part of the policy state that describes the log rather than the save.
+   This tracks the binary save, so it's only meaningful while the binary save
+   is allocated. */
+static struct backup_chain {
+    long backup_disk_size;
+    long chain_diffs;
+    long long chain_replay_cost;
+} backup_chain;
+
+/* Counters for how much work log_sync has to do; see nh_get_log_sync_stats. */
+static struct nh_log_sync_stats log_sync_stats;
+static long diffs_replayed, backups_loaded;
+
+static void
+set_backup_policy_options(void)
+{
+    const char *policy = nh_getenv("NH4BACKUPPOLICY");
+    int i;
+
+    backup_policy = backup_policies;
+    if (policy) {
+        for (i = 0; i < SIZE(backup_policies); i++)
+            if (!strcmp(policy, backup_policies[i].name))
+                break;
+        if (i < SIZE(backup_policies))
+            backup_policy = backup_policies + i;
+        else
+            paniclog("backup policy",
+                     msgprintf("unknown NH4BACKUPPOLICY '%s'", policy));
+    }
+
+    backup_replay_limit =
+        save_check_int_option("NH4BACKUPREPLAYLIMIT", 50, 1, INT_MAX / 2);
+    backup_disk_budget =
+        save_check_int_option("NH4BACKUPDISKBUDGET", 50, 1, 100);
+}
+
+/* Called whenever the binary save is set from a save backup. */
+static void
+backup_chain_restart(long backup_disk_size)
+{
+    backup_chain.backup_disk_size = backup_disk_size;
+    backup_chain.chain_diffs = 0;
+    backup_chain.chain_replay_cost = 0;
+}
+
+/* Called whenever a save diff is applied to the binary save. */
+static void
+backup_chain_extend(long save_size)
+{
+    backup_chain.chain_diffs++;
+    backup_chain.chain_replay_cost += save_size;
+}
+
+static boolean
+backup_policy_wants_backup(void)
+{
+    struct backup_policy_state bps = {
+        .save_size = program_state.binary_save.pos,
+        .backup_disk_size = backup_chain.backup_disk_size,
+        .chain_disk_size = program_state.gamestate_location -
+            program_state.save_backup_location,
+        .chain_diffs = backup_chain.chain_diffs,
+        .chain_replay_cost = backup_chain.chain_replay_cost,
+    };
+
+    return backup_policy->want_backup(&bps);
+}
+
+/* Records the work done by a log_sync call, given the counters and time from
+   when it started. */
+static void
+note_log_sync_done(long diffs_before, long backups_before, microseconds start)
+{
+    long diffs = diffs_replayed - diffs_before;
+
+    log_sync_stats.syncs++;
+    log_sync_stats.sync_time += utc_time() - start;
+    log_sync_stats.last_diffs = diffs;
+    if (diffs > log_sync_stats.max_diffs)
+        log_sync_stats.max_diffs = diffs;
+    log_sync_stats.total_diffs += diffs;
+    log_sync_stats.total_backups += backups_loaded - backups_before;
+}
+
+void
+nh_get_log_sync_stats(struct nh_log_sync_stats *stats)
+{
+    *stats = log_sync_stats;
+}
+
 /***** Log I/O *****/
 
 static int lvprintf(const char *fmt, va_list vargs) PRINTFLIKE(1,0);
@@ -640,6 +1258,9 @@ full_write(int fd, const void *buffer, int len)
 {
     int rv;
     long o = lseek(fd, 0, SEEK_CUR);
+
+    log_window_written(fd);
+
     errno = 0;
     rv = write(fd, buffer, len);
     if (rv < 0 && errno == EINTR) {
@@ -699,7 +1320,7 @@ log_binary(const char *buf, int buflen)
         return;
 
     b64buf = malloc(base64size(buflen));
-    base64_encode_binary((const unsigned char *)buf, b64buf, buflen);
+    base64_encode_binary((const unsigned char *)buf, b64buf, buflen, NULL, 0);
 
     /* don't use lprintf, b64buf might be too big for the buffer used by
        lprintf */
@@ -709,134 +1330,289 @@ log_binary(const char *buf, int buflen)
     free(b64buf);
 }
 
-/* Reads a line starting from the current file pointer. Returns NULL if the line
-   is incomplete or spos is past EOF, otherwise mallocs enough space for the
-   line and returns it. The file pointer is left at the newline, or in an
-   unpredictable location in case of error. */
-static char *
-lgetline_malloc(int fd)
+/* Writes a save diff or backup to the log, in the encoding that the log's
+   header asks for. If dict isn't NULL, the data is compressed against it. */
+static void
+log_save_data(const char *buf, int buflen, const char *dict, int dictlen)
 {
-    char *inbuf = NULL;
-    long inbuflen = 0;  /* number of bytes read */
-    long fpos = 0;      /* file pointer, relative to its original location */
-    void *nlloc = NULL;
-    boolean at_eof = FALSE;
+    char *encbuf;
 
-    do {
-        inbuflen += 4;
-        inbuflen *= 3;
-        inbuflen /= 2;
-        inbuf = realloc(inbuf, inbuflen);
-        if (!inbuf)
-            panic("Out of memory in lgetline_malloc");
-
-        /* Return values from read:
-           negative return = error
-           zero return = EOF
-           positive return = success, even if it didn't return as many
-           bytes as expected (in which case we must rerun read) */
-        inbuflen = read(fd, inbuf + fpos, inbuflen - fpos) + fpos;
-
-        /* Most errors are a problem. However, if the read is interrupted with
-           zero bytes read, then this is reported as an "error" EINTR rather
-           than a count of zero, so as to distinguish it from EOF. (This API
-           could have been better designed, really, but we're stuck with it
-           now.) */
-        at_eof = inbuflen == fpos;
-
-        if (inbuflen < fpos) {
-            if (errno != EINTR) {
-                free(inbuf);
-                return NULL;
-            }
-            inbuflen = fpos; /* we successfully read 0 bytes */
-        }
+    if (program_state.logfile == -1)
+        return;
 
-        /* We want to break out of the loop if we're at EOF (inbuflen ==
-           fpos) or if a newline was found. */
-        nlloc = memchr(inbuf, '\x0a', fpos);
-        if (at_eof)
-            break;
+    if (program_state.log_format == LF_BINARY) {
+        encbuf = malloc(raw_size(buflen));
+        raw_encode_binary((const unsigned char *)buf, encbuf, buflen,
+                          dict, dictlen);
+    } else {
+        encbuf = malloc(base64size(buflen));
+        base64_encode_binary((const unsigned char *)buf, encbuf, buflen,
+                             dict, dictlen);
+    }
 
-        fpos = inbuflen;
-    } while (!nlloc);
+    if (!full_write(program_state.logfile, encbuf, strlen(encbuf)))
+        panic("Could not write binary content to the log.");
 
-    if (!nlloc && fpos > 0) {
-        /* The save file ends with a partial line, something that should never
-           happen in normal operation (it indicates that a process crashed in
-           the middle of a write). Get rid of the partial line. */
+    free(encbuf);
+}
 
-        free(inbuf);
+/* Lines are read from the log via a read-ahead window, so that reading a line
+   normally costs no read() calls at all, rather than several (plus a seek back
+   over whatever was read past the end of the line).
 
-        /* Note: this assumes that fd is never 0 or -1. -1 is definitely a safe
-           assumption, we wouldn't reach here if the fd were invalid. TODO: 0
-           is possibly an unsafe assumption, if we're ever run from a client
-           that has no open FDs of its own and which has closed all the
-           standard handles. */
-        if (fd == program_state.logfile) {
-            log_recover_noreturn(get_log_last_newline(1),
-                                 "Save file ends with a partial line",
-                                 __FILE__, __LINE__);
-        } else {
-            /* Maybe there's no game loaded, in which case we shouldn't try to
-               recover it. This only happens from read_log_header.
-               Communicating with the user is a bad idea in this case, so we
-               just pretend the partial line doesn't exist.
-
-               (This is a pretty corner-case error condition; it can only happen
-               due to corruption in the first three lines of a file. The NULL
-               return here treats this the same way as if one of the first three
-               lines were missing, which is pretty much equivalent.) */
-            free(inbuf);
-            return NULL;
-        }
+   The window holds a copy of the file contents starting at window.start. It's
+   discarded whenever we write to the file. Other processes might write to it
+   too, unless we're the process playing the game; so in that case, we also
+   discard it if the file's inode, size, modification time or change time has
+   changed since the window was filled. The times are compared to the
+   nanosecond where the platform supports it; a write in the same second as
+   the fill that happens to leave the size alone would go unnoticed with
+   whole seconds. */
 
-    } else if (!nlloc && fpos == 0) {
-        /* At EOF, which is at the start of the line. */
-        free(inbuf);
-        return NULL;
-    }
+#define LOG_WINDOW_INITIAL_READ 4096
+#define LOG_WINDOW_READ 65536
 
-    /* We could trim inbuf down to size, but there's not a lot of point,
-       especially as in most cases it's going to be free'd almost
-       immediately. We must, however, undo the excess read via seeking the
-       cursor backwards to just after the final newline. */
-    *(char *)nlloc = '\0';
-    lseek(fd, ((char *)nlloc - inbuf) + 1 - fpos, SEEK_CUR);
+static struct {
+    int fd;             /* -1 if the window is empty */
+    char *buf;
+    long size;          /* bytes allocated for buf */
+    long start;         /* file offset of buf[0] */
+    long len;           /* bytes of buf that hold file contents */
+    struct stat file_st; /* what fstat() said when the window was filled */
+} log_window = {.fd = -1};
 
-    return inbuf;
+static void
+log_window_discard(void)
+{
+    log_window.fd = -1;
+    log_window.len = 0;
 }
 
-
-/* Returns the offset to the current file pointer in the log. */
-static long
-get_log_offset(void)
+/* Called before writing to fd. */
+static void
+log_window_written(int fd)
 {
-    return lseek(program_state.logfile, 0, SEEK_CUR);
+    if (fd == log_window.fd)
+        log_window_discard();
 }
 
-/* Returns the offset just past the end of the last valid line in the log.  This
-   is used to determine how much of the save file is meaningful after a process
-   crashes during a write.
-
-   If nth is 1, we get the last newline. nth as 2 gets the penultimate newline,
-   and so on. */
-static long
-get_log_last_newline(int nth)
+static boolean
+log_window_may_be_stale(int fd)
 {
-    long o = get_log_offset();
-    long rv;
-    char inchar[2] = {0, 0};
+    struct stat st;
+    const struct stat *old = &log_window.file_st;
 
-    if (!change_fd_lock(program_state.logfile, TRUE, LT_READ, 2))
-        panic("Could not upgrade to read lock on logfile");
+    if (fd == program_state.logfile && program_state.followmode == FM_PLAY)
+        return FALSE;
 
-    lseek(program_state.logfile, -1, SEEK_END);
+    if (fstat(fd, &st) < 0 || st.st_ino != old->st_ino ||
+        st.st_size != old->st_size)
+        return TRUE;
 
-    /* Run through the file backwards, reading one char at a time until we find
-       a newline. (This is rather less efficient than reading blocks at a time
-       and scanning them backwards, but the code is much simpler, and given that
-       this only runs in very exceptional circumstances and most lines are short
+#ifndef AIMAKE_BUILDOS_MSWin32
+    return st.st_mtim.tv_sec != old->st_mtim.tv_sec ||
+        st.st_mtim.tv_nsec != old->st_mtim.tv_nsec ||
+        st.st_ctim.tv_sec != old->st_ctim.tv_sec ||
+        st.st_ctim.tv_nsec != old->st_ctim.tv_nsec;
+#else
+    return st.st_mtime != old->st_mtime || st.st_ctime != old->st_ctime;
+#endif
+}
+
+/* Makes the window hold at least need bytes from offset pos onwards, unless
+   that would be past EOF. If it has to read, it tries to get want bytes. Returns
+   FALSE on I/O error. */
+static boolean
+log_window_fill(int fd, long pos, long need, long want)
+{
+    long keep = 0;
+    int rv;
+
+    if (log_window.fd == fd && pos >= log_window.start &&
+        pos <= log_window.start + log_window.len)
+        keep = log_window.start + log_window.len - pos;
+
+    if (keep >= need)
+        return TRUE;
+
+    if (keep == 0) {
+        if (fstat(fd, &log_window.file_st) < 0)
+            return FALSE;
+        log_window.fd = fd;
+    } else
+        memmove(log_window.buf, log_window.buf + (pos - log_window.start),
+                keep);
+
+    log_window.start = pos;
+    log_window.len = keep;
+
+    if (log_window.size < want) {
+        log_window.size = want;
+        log_window.buf = realloc(log_window.buf, log_window.size);
+        if (!log_window.buf)
+            panic("Out of memory in log_window_fill");
+    }
+
+    lseek(fd, pos + keep, SEEK_SET);
+    while (log_window.len < want) {
+        rv = read(fd, log_window.buf + log_window.len,
+                  want - log_window.len);
+        if (rv == 0)
+            break;
+        if (rv < 0) {
+            if (errno == EINTR)
+                continue;
+            log_window_discard();
+            return FALSE;
+        }
+        log_window.len += rv;
+    }
+
+    return TRUE;
+}
+
+/* Reads a line starting from the current file pointer. Returns NULL if the line
+   is incomplete or the file pointer is at EOF. Otherwise, returns the line
+   (with the newline replaced by a nul), and leaves the file pointer just past
+   the newline. The returned line is part of the read-ahead window, so it must
+   not be freed, and is only valid until the next time the log is read or
+   written. Callers may change the line, but must change it back. */
+static char *
+lgetline_view(int fd)
+{
+    long pos = lseek(fd, 0, SEEK_CUR);
+    long searched = 0;
+    long amount, avail;
+    char *line, *end;
+
+    if (log_window.fd != -1 &&
+        (log_window.fd != fd || log_window_may_be_stale(fd)))
+        log_window_discard();
+
+    amount = log_window.fd == fd ? LOG_WINDOW_READ : LOG_WINDOW_INITIAL_READ;
+
+    for (;;) {
+        if (!log_window_fill(fd, pos, searched + 1, searched + amount))
+            return NULL;
+
+        line = log_window.buf + (pos - log_window.start);
+        avail = log_window.start + log_window.len - pos;
+
+        /* A line ends at a newline, or at a nul if we've returned it before. */
+        for (end = line + searched; end < line + avail; end++)
+            if (*end == '\x0a' || *end == '\0')
+                break;
+
+        if (end < line + avail)
+            break;
+
+        if (avail == searched) {
+            /* We're at EOF. */
+            if (searched > 0 && fd == program_state.logfile) {
+                /* The save file ends with a partial line, something that should
+                   never happen in normal operation (it indicates that a process
+                   crashed in the middle of a write). Get rid of the partial
+                   line. */
+                log_recover_noreturn(get_log_last_newline(1),
+                                     "Save file ends with a partial line",
+                                     __FILE__, __LINE__);
+            }
+
+            /* Either we're at EOF at the start of a line, or there's no game
+               loaded (so we were called from read_log_header), in which case
+               communicating with the user is a bad idea; we just pretend the
+               partial line doesn't exist. (This is a pretty corner-case error
+               condition; it can only happen due to corruption in the first
+               three lines of a file. Returning NULL treats this the same way as
+               if one of the first three lines were missing, which is pretty
+               much equivalent.) */
+            return NULL;
+        }
+
+        searched = avail;
+        amount *= 2;
+    }
+
+    *end = '\0';
+    lseek(fd, pos + (end - line) + 1, SEEK_SET);
+    return line;
+}
+
+/* Like lgetline_view, but returns a copy of the line, which must be freed. */
+static char *
+lgetline_malloc(int fd)
+{
+    char *line = lgetline_view(fd);
+    char *rv;
+
+    if (!line)
+        return NULL;
+
+    rv = strdup(line);
+    if (!rv)
+        panic("Out of memory in lgetline_malloc");
+    return rv;
+}
+
+/* Moves the file pointer past the current line. Returns FALSE if there isn't a
+   complete line there. */
+static boolean
+lskipline(int fd)
+{
+    return lgetline_view(fd) != NULL;
+}
+
+/* Reads len bytes from the given file offset without moving the file
+   pointer, using the read-ahead window if it happens to hold them. */
+static boolean
+lpeek(int fd, long offset, void *buffer, int len)
+{
+    long o;
+    boolean rv;
+
+    if (log_window.fd == fd && !log_window_may_be_stale(fd) &&
+        offset >= log_window.start &&
+        offset + len <= log_window.start + log_window.len) {
+        memcpy(buffer, log_window.buf + (offset - log_window.start), len);
+        return TRUE;
+    }
+
+    o = lseek(fd, 0, SEEK_CUR);
+    rv = lseek(fd, offset, SEEK_SET) >= 0 && full_read(fd, buffer, len);
+    lseek(fd, o, SEEK_SET);
+    return rv;
+}
+
+
+/* Returns the offset to the current file pointer in the log. */
+static long
+get_log_offset(void)
+{
+    return lseek(program_state.logfile, 0, SEEK_CUR);
+}
+
+/* Returns the offset just past the end of the last valid line in the log.  This
+   is used to determine how much of the save file is meaningful after a process
+   crashes during a write.
+
+   If nth is 1, we get the last newline. nth as 2 gets the penultimate newline,
+   and so on. */
+static long
+get_log_last_newline(int nth)
+{
+    long o = get_log_offset();
+    long rv;
+    char inchar[2] = {0, 0};
+
+    if (!change_fd_lock(program_state.logfile, TRUE, LT_READ, 2))
+        panic("Could not upgrade to read lock on logfile");
+
+    lseek(program_state.logfile, -1, SEEK_END);
+
+    /* Run through the file backwards, reading one char at a time until we find
+       a newline. (This is rather less efficient than reading blocks at a time
+       and scanning them backwards, but the code is much simpler, and given that
+       this only runs in very exceptional circumstances and most lines are short
        it's unlikely to be a performance bottleneck.) */
     while (full_read(program_state.logfile, inchar, 1) &&
            (*inchar != '\n' || --nth))
@@ -876,7 +1652,6 @@ get_log_start_of_turn_offset(void)
 
     long o = get_log_offset();
     long rv;
-    void *save_diff_line;
 
     long loc = program_state.binary_save_location;
     if (program_state.emergency_recover_location)
@@ -889,15 +1664,11 @@ get_log_start_of_turn_offset(void)
        may as well handle it just in case it isn't), we treat it the same way as
        an incomplete line. */
 
-    save_diff_line = lgetline_malloc(program_state.logfile);
-
-    if (!save_diff_line)
+    if (!lskipline(program_state.logfile))
         log_recover_noreturn(get_log_last_newline(1),
                              "No save diff in binary save location",
                              __FILE__, __LINE__);
 
-    free(save_diff_line);
-
     /* Now return the offset we found, taking care to restore the file
        pointer. */
     rv = get_log_offset();
@@ -947,7 +1718,7 @@ start_updating_logfile(boolean ok_not_at_end)
     struct nh_game_info si;
     int recovery_count;
     int lstatus = read_log_header(program_state.logfile, &si,
-                                  &recovery_count, FALSE);
+                                  &recovery_count, NULL, FALSE);
 
     if (recovery_count != program_state.expected_recovery_count)
         terminate(RESTART_PLAY);
@@ -1000,6 +1771,7 @@ log_newgame(microseconds start_time)
 {
     char encbuf[ENCBUFSZ];
     const char *role;
+    const char *format = nh_getenv("NH4LOGFORMAT");
     long start_of_third_line;
 
     if (!change_fd_lock(program_state.logfile, TRUE, LT_WRITE, 2))
@@ -1017,8 +1789,17 @@ log_newgame(microseconds start_time)
     else
         role = roles[u.initrole].name.m;
 
-    lprintf("NHGAME %" STATUS_LEN_STR "." STATUS_LEN_STR "s "
+    /* The log format is chosen when the game is created, and stays the same
+       for the rest of the game (unless the log is converted offline). */
+    program_state.log_format = LF_TEXT;
+    if (format && !strcmp(format, "binary"))
+        program_state.log_format = LF_BINARY;
+    else if (format && strcmp(format, "text"))
+        paniclog("log format", msgprintf("unknown NH4LOGFORMAT '%s'", format));
+
+    lprintf("%s %" STATUS_LEN_STR "." STATUS_LEN_STR "s "
             "00000001 %d.%03d.%03d\x0a",
+            log_format_magic(program_state.log_format),
             status_string(LS_SAVED), VERSION_MAJOR, VERSION_MINOR, PATCHLEVEL);
     lprintf("%" SECOND_LOGLINE_LEN_STR "s\x0a", "(new game)");
     start_of_third_line = get_log_offset();
@@ -1099,6 +1880,8 @@ log_backup_save(void)
     if (program_state.logfile == -1)
         panic("log_backup_save called with no logfile");
 
+    collect_save_check(TRUE);
+
     if (!start_updating_logfile(TRUE)) {
         log_replay_save_line();
         return;
@@ -1109,15 +1892,32 @@ log_backup_save(void)
         mfree(&program_state.binary_save);
     mnew(&program_state.binary_save, NULL);
     program_state.binary_save_allocated = TRUE;
+    microseconds t = utc_time();
     savegame(&program_state.binary_save);
+    note_levels_saved();
+    log_sync_stats.save_time += utc_time() - t;
 
+    t = utc_time();
     long o = get_log_offset();
     boolean is_newgame = program_state.save_backup_location == 0;
+    const char *dict = NULL;
+    int dictlen = 0;
+
+    /* The first save backup is the dictionary for the others. */
+    if (is_newgame)
+        backup_dictionary_set_source(program_state.logfile, o);
+    else if (backup_dictionary_enabled)
+        dict = backup_dictionary_get(&dictlen);
+
     lprintf("*%08lx ", program_state.save_backup_location);
     program_state.save_backup_location = o;
     program_state.binary_save_location = o;
-    log_binary(program_state.binary_save.buf, program_state.binary_save.pos);
+    log_save_data(program_state.binary_save.buf, program_state.binary_save.pos,
+                  dict, dictlen);
     lprintf("\x0a");
+    backup_chain_restart(get_log_offset() - o);
+
+    backup_index_add(o, moves);
 
     /* Once per backup save is about the right rate to refresh this. */
     log_game_state_inner();
@@ -1127,19 +1927,18 @@ log_backup_save(void)
           program_state.last_save_backup_location_location, SEEK_SET);
     lprintf("%08lx", o);
     lseek(program_state.logfile, 0, SEEK_END);
+    log_sync_stats.diff_time += utc_time() - t;
+
+    t = utc_time();
+    boolean reload = check_new_binary_save(NULL, full_check_due(TRUE), FALSE);
 
     stop_updating_logfile(1);
 
     /* Verify that the save file loads correctly; it's better to fail fast
        than end up with a corrupted save. */
-    load_gamestate_from_binary_save(FALSE);
-}
-
-static noreturn void
-diff_error_at_neutral_turnstate(const char *message, char *diff)
-{
-    (void) diff;
-    panic("Corrupted diff added to save file: %s", message);
+    adopt_binary_save(reload);
+    log_sync_stats.check_time += utc_time() - t;
+    log_sync_stats.saves++;
 }
 
 void
@@ -1153,11 +1952,11 @@ log_neutral_turnstate(void)
         return;
     }
 
-    /* A heuristic to work out whether to use a save diff or save backup
-       line. */
-    if (program_state.binary_save.pos <
-        (program_state.gamestate_location - program_state.save_backup_location)
-        || !program_state.ok_to_diff)
+    collect_save_check(TRUE);
+
+    /* Work out whether to use a save diff or save backup line. */
+    if (!program_state.ok_to_diff || !binary_save_intact() ||
+        backup_policy_wants_backup())
 
         log_backup_save();
 
@@ -1180,30 +1979,33 @@ log_neutral_turnstate(void)
         program_state.binary_save_location = 0;
 
         /* Save the game, and calculate a diff against the old location in
-           the process. */
+           the process. (If the save will be checked for out-of-date levels,
+           levels that haven't changed are copied from the old binary save.) */
+        microseconds t = utc_time();
+        boolean full = full_check_due(FALSE);
+        program_state.copy_unchanged_levels = stale_level_check_async(full);
         savegame(&program_state.binary_save);
+        boolean levels_copied = program_state.copy_unchanged_levels;
+        program_state.copy_unchanged_levels = FALSE;
+        note_levels_saved();
+        log_sync_stats.save_time += utc_time() - t;
 
+        t = utc_time();
         program_state.binary_save_location = get_log_offset();
 
         mdiffflush(&program_state.binary_save, 1);
 
         lprintf("~");
-        log_binary(program_state.binary_save.diffbuf,
-                   program_state.binary_save.diffpos);
+        log_save_data(program_state.binary_save.diffbuf,
+                      program_state.binary_save.diffpos, NULL, 0);
         lprintf("\x0a");
+        backup_chain_extend(program_state.binary_save.pos);
+        log_sync_stats.diff_time += utc_time() - t;
 
         /* Verify that the diffing algorithm is working correctly; we don't
            want to corrupt the save in a way that can't be recovered. */
-        {
-            struct memfile checkmf;
-            mnew(&checkmf, NULL);
-            mdiffapply(program_state.binary_save.diffbuf,
-                       program_state.binary_save.diffpos, &mf,
-                       &checkmf, diff_error_at_neutral_turnstate);
-            if (!mequal(&checkmf, &program_state.binary_save, NULL))
-                panic("Corrupted diff added to save file");
-            mfree(&checkmf);
-        }
+        t = utc_time();
+        boolean reload = check_new_binary_save(&mf, full, levels_copied);
 
         /* Make the new binary save absolute rather than relative, so that
            we can free the old one. */
@@ -1213,12 +2015,66 @@ log_neutral_turnstate(void)
         stop_updating_logfile(1);
 
         /* Check the gamestate, for the same reason as in log_backup_save(). */
-        load_gamestate_from_binary_save(FALSE);
+        adopt_binary_save(reload);
+        log_sync_stats.check_time += utc_time() - t;
+        log_sync_stats.saves++;
 
         program_state.emergency_recover_location = 0;
     }
 }
 
+/* When watching, we can outrace the process that's playing the game, and need
+   to wait for it to write more to the logfile. On Linux, we use inotify to wake
+   up as soon as the file changes; elsewhere, we just sleep for a bit. Either
+   way, this returns FALSE after waiting 100ms with no sign of a change, and
+   TRUE if the logfile may have changed (the caller should look again). */
+#ifdef AIMAKE_BUILDOS_linux
+static int logfile_inotify_fd = -1;
+#endif
+
+static boolean
+wait_for_logfile_change(void)
+{
+#ifdef AIMAKE_BUILDOS_linux
+    char path[64], events[4096];
+    struct pollfd pfd;
+    int ret;
+
+    if (logfile_inotify_fd == -1) {
+        /* The watch needs a path, and we only have a file descriptor; /proc
+           gives us a path that leads to the same file. */
+        snprintf(path, sizeof path, "/proc/self/fd/%d", program_state.logfile);
+        logfile_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (logfile_inotify_fd != -1 &&
+            inotify_add_watch(logfile_inotify_fd, path, IN_MODIFY) == -1) {
+            close(logfile_inotify_fd);
+            logfile_inotify_fd = -2;    /* don't try again */
+        }
+
+        /* The file might have changed before the watch was set up. */
+        if (logfile_inotify_fd >= 0)
+            return TRUE;
+    }
+
+    if (logfile_inotify_fd >= 0) {
+        pfd.fd = logfile_inotify_fd;
+        pfd.events = POLLIN;
+        ret = poll(&pfd, 1, 100);
+        if (ret > 0)
+            while (read(logfile_inotify_fd, events, sizeof events) > 0)
+                ;
+        return ret != 0;
+    }
+#endif
+
+#ifndef WIN32
+    /* Don't bother sleeping on Windows; this situation should be impossible
+       anyway because watching doesn't work there */
+    nanosleep(&(struct timespec){.tv_nsec = 100000000}, NULL);
+#endif
+    return FALSE;
+}
+
 /* Update turntime in a manner that's safe within the log. */
 void
 log_time_line(void)
@@ -1243,13 +2099,9 @@ log_time_line(void)
             if (!log_replay_input(1, "+%" SCNxLEAST64, &timediff))
                 log_replay_no_more_options();
         } else if (program_state.followmode == FM_WATCH) {
-            if (tries-- == 0)
+            /* only waits that timed out count against the 3 seconds */
+            if (!wait_for_logfile_change() && tries-- == 0)
                 panic("No time line in save file");
-#ifndef WIN32
-            /* Don't bother sleeping on Windows; this situation should be
-               impossible anyway because watching doesn't work there */
-            nanosleep(&(struct timespec){.tv_nsec = 100000000}, NULL);
-#endif
             continue;
         } else {
             timediff = time_for_time_line() - flags.turntime;
@@ -1445,7 +2297,9 @@ log_record_command(const char *cmd, const struct nh_cmd_arg *arg)
 
 /***** Reading the log *****/
 
-/* Called when reading non-command input from the log. This is idempotent. */
+/* Called when reading non-command input from the log. This is idempotent. The
+   return value is a view into the log (see lgetline_view), so callers must not
+   free it. */
 static char *
 start_replaying_logfile(char firstchar)
 {
@@ -1463,7 +2317,7 @@ start_replaying_logfile(char firstchar)
     lseek(program_state.logfile,
           program_state.end_of_gamestate_location, SEEK_SET);
 
-    logline = lgetline_malloc(program_state.logfile);
+    logline = lgetline_view(program_state.logfile);
 
     if (!change_fd_lock(program_state.logfile, TRUE, LT_MONITOR, 2))
         panic("Could not downgrade to monitor lock on logfile");
@@ -1477,9 +2331,7 @@ start_replaying_logfile(char firstchar)
     if (logline && firstchar && firstchar != *logline) {
         /* Desync: the log contains one sort of input, but the engine is
            requesting another. */
-        char c = *logline;
-        free(logline);
-        log_desync(c, firstchar);
+        log_desync(*logline, firstchar);
     }
 
     return logline;
@@ -1491,11 +2343,8 @@ log_want_replay(char firstchar)
     if (program_state.in_zero_time_command)
         return FALSE;         /* can happen while replaying */
 
-    char *logline = start_replaying_logfile(firstchar);
-    if (logline) {
-        free(logline);
+    if (start_replaying_logfile(firstchar))
         return TRUE;
-    }
 
     if (program_state.followmode == FM_REPLAY) {
         /* We can't continue through the normal codepath. Let the client
@@ -1571,8 +2420,6 @@ log_replay_bones(struct memfile *mf)
 
     stop_replaying_logfile();
 
-    free(logline);
-
     return TRUE;
 }
 
@@ -1618,10 +2465,8 @@ log_replay_input(int count, const char *fmt, ...)
     /* Does the format line parse all the characters in logline? */
     actual_count = -1;
     sscanf(logline, fmtbuf, &actual_count);
-    if (strlen(logline) != actual_count) {
-        free(logline);
+    if (strlen(logline) != actual_count)
         return FALSE;
-    }
 
     /* OK, now make sure there's enough input in logline to assign to all
        the arguments. */
@@ -1629,8 +2474,6 @@ log_replay_input(int count, const char *fmt, ...)
     actual_count = vsscanf(logline, fmt, vargs);
     va_end(vargs);
 
-    free(logline);
-
     if (count != actual_count)
         return FALSE;
 
@@ -1653,8 +2496,6 @@ log_replay_line(const char **buf)
 
     stop_replaying_logfile();
 
-    free(logline);
-
     return TRUE;
 }
 
@@ -1699,19 +2540,15 @@ log_replay_menu(boolean isobjmenu, void *el)
 
         if (*lp == ',') {
 
-            if (!isobjmenu) {
-                free(logline);
+            if (!isobjmenu)
                 error_reading_save("non-obj menu has counts\n");
-            }
 
             lp++;
             count = parse_decimal_number(&lp);
         }
 
-        if (*lp != ':' && *lp) {
-            free(logline);
+        if (*lp != ':' && *lp)
             error_reading_save("bad number format in menu\n");
-        }
 
         if (isobjmenu) {
             orl = xrealloc(&turnstate.message_chain, orl,
@@ -1730,8 +2567,6 @@ log_replay_menu(boolean isobjmenu, void *el)
 
     stop_replaying_logfile();
 
-    free(logline);
-
     if (isobjmenu)
         *objresultlist = orl;
     else
@@ -1759,11 +2594,8 @@ log_replay_command(struct nh_cmd_and_arg *cmd)
                 return FALSE;
         }
 
-        if (*logline < 'a' || *logline > 'z') {
-            c = *logline;
-            free(logline);
-            log_desync(c, 'a');
-        }
+        if (*logline < 'a' || *logline > 'z')
+            log_desync(*logline, 'a');
     }
 
     program_state.eof_reached = FALSE;
@@ -1791,10 +2623,8 @@ log_replay_command(struct nh_cmd_and_arg *cmd)
         case 'P':
             cmd->arg.argtype |= CMD_ARG_POS;
             cmd->arg.pos.x = parse_decimal_number(&lp);
-            if (*(lp++) != ',') {
-                free(logline);
+            if (*(lp++) != ',')
                 error_reading_save("No comma in position argument\n");
-            }
             cmd->arg.pos.y = parse_decimal_number(&lp);
             break;
 
@@ -1831,15 +2661,12 @@ log_replay_command(struct nh_cmd_and_arg *cmd)
             break;
 
         default:
-            free(logline);
             error_reading_save("Unrecognised command argument\n");
         }
     }
 
     stop_replaying_logfile();
 
-    free(logline);
-
     return TRUE;
 }
 
@@ -1849,7 +2676,7 @@ log_replay_command(struct nh_cmd_and_arg *cmd)
 noreturn void
 log_replay_no_more_options(void)
 {
-    free(start_replaying_logfile(0));
+    start_replaying_logfile(0);
     log_desync('?', '?');
 }
 
@@ -1857,30 +2684,39 @@ log_replay_no_more_options(void)
 
 /* Code common to nh_get_savegame_status and log loading */
 static enum nh_log_status
-read_log_header(int fd, struct nh_game_info *si,
-                int *recovery_count, boolean do_locking)
+read_log_header(int fd, struct nh_game_info *si, int *recovery_count,
+                enum nh_log_format *format, boolean do_locking)
 {
     char *logline, *p;
     char namebuf[65]; /* matches %64s later */
+    char magicbuf[7]; /* matches %6s later */
     char statusbuf[STATUS_LEN + 1];
+    enum nh_log_format log_format;
     int playmode, version_major, version_minor, version_patchlevel;
     enum nh_log_status result;
 
     if (do_locking && !change_fd_lock(fd, FALSE, LT_READ, 1))
         return LS_IN_PROGRESS;
 
+    /* The header is where other processes make changes that don't alter the
+       length of the file, so make sure we see them. */
+    log_window_discard();
+
     lseek(fd, 0, SEEK_SET);
     logline = lgetline_malloc(fd);
     if (!logline)
         goto invalid_log;
 
-    if (sscanf(logline, "NHGAME %" STATUS_LEN_STR "s %8x %d.%3d.%3d", statusbuf,
-               recovery_count, &version_major, &version_minor,
-               &version_patchlevel) != 5)
+    if (sscanf(logline, "%" LOG_MAGIC_LEN_STR "s %" STATUS_LEN_STR
+               "s %8x %d.%3d.%3d", magicbuf, statusbuf, recovery_count,
+               &version_major, &version_minor, &version_patchlevel) != 6)
         goto invalid_logline;
 
     free(logline);
 
+    if ((log_format = log_format_from_magic(magicbuf)) == LF_INVALID)
+        goto invalid_log;
+
     if ((result = status_from_string(statusbuf)) == LS_INVALID)
         goto invalid_log;
 
@@ -1915,6 +2751,8 @@ read_log_header(int fd, struct nh_game_info *si,
 
     si->playmode = playmode;
     base64_decode(namebuf, si->name, sizeof (si->name));
+    if (format)
+        *format = log_format;
 
     if (do_locking)
         change_fd_lock(fd, FALSE, LT_NONE, 0);
@@ -1935,12 +2773,195 @@ nh_get_savegame_status(int fd, struct nh_game_info *si)
     int dummy2;
     if (!si)
         si = &dummy;
-    return read_log_header(fd, si, &dummy2, TRUE);
+    return read_log_header(fd, si, &dummy2, NULL, TRUE);
+}
+
+
+/***** Converting between log formats *****/
+
+/* Writes a line to outfd consisting of the given prefix, followed by the given
+   save diff or backup data re-encoded into the given format. Data that was
+   compressed against the save backup dictionary stays that way. */
+static boolean
+convert_save_data_line(int outfd, const char *prefix, const char *data,
+                       enum nh_log_format format)
+{
+    int len = log_data_exact_len(data);
+    const char *dict = NULL;
+    int dictlen = 0;
+    char *decoded, *encoded;
+    boolean rv;
+
+    /* base64_decode may write a couple of bytes of padding and a nul past
+       the end of the data, so leave it room to do so. */
+    decoded = malloc(len + 3);
+    log_data_decode(data, decoded, len + 3);
+
+    if (*data == '&')
+        dict = backup_dictionary_get(&dictlen);
+
+    if (format == LF_BINARY) {
+        encoded = malloc(raw_size(len));
+        raw_encode_binary((const unsigned char *)decoded, encoded, len,
+                          dict, dictlen);
+    } else {
+        encoded = malloc(base64size(len));
+        base64_encode_binary((const unsigned char *)decoded, encoded, len,
+                             dict, dictlen);
+    }
+    free(decoded);
+
+    rv = full_write(outfd, prefix, strlen(prefix)) &&
+        full_write(outfd, encoded, strlen(encoded)) &&
+        full_write(outfd, "\x0a", 1);
+
+    free(encoded);
+    return rv;
+}
+
+/* Copies the log in infd to outfd (which should be a newly created file),
+   rewriting its save diffs and backups in the given format; everything else is
+   copied unchanged. The save backup chain is rebuilt to match the new offsets,
+   and a partial line at the end of the input is dropped, as recovery would.
+   This is used to move existing games to the binary format, or to move binary
+   logs back to text for versions and tools that only understand that.
+
+   This must not be called while a game is running; it reports a corrupted
+   input log the same way as loading one would. Returns FALSE if the input
+   isn't a valid log, or on I/O error. */
+nh_bool
+nh_convert_savegame(int infd, int outfd, enum nh_log_format format)
+{
+    struct nh_game_info si;
+    int recovery_count, i;
+    char *line;
+    char buf[BUFSZ];
+    long o;
+    volatile long first_backup = -1, prev_backup = 0;
+    volatile boolean rv = FALSE;
+
+    API_ENTRY_CHECKPOINT() {
+    IF_ANY_API_EXCEPTION():
+        change_fd_lock(infd, FALSE, LT_NONE, 0);
+        log_window_discard();
+        backup_dictionary_clear();
+        return FALSE;
+    }
+
+    if (format != LF_TEXT && format != LF_BINARY)
+        goto out;
+
+    if (!change_fd_lock(infd, FALSE, LT_READ, 1))
+        goto out;
+
+    log_window_discard();
+    if (read_log_header(infd, &si, &recovery_count, NULL, FALSE) == LS_INVALID)
+        goto unlock;
+
+    /* The header lines are copied as-is, apart from the first word. */
+    lseek(infd, 0, SEEK_SET);
+    for (i = 0; i < 3; i++) {
+        line = lgetline_view(infd);
+        if (!line)
+            goto unlock;
+        if (i == 0) {
+            if (!full_write(outfd, log_format_magic(format),
+                            strlen(LOG_MAGIC_TEXT)))
+                goto unlock;
+            line += strlen(LOG_MAGIC_TEXT);
+        }
+        if (!full_write(outfd, line, strlen(line)) ||
+            !full_write(outfd, "\x0a", 1))
+            goto unlock;
+    }
+
+    /* The first save backup comes straight after the header. */
+    backup_dictionary_set_source(infd, lseek(infd, 0, SEEK_CUR));
+
+    while ((line = lgetline_view(infd))) {
+        o = lseek(outfd, 0, SEEK_CUR);
+
+        if (*line == '*') {
+            /* The first save backup points to the last, which we don't know
+               yet; every other backup points to the one before it. */
+            snprintf(buf, sizeof buf, "*%08lx ", prev_backup);
+            if (strlen(line) < 10 ||
+                !convert_save_data_line(outfd, buf, line + 10, format))
+                goto unlock;
+            if (first_backup < 0)
+                first_backup = o;
+            prev_backup = o;
+        } else if (*line == '~') {
+            if (!convert_save_data_line(outfd, "~", line + 1, format))
+                goto unlock;
+        } else if (!full_write(outfd, line, strlen(line)) ||
+                   !full_write(outfd, "\x0a", 1))
+            goto unlock;
+    }
+
+    /* Now we know where the last save backup went, point the first at it. */
+    if (first_backup >= 0) {
+        snprintf(buf, sizeof buf, "%08lx", prev_backup);
+        if (lseek(outfd, first_backup + 1, SEEK_SET) < 0 ||
+            !full_write(outfd, buf, 8))
+            goto unlock;
+        lseek(outfd, 0, SEEK_END);
+    }
+
+    rv = TRUE;
+
+unlock:
+    change_fd_lock(infd, FALSE, LT_NONE, 0);
+    log_window_discard();
+    backup_dictionary_clear();
+out:
+    API_EXIT();
+    return rv;
 }
 
 
 /***** Gamestate handling *****/
 
+/* Points the gamestate location at the binary save location. */
+static void
+set_gamestate_location_from_binary_save(void)
+{
+    program_state.gamestate_location = program_state.binary_save_location;
+    lseek(program_state.logfile, program_state.binary_save_location,
+          SEEK_SET);
+    lskipline(program_state.logfile);
+    program_state.end_of_gamestate_location = get_log_offset();
+}
+
+/* The binary save at the given location doesn't load correctly. */
+static noreturn void
+recover_from_bad_binary_save(long location, const char *message,
+                             const char *file, int line)
+{
+    /* To recover from this, we need to go back to the binary save before the
+       one we were trying to load. log_sync rounds down. */
+    log_sync(location - 1, TLU_BYTES, TRUE);
+    lseek(program_state.logfile, location, SEEK_SET);
+    lskipline(program_state.logfile);
+    log_recover_noreturn(get_log_offset(), message, file, line);
+}
+
+/* Replaces the gamestate with the one in the binary save, then saves it again
+   into a new memfile, which the caller must free. */
+static void
+reload_binary_save(struct memfile *mf)
+{
+    /* Load the saved game. */
+    freedynamicdata();
+    init_data(FALSE);
+    startup_common(FALSE);
+    dorecover(&program_state.binary_save);
+
+    /* Save the loaded game. */
+    mnew(mf, NULL);
+    savegame(mf);
+}
+
 /* Sets the gamestate pointer and the actual gamestate from the binary save
    pointer and binary save. This function restores the gamestate-related
    program_state invariants. It also ensures that the binary save is correctly
@@ -1958,21 +2979,8 @@ load_gamestate_from_binary_save(boolean maybe_old_version)
     struct memfile mf;
     const char *mequal_message;
 
-    /* Load the saved game. */
-    program_state.gamestate_location = program_state.binary_save_location;
-    lseek(program_state.logfile, program_state.binary_save_location,
-          SEEK_SET);
-    free(lgetline_malloc(program_state.logfile));
-    program_state.end_of_gamestate_location = get_log_offset();
-
-    freedynamicdata();
-    init_data(FALSE);
-    startup_common(FALSE);
-    dorecover(&program_state.binary_save);
-
-    /* Save the loaded game. */
-    mnew(&mf, NULL);
-    savegame(&mf);
+    set_gamestate_location_from_binary_save();
+    reload_binary_save(&mf);
 
     if (!mequal(&program_state.binary_save, &mf, maybe_old_version ? NULL :
                 &mequal_message)) {
@@ -1983,20 +2991,416 @@ load_gamestate_from_binary_save(boolean maybe_old_version)
             return;
         }
 
-        /* To recover from this, we need to go back to the binary save before
-           the one we were trying to load. log_sync rounds down. */
-        log_sync(program_state.binary_save_location - 1, TLU_BYTES, TRUE);
-        lseek(program_state.logfile, program_state.binary_save_location,
-              SEEK_SET);
-        free(lgetline_malloc(program_state.logfile));
-        log_recover_noreturn(get_log_offset(), mequal_message,
-                             __FILE__, __LINE__);
+        recover_from_bad_binary_save(program_state.binary_save_location,
+                                     mequal_message, __FILE__, __LINE__);
     }
 
     /* Replace the old save file with the new save file. */
     mfree(&program_state.binary_save);
     program_state.binary_save = mf;
     program_state.ok_to_diff = TRUE;
+    note_levels_saved();
+    note_full_check();
+}
+
+/* Checking new binary saves.
+
+   A save that doesn't load correctly is much easier to recover from if we
+   notice straight away, so each binary save we write is checked:
+
+   * a save diff must reproduce the save it was calculated from;
+   * levels copied over from the previous binary save must be the same as
+     saving them from scratch would produce;
+   * the save must load, and saving the loaded game must produce an identical
+     save.
+
+   The last two checks (the "full check") are expensive, because they amount to
+   saving the whole game and rebuilding it from scratch. They're always done for
+   save backups, but for save diffs, they can be limited to every N turns
+   (NH4RELOADINTERVAL, default 1), plus whenever the player has changed level
+   since the last full check (unless NH4RELOADLEVELCHANGE is "no"), plus a
+   random P percent of the remaining diffs (NH4RELOADSAMPLE, default 0). In
+   between full checks, we keep a CRC of the whole binary save, so that if it's
+   changed in memory by the time we next diff against it, we can make a save
+   backup instead. This is a substitute for the full check, not a cheaper
+   version of it: it doesn't look at the structure of the save at all, so it
+   can't notice a save that wouldn't load, a save that loads differently from
+   the gamestate it came from, or a level that was copied when it had changed
+   (only the diff round-trip check runs on every diff).
+
+   Checking for out-of-date levels means saving the game a second time without
+   copying anything, which would double the cost of a synchronous full check.
+   So levels are only copied when that check will be made off the critical
+   path: in "async" mode, for saves that get a full check. Everything else
+   saves every level from scratch, so that a level is never copied without
+   being checked.
+
+   In "paranoid" mode (the default), the checks happen before the next command
+   is accepted, and after a full check, the gamestate is replaced with the one
+   that was loaded from the save. In "async" mode, the checks are done by a
+   forked child process against its copy of the gamestate, and the playing
+   process carries on with the gamestate it has; the result is collected before
+   the next save is made (so that there's never more than one check in
+   progress), or when the game is closed. The mode is set via the NH4SAVECHECK
+   environment variable.
+
+   The server sets all these environment variables from its configuration
+   file. */
+
+enum save_check_mode {
+    SCM_PARANOID,
+    SCM_ASYNC,
+};
+
+enum save_check_result {
+    SCR_OK = EXIT_SUCCESS,
+    SCR_ERROR = EXIT_FAILURE,   /* terminate() was called while checking */
+    SCR_BAD_DIFF,
+    SCR_STALE_LEVEL,
+    SCR_BAD_RELOAD,
+    SCR_CRASHED,
+};
+
+static enum save_check_mode save_check_mode = SCM_PARANOID;
+static int reload_check_interval = 1;
+static int reload_check_sample = 0;
+static boolean reload_check_level_change = TRUE;
+
+static long last_full_check_moves;
+static d_level last_full_check_uz;
+static unsigned long sample_seed;
+
+static uLong binary_save_crc;
+static long binary_save_crc_location = -1;
+
+#ifndef AIMAKE_BUILDOS_MSWin32
+static pid_t save_check_pid = 0;       /* 0 if no check is in progress */
+static long save_check_location;       /* the binary save being checked */
+#endif
+
+static const char *
+save_check_result_string(enum save_check_result result)
+{
+    switch (result) {
+    case SCR_OK:
+        return "save file is correct";
+    case SCR_ERROR:
+        return "error while checking the save file";
+    case SCR_BAD_DIFF:
+        return "corrupted diff added to save file";
+    case SCR_STALE_LEVEL:
+        return "out-of-date level copied into save file";
+    case SCR_BAD_RELOAD:
+        return "save file does not reload correctly";
+    case SCR_CRASHED:
+        return "save check process crashed";
+    }
+    return "unknown save check result";
+}
+
+static int
+save_check_int_option(const char *name, int def, int min, int max)
+{
+    const char *val = nh_getenv(name);
+    char *end;
+    long l;
+
+    if (!val)
+        return def;
+
+    l = strtol(val, &end, 10);
+    if (!*val || *end || l < min || l > max) {
+        paniclog("save check", msgprintf("bad value '%s' for %s", val, name));
+        return def;
+    }
+
+    return l;
+}
+
+static void
+set_save_check_options(void)
+{
+    const char *mode = nh_getenv("NH4SAVECHECK");
+    const char *level_change = nh_getenv("NH4RELOADLEVELCHANGE");
+
+    save_check_mode = SCM_PARANOID;
+    if (mode && !strcmp(mode, "async"))
+        save_check_mode = SCM_ASYNC;
+    else if (mode && strcmp(mode, "paranoid"))
+        paniclog("save check", msgprintf("unknown NH4SAVECHECK mode '%s'",
+                                         mode));
+
+    reload_check_interval =
+        save_check_int_option("NH4RELOADINTERVAL", 1, 1, INT_MAX);
+    reload_check_sample = save_check_int_option("NH4RELOADSAMPLE", 0, 0, 100);
+    reload_check_level_change = !level_change || strcmp(level_change, "no");
+
+    /* This mustn't use the game's RNG; which diffs get a full check isn't
+       recorded anywhere, so it mustn't affect the gamestate. */
+    sample_seed = (unsigned long)time(NULL);
+#ifndef AIMAKE_BUILDOS_MSWin32
+    sample_seed ^= (unsigned long)getpid() << 16;
+#endif
+
+    binary_save_crc_location = -1;
+    program_state.copy_unchanged_levels = FALSE;
+}
+
+/* Called when the gamestate has just been fully checked, either by loading it
+   from the binary save or in a save check process. */
+static void
+note_full_check(void)
+{
+    last_full_check_moves = moves;
+    last_full_check_uz = u.uz;
+}
+
+static boolean
+full_check_due(boolean is_backup)
+{
+    if (is_backup || reload_check_interval <= 1 ||
+        moves - last_full_check_moves >= reload_check_interval)
+        return TRUE;
+
+    if (reload_check_level_change && !on_level(&u.uz, &last_full_check_uz))
+        return TRUE;
+
+    if (reload_check_sample) {
+        /* xorshift; quality isn't very important here */
+        sample_seed ^= sample_seed << 13;
+        sample_seed ^= sample_seed >> 7;
+        sample_seed ^= sample_seed << 17;
+        return (sample_seed & 0xffffffffUL) % 100 < reload_check_sample;
+    }
+
+    return FALSE;
+}
+
+/* Whether a save with the given full_check_due() result will be checked for
+   out-of-date levels by a save check process, so that it's worth copying
+   levels into it. */
+static boolean
+stale_level_check_async(boolean full)
+{
+    return full && save_check_mode == SCM_ASYNC;
+}
+
+static void
+note_binary_save_crc(void)
+{
+    binary_save_crc = crc32(0, (const Bytef *)program_state.binary_save.buf,
+                            program_state.binary_save.pos);
+    binary_save_crc_location = program_state.binary_save_location;
+}
+
+/* Returns FALSE if the binary save has changed in memory since we last saw it,
+   meaning that it isn't safe to diff against. */
+static boolean
+binary_save_intact(void)
+{
+    if (binary_save_crc_location != program_state.binary_save_location)
+        return TRUE; /* we don't know what it should be */
+
+    if (crc32(0, (const Bytef *)program_state.binary_save.buf,
+              program_state.binary_save.pos) == binary_save_crc)
+        return TRUE;
+
+    paniclog("save check", "binary save changed in memory");
+    return FALSE;
+}
+
+static noreturn void
+diff_error_at_neutral_turnstate(const char *message, char *diff)
+{
+    (void) diff;
+    panic("Corrupted diff added to save file: %s", message);
+}
+
+/* The checks that don't involve reloading the save. diff_base is the binary
+   save that the new binary save was diffed against. The check for out-of-date
+   levels is expensive, so is only done if check_stale is set. */
+static enum save_check_result
+check_save_diff(struct memfile *diff_base, boolean check_stale,
+                void (*errfunction)(const char *, char *),
+                const char **reason)
+{
+    struct memfile checkmf;
+    enum save_check_result result = SCR_OK;
+
+    *reason = save_check_result_string(SCR_OK);
+
+    mnew(&checkmf, NULL);
+    mdiffapply(program_state.binary_save.diffbuf,
+               program_state.binary_save.diffpos, diff_base,
+               &checkmf, errfunction);
+    if (!mequal(&checkmf, &program_state.binary_save, NULL)) {
+        *reason = save_check_result_string(SCR_BAD_DIFF);
+        result = SCR_BAD_DIFF;
+    }
+    mfree(&checkmf);
+
+    if (result != SCR_OK || !check_stale)
+        return result;
+
+    /* Saving with nothing to be relative to means no levels are copied. */
+    mnew(&checkmf, NULL);
+    savegame(&checkmf);
+    if (!mequal(&program_state.binary_save, &checkmf, reason))
+        result = SCR_STALE_LEVEL;
+    mfree(&checkmf);
+
+    return result;
+}
+
+#ifndef AIMAKE_BUILDOS_MSWin32
+static noreturn void
+diff_error_in_save_check(const char *message, char *diff)
+{
+    (void) diff;
+    paniclog("save check", message);
+    _exit(SCR_BAD_DIFF);
+}
+
+static noreturn void
+save_check_process(struct memfile *diff_base, boolean full,
+                   boolean levels_copied)
+{
+    struct memfile mf;
+    const char *reason;
+    enum save_check_result result = SCR_OK;
+
+    program_state.in_save_check_process = TRUE;
+    program_state.logfile = -1;
+
+    /* The server catches SIGSEGV to report the crash to its client, which isn't
+       something that this process should be doing. */
+    signal(SIGSEGV, SIG_DFL);
+
+    dlb_reinit_after_fork();
+
+    if (diff_base)
+        result = check_save_diff(diff_base, levels_copied,
+                                 diff_error_in_save_check, &reason);
+
+    if (result == SCR_OK && full) {
+        reload_binary_save(&mf);
+        if (!mequal(&program_state.binary_save, &mf, &reason))
+            result = SCR_BAD_RELOAD;
+    }
+
+    if (result != SCR_OK)
+        paniclog("save check", reason);
+
+    _exit(result);
+}
+#endif
+
+/* Checks the binary save that was just written to the log. diff_base is the
+   binary save it was diffed against, or NULL for a save backup; full is the
+   result of full_check_due() for it; levels_copied is set if levels could have
+   been copied from diff_base rather than saved. This is called while the
+   logfile is still being updated; the return value should be passed to
+   adopt_binary_save() once it isn't. */
+static boolean
+check_new_binary_save(struct memfile *diff_base, boolean full,
+                      boolean levels_copied)
+{
+    const char *reason;
+
+#ifndef AIMAKE_BUILDOS_MSWin32
+    if (save_check_mode == SCM_ASYNC) {
+        pid_t pid = fork();
+        if (pid == 0)
+            save_check_process(diff_base, full, levels_copied);
+        if (pid > 0) {
+            save_check_pid = pid;
+            save_check_location = program_state.binary_save_location;
+            if (full)
+                note_full_check();
+            return FALSE;
+        }
+        /* If we couldn't fork, check synchronously instead (including for
+           out-of-date levels, before the save can be reloaded). */
+    }
+#endif
+
+    if (diff_base) {
+        switch (check_save_diff(diff_base, levels_copied,
+                                diff_error_at_neutral_turnstate, &reason)) {
+        case SCR_OK:
+            break;
+        case SCR_STALE_LEVEL:
+            panic("Out-of-date level copied into save file: %s", reason);
+        default:
+            panic("Corrupted diff added to save file");
+        }
+    }
+
+    return full;
+}
+
+/* Makes the binary save that was just written the current gamestate; if
+   reload is set, by loading it, otherwise by keeping the gamestate we have
+   (because it was saved successfully and the full check isn't due, or because
+   another process is checking it). */
+static void
+adopt_binary_save(boolean reload)
+{
+    if (reload)
+        load_gamestate_from_binary_save(FALSE);
+    else {
+        set_gamestate_location_from_binary_save();
+        program_state.ok_to_diff = TRUE;
+    }
+
+    note_binary_save_crc();
+}
+
+/* Waits for the save check in progress, if any, to finish. If it found a
+   problem, we recover the same way as if the check had been done at the time
+   (if can_recover is set; otherwise, all we can do is record the problem in
+   the panic log). */
+static void
+collect_save_check(boolean can_recover)
+{
+#ifndef AIMAKE_BUILDOS_MSWin32
+    enum save_check_result result;
+    pid_t pid = save_check_pid;
+    int status;
+
+    if (!pid)
+        return;
+    save_check_pid = 0;
+
+    while (waitpid(pid, &status, 0) == -1)
+        if (errno != EINTR)
+            return; /* somebody else reaped it; we can't know the result */
+
+    if (WIFEXITED(status))
+        result = WEXITSTATUS(status);
+    else
+        result = SCR_CRASHED;
+
+    if (result == SCR_OK)
+        return;
+
+    if (!can_recover) {
+        paniclog("save check", save_check_result_string(result));
+        return;
+    }
+
+    /* A bad diff is cut out of the log, as though it had caused a panic. */
+    if (result == SCR_BAD_DIFF || result == SCR_STALE_LEVEL)
+        log_recover_noreturn(save_check_location,
+                             save_check_result_string(result),
+                             __FILE__, __LINE__);
+
+    recover_from_bad_binary_save(save_check_location,
+                                 save_check_result_string(result),
+                                 __FILE__, __LINE__);
+#else
+    (void) can_recover;
+#endif
 }
 
 static noreturn void
@@ -2028,14 +3432,17 @@ apply_save_diff(char *s, struct memfile *diff_base)
     /* The header of a save diff is one byte, '~'. */
     s++;
 
-    buflen = base64_strlen(s);
+    buflen = log_data_strlen(s);
     buf = malloc(buflen + 2);
     memset(buf, 0, buflen + 2);
-    base64_decode(s, buf, buflen);
+    log_data_decode(s, buf, buflen);
 
     mdiffapply(buf, buflen, diff_base, &program_state.binary_save,
                apply_save_diff_error);
     free(buf);
+
+    backup_chain_extend(program_state.binary_save.pos);
+    diffs_replayed++;
 }
 
 /* Decodes the given string into program_state.binary_save. The caller should
@@ -2052,12 +3459,33 @@ load_save_backup_from_string(char *s)
     mnew(&program_state.binary_save, NULL);
     program_state.binary_save_allocated = TRUE;
 
+    backup_chain_restart(strlen(s) + 1);
+    backups_loaded++;
+
     /* The header is '*', an 8 digit hex number, and ' ', = 10 bytes. */
     s += 10;
-    len = base64_strlen(s);
+    len = log_data_strlen(s);
 
     mp = mmmap(&program_state.binary_save, len, 0);
-    base64_decode(s, mp, len);
+    log_data_decode(s, mp, len);
+}
+
+/* Returns the turn counter stored in a binary save. */
+static long
+binary_save_moves(struct memfile *mf)
+{
+    long temp_pos = mf->pos;
+    long curv;
+
+    mf->pos = 0;
+    if (!uptodate(mf, NULL))
+        error_reading_save(
+            "binary save is from the wrong version of NetHack\n");
+
+    curv = mread32(mf);
+    mf->pos = temp_pos;
+
+    return curv;
 }
 
 /* Sets the binary save and save backup locations from the argument (which
@@ -2074,13 +3502,12 @@ load_save_backup_from_offset(long offset)
     program_state.save_backup_location = offset;
 
     lseek(program_state.logfile, offset, SEEK_SET);
-    logline = lgetline_malloc(program_state.logfile);
+    logline = lgetline_view(program_state.logfile);
 
     if (!logline)
         error_reading_save("EOF when reading save backup\n");
 
     load_save_backup_from_string(logline);
-    free(logline);
 }
 
 /* Checks to see if a save backup exists at a given file location. Returns -1 if
@@ -2089,7 +3516,6 @@ load_save_backup_from_offset(long offset)
 static long
 get_save_backup_offset(long offset)
 {
-    long oldoffset = get_log_offset();
     long rv = -1;
     char sbbuf[11];
     long sbloc;
@@ -2098,11 +3524,8 @@ get_save_backup_offset(long offset)
     if (!change_fd_lock(program_state.logfile, TRUE, LT_READ, 2))
         panic("Could not upgrade to read lock on logfile");
 
-    if (lseek(program_state.logfile, offset, SEEK_SET) < 0)
-        goto cleanup;
-
     /* Read the save backup header. */
-    if (!full_read(program_state.logfile, sbbuf, 10))
+    if (!lpeek(program_state.logfile, offset, sbbuf, 10))
         goto cleanup;
     sbbuf[10] = '\0';
 
@@ -2121,8 +3544,6 @@ get_save_backup_offset(long offset)
         rv = sbloc;
 
 cleanup:
-    lseek(program_state.logfile, oldoffset, SEEK_SET);
-
     if (!change_fd_lock(program_state.logfile, TRUE, LT_MONITOR, 2))
         panic("Could not downgrade to monitor lock on logfile");
 
@@ -2144,7 +3565,6 @@ cleanup:
 static long
 relative_to_target(long bsl, long targetpos, enum target_location_units tlu)
 {
-    long temp_pos = program_state.binary_save.pos;
     long curv;
 
     switch (tlu) {
@@ -2157,14 +3577,7 @@ relative_to_target(long bsl, long targetpos, enum target_location_units tlu)
         break;
 
     case TLU_TURNS:
-
-        program_state.binary_save.pos = 0;
-        if (!uptodate(&program_state.binary_save, NULL))
-            error_reading_save(
-                "binary save is from the wrong version of NetHack\n");
-
-        curv = mread32(&program_state.binary_save);
-        program_state.binary_save.pos = temp_pos;
+        curv = binary_save_moves(&program_state.binary_save);
         break;
 
     default:
@@ -2174,6 +3587,172 @@ relative_to_target(long bsl, long targetpos, enum target_location_units tlu)
     return curv - targetpos;
 }
 
+/***** Save backup index *****/
+
+/* To find the save backup to start from, log_sync() used to walk the chain of
+   save backups one at a time, loading each of them, until it found one that
+   was early enough. Instead, we keep an index of all the save backups in the
+   log, sorted by location, and binary-search it.
+
+   The index is built from the chain of save backup locations that's already in
+   the log (the first save backup points to the last, and each other save
+   backup points to the one before it); this only needs the headers of the save
+   backups to be read, not the saves themselves. It's then kept up to date as
+   save backups are written or read. The turn counter of each save backup is
+   only read from the log if a binary search needs it.
+
+   If the chain turns out to be inconsistent, the index is marked as invalid,
+   and log_sync() falls back to walking it. */
+
+struct backup_index_entry {
+    long offset;
+    long moves;         /* -1 if not known yet */
+};
+
+static struct backup_index_entry *backup_index = NULL;
+static int backup_index_len = 0;
+static int backup_index_size = 0;
+static enum { BI_UNBUILT, BI_VALID, BI_INVALID } backup_index_state = BI_UNBUILT;
+
+static void
+backup_index_clear(void)
+{
+    free(backup_index);
+    backup_index = NULL;
+    backup_index_len = 0;
+    backup_index_size = 0;
+    backup_index_state = BI_UNBUILT;
+}
+
+static void
+backup_index_push(long offset, long moves)
+{
+    if (backup_index_len == backup_index_size) {
+        backup_index_size = backup_index_size ? backup_index_size * 2 : 64;
+        backup_index = realloc(backup_index, backup_index_size *
+                               sizeof (struct backup_index_entry));
+        if (!backup_index)
+            panic("Out of memory in backup_index_push");
+    }
+
+    backup_index[backup_index_len].offset = offset;
+    backup_index[backup_index_len].moves = moves;
+    backup_index_len++;
+}
+
+/* Records a save backup that was just read or written, if it's newer than any
+   we know about (the log only ever gets longer while the index exists). */
+static void
+backup_index_add(long offset, long moves)
+{
+    if (backup_index_state != BI_VALID)
+        return;
+    if (backup_index_len && backup_index[backup_index_len - 1].offset >= offset)
+        return;
+
+    backup_index_push(offset, moves);
+}
+
+static void
+backup_index_build(void)
+{
+    long first = program_state.last_save_backup_location_location - 1;
+    long sloc, prev;
+    int i;
+
+    backup_index_clear();
+    backup_index_state = BI_INVALID;
+
+    /* Walk the chain backwards, starting from the last save backup. */
+    sloc = get_save_backup_offset(first);
+    if (sloc < 0)
+        return;
+
+    while (sloc > first) {
+        backup_index_push(sloc, -1);
+
+        prev = get_save_backup_offset(sloc);
+        if (prev < first || prev >= sloc) {
+            /* Not a save backup, or the chain doesn't move backwards. */
+            backup_index_clear();
+            backup_index_state = BI_INVALID;
+            return;
+        }
+        sloc = prev;
+    }
+
+    backup_index_push(first, -1);
+
+    /* We built the index backwards; reverse it. */
+    for (i = 0; i < backup_index_len / 2; i++) {
+        struct backup_index_entry t = backup_index[i];
+        backup_index[i] = backup_index[backup_index_len - 1 - i];
+        backup_index[backup_index_len - 1 - i] = t;
+    }
+
+    backup_index_state = BI_VALID;
+}
+
+/* Like relative_to_target, but for the save backup at the given index entry. */
+static long
+backup_index_relative_to_target(int i, long targetpos,
+                                enum target_location_units tlu)
+{
+    struct backup_index_entry *bie = backup_index + i;
+
+    if (tlu != TLU_TURNS)
+        return relative_to_target(bie->offset, targetpos, tlu);
+
+    if (bie->moves < 0) {
+        struct memfile mf;
+        char *logline;
+        long len;
+
+        lseek(program_state.logfile, bie->offset, SEEK_SET);
+        logline = lgetline_view(program_state.logfile);
+        if (!logline)
+            error_reading_save("EOF when reading save backup\n");
+
+        /* As in load_save_backup_from_string. */
+        len = log_data_strlen(logline + 10);
+        mnew(&mf, NULL);
+        log_data_decode(logline + 10, mmmap(&mf, len, 0), len);
+
+        bie->moves = binary_save_moves(&mf);
+        mfree(&mf);
+    }
+
+    return bie->moves - targetpos;
+}
+
+/* Returns the location of the last save backup that isn't ahead of the target
+   location (or the first save backup, if they all are), or -1 if the index
+   can't be used. */
+static long
+backup_index_find(long targetpos, enum target_location_units tlu)
+{
+    int lo, hi, mid;
+
+    if (backup_index_state == BI_UNBUILT)
+        backup_index_build();
+    if (backup_index_state != BI_VALID || !backup_index_len)
+        return -1;
+
+    /* Invariant: everything before lo is not ahead of the target, everything
+       from hi onwards is ahead of the target. */
+    lo = 0;
+    hi = backup_index_len;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (backup_index_relative_to_target(mid, targetpos, tlu) > 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return backup_index[lo ? lo - 1 : 0].offset;
+}
+
 /*
  * Fastforwards/rewinds the gamestate to the target location.
  *
@@ -2221,8 +3800,11 @@ log_sync(long target_location, enum target_location_units tlu,
 {
     struct nh_game_info si;
     struct memfile bsave;
+    struct backup_chain bchain;
     long sloc, loglineloc, last_sloc;
     char *logline;
+    long diffs_before = diffs_replayed, backups_before = backups_loaded;
+    microseconds sync_start = utc_time();
 
     if (!change_fd_lock(program_state.logfile, TRUE, LT_READ, 2))
         panic("Could not upgrade to read lock on logfile");
@@ -2236,7 +3818,7 @@ log_sync(long target_location, enum target_location_units tlu,
            pointer to the start of line 4 (the first save backup). */
         int ls = read_log_header(program_state.logfile, &si,
                                  &program_state.expected_recovery_count,
-                                 FALSE);
+                                 &program_state.log_format, FALSE);
         if (ls != LS_SAVED && ls != LS_DONE)
             error_reading_save(
                 "logfile has a bad header (is it from an old version?)\n");
@@ -2248,6 +3830,8 @@ log_sync(long target_location, enum target_location_units tlu,
         program_state.save_backup_location = get_log_offset();
         program_state.last_save_backup_location_location =
             program_state.save_backup_location + 1;
+        backup_dictionary_set_source(program_state.logfile,
+                                     program_state.save_backup_location);
 
         sloc = get_save_backup_offset(program_state.save_backup_location);
         if (sloc < 0) /* fourth line wasn't a save backup */
@@ -2275,9 +3859,18 @@ log_sync(long target_location, enum target_location_units tlu,
 
     }
 
-    /* If we're ahead of the target, move back to the last save backup (because
-       we can't run save diffs backwards, our only choice is to move forwards
-       from the save backup location). */
+    /* Find the save backup to start from: the last one that isn't ahead of the
+       target (because we can't run save diffs backwards, we have to move
+       forwards from a save backup). If we're behind the target, this could
+       still save us replaying a lot of diffs. */
+    sloc = backup_index_find(target_location, tlu);
+    if (sloc >= 0 && sloc != program_state.binary_save_location &&
+        (sloc > program_state.binary_save_location ||
+         relative_to_target(program_state.binary_save_location,
+                            target_location, tlu) > 0))
+        load_save_backup_from_offset(sloc);
+
+    /* If we're ahead of the target, move back to the last save backup. */
     if (program_state.binary_save_location != program_state.save_backup_location
         && relative_to_target(program_state.binary_save_location,
                               target_location, tlu) > 0) {
@@ -2286,7 +3879,7 @@ log_sync(long target_location, enum target_location_units tlu,
     }
 
     /* While we're still ahead of the target, try progressively earlier
-       backups. */
+       backups. (This only does anything if the index couldn't be used.) */
     last_sloc = -1;
     while (relative_to_target(program_state.binary_save_location,
                               target_location, tlu) > 0 &&
@@ -2324,14 +3917,14 @@ log_sync(long target_location, enum target_location_units tlu,
 
         lseek(program_state.logfile, sloc, SEEK_SET);
         /* Skip the save diff or backup itself. */
-        free(lgetline_malloc(program_state.logfile));
+        lskipline(program_state.logfile);
 
         /* Look for the next save diff or backup line. */
         for ((loglineloc = get_log_offset()),
-                 (logline = lgetline_malloc(program_state.logfile));
+                 (logline = lgetline_view(program_state.logfile));
              logline;
-             free(logline), (loglineloc = get_log_offset()),
-                 (logline = lgetline_malloc(program_state.logfile))) {
+             (loglineloc = get_log_offset()),
+                 (logline = lgetline_view(program_state.logfile))) {
             if (*logline == '*' || *logline == '~')
                 break;
         }
@@ -2344,6 +3937,7 @@ log_sync(long target_location, enum target_location_units tlu,
                 load_gamestate_from_binary_save(TRUE);
             if (!change_fd_lock(program_state.logfile, TRUE, LT_MONITOR, 2))
                 panic("Could not downgrade to monitor lock on logfile");
+            note_log_sync_done(diffs_before, backups_before, sync_start);
             return;
         }
 
@@ -2351,6 +3945,7 @@ log_sync(long target_location, enum target_location_units tlu,
            (This trick to avoid having to use mclone() is inspired by C++
            move constructors.) */
         bsave = program_state.binary_save;
+        bchain = backup_chain;
         program_state.binary_save_allocated = FALSE;
 
         if (*logline == '*') {
@@ -2369,27 +3964,29 @@ log_sync(long target_location, enum target_location_units tlu,
             if (!program_state.binary_save_allocated) /* should never happen */
                 panic("overshoot in log_sync but no binary save present");
 
-            free(logline);
             mfree(&program_state.binary_save);
             program_state.binary_save = bsave;
+            backup_chain = bchain;
 
             if (!inconsistent)
                 load_gamestate_from_binary_save(TRUE);
             if (!change_fd_lock(program_state.logfile, TRUE, LT_MONITOR, 2))
                 panic("Could not downgrade to monitor lock on logfile");
+            note_log_sync_done(diffs_before, backups_before, sync_start);
             return;
 
         } else {
 
             /* We didn't overshoot: set the locations to match this new save. */
             sloc = program_state.binary_save_location = loglineloc;
-            if (*logline == '*')
+            if (*logline == '*') {
                 program_state.save_backup_location = loglineloc;
+                backup_index_add(loglineloc,
+                                 binary_save_moves(&program_state.binary_save));
+            }
 
             mfree(&bsave);
         }
-
-        free(logline);
     }
 
     /* Fix the invariant on the gamestate. */
@@ -2398,6 +3995,7 @@ log_sync(long target_location, enum target_location_units tlu,
 
     if (!change_fd_lock(program_state.logfile, TRUE, LT_MONITOR, 2))
         panic("Could not downgrade to monitor lock on logfile");
+    note_log_sync_done(diffs_before, backups_before, sync_start);
 }
 
 
@@ -2433,14 +4031,7 @@ log_replay_save_line(void)
         if (!change_fd_lock(program_state.logfile, TRUE, LT_MONITOR, 2))
             panic("Could not downgrade to monitor lock on logfile");
 
-#ifndef WIN32
-        /* Don't bother sleeping on Windows; this situation should be
-           impossible anyway because watching doesn't work there */
-        if (!logline)
-            nanosleep(&(struct timespec){.tv_nsec = 100000000}, NULL);
-#endif
-
-    } while (!logline && tries--);
+    } while (!logline && (wait_for_logfile_change() || tries--));
 
     if (!logline) {
         /* maybe we find a diff/binary save later */
@@ -2495,6 +4086,11 @@ log_reset(void)
     program_state.last_save_backup_location_location = 0;
     program_state.emergency_recover_location = 0;
     program_state.eof_reached = FALSE;
+
+    backup_index_clear();
+    backup_dictionary_clear();
+    log_window_discard();
+    memset(&backup_chain, 0, sizeof backup_chain);
 }
 
 void
@@ -2509,17 +4105,29 @@ log_init(int logfd)
         terminate(ERR_IN_PROGRESS);
     }
 
+    const char *dict = nh_getenv("NH4BACKUPDICTIONARY");
+
+    set_save_check_options();
+    set_backup_policy_options();
+    backup_dictionary_enabled = dict && !strcmp(dict, "yes");
+
     log_reset();
 }
 
 void
 log_uninit(void)
 {
+    collect_save_check(FALSE);
+
     if (program_state.logfile > -1)
         change_fd_lock(program_state.logfile, TRUE, LT_NONE, 0);
 
 #ifdef AIMAKE_BUILDOS_linux
     flush_logfile_watchers();
+
+    if (logfile_inotify_fd >= 0)
+        close(logfile_inotify_fd);
+    logfile_inotify_fd = -1;
 #endif
 
     program_state.logfile = -1;
@@ -2533,6 +4141,13 @@ log_uninit(void)
         program_state.binary_save_allocated = 0;
     }
 
+    backup_index_clear();
+    backup_dictionary_clear();
+    log_window_discard();
+    free(log_window.buf);
+    log_window.buf = NULL;
+    log_window.size = 0;
+
     /* just in case we have a badly-timed panic */
     program_state.emergency_recover_location = 0;
 }
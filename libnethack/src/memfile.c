@@ -93,6 +93,9 @@ le64_to_host(unsigned long long x)
 static FILE *volatile debuglog = NULL;
 
 static void mdiffwrite(struct memfile *, const void *, unsigned int);
+static void mtag_table_new(struct memfile *mf, int cap);
+static void mtag_table_free(struct memfile *mf);
+static void mtag_insert(struct memfile *mf, const struct memfile_tag *tag);
 
 /* Creating and freeing memory files */
 void
@@ -117,17 +120,20 @@ mnew(struct memfile *mf, struct memfile *relativeto)
 
     mdiffwrite(mf, diffheader, 2);
 
-    for (i = 0; i < MEMFILE_HASHTABLE_SIZE; i++)
-        mf->tags[i] = 0;
-    mf->last_tag = 0;
+    /* A save usually has about as many tags as the save it's relative to, so
+       size the table to fit them without needing to grow. */
+    i = MEMFILE_TAGS_INITIAL;
+    if (relativeto)
+        while (i / 4 * 3 <= relativeto->tagcount)
+            i *= 2;
+    mtag_table_new(mf, i);
+    mf->last_tag.pos = -1;
 }
 
 /* Allocates to as a deep copy of from. */
 void
 mclone(struct memfile *to, const struct memfile *from)
 {
-    int i;
-
     *to = *from;
 
     if (from->buf) {
@@ -138,43 +144,20 @@ mclone(struct memfile *to, const struct memfile *from)
         to->diffbuf = malloc(to->difflen);
         memcpy(to->diffbuf, from->diffbuf, from->difflen);
     }
-
-    for (i = 0; i < MEMFILE_HASHTABLE_SIZE; i++) {
-        struct memfile_tag *fromtag, **totag;
-
-        fromtag = from->tags[i];
-        totag = &(to->tags[i]);
-
-        while (fromtag) {
-            *totag = malloc(sizeof (struct memfile_tag));
-            **totag = *fromtag;
-            fromtag = fromtag->next;
-            totag = &((*totag)->next);
-        }
-
-        *totag = 0;
+    if (from->tags) {
+        to->tags = malloc(from->tagcap * sizeof *to->tags);
+        memcpy(to->tags, from->tags, from->tagcap * sizeof *to->tags);
     }
 }
 
 void
 mfree(struct memfile *mf)
 {
-    int i;
-
     free(mf->buf);
     mf->buf = 0;
     free(mf->diffbuf);
     mf->diffbuf = 0;
-    for (i = 0; i < MEMFILE_HASHTABLE_SIZE; i++) {
-        struct memfile_tag *tag, *otag;
-
-        for ((tag = mf->tags[i]), (otag = NULL); tag; tag = tag->next) {
-            free(otag);
-            otag = tag;
-        }
-        free(otag);
-        mf->tags[i] = 0;
-    }
+    mtag_table_free(mf);
 }
 
 /* Functions for writing to a memory file.
@@ -211,6 +194,38 @@ mmmap(struct memfile *mf, long len, long off)
     return mf->buf + off;
 }
 
+/* Returns the length of the longest common prefix of a and b, which are both at
+   least len bytes long. Most of a save is the same as the save it's diffed
+   against, so this is the inner loop of saving; it compares 32-byte blocks
+   while it can (the compiler can vectorize that), then single words, and only
+   looks at individual bytes to find where within a word the difference is. */
+static unsigned int
+mdiff_common_prefix(const char *a, const char *b, unsigned int len)
+{
+    unsigned int i = 0;
+    uint64_t wa[4], wb[4];
+
+    while (i + sizeof wa <= len) {
+        memcpy(wa, a + i, sizeof wa);
+        memcpy(wb, b + i, sizeof wb);
+        if ((wa[0] ^ wb[0]) | (wa[1] ^ wb[1]) |
+            (wa[2] ^ wb[2]) | (wa[3] ^ wb[3]))
+            break;
+        i += sizeof wa;
+    }
+    while (i + sizeof *wa <= len) {
+        memcpy(wa, a + i, sizeof *wa);
+        memcpy(wb, b + i, sizeof *wb);
+        if (*wa != *wb)
+            break;
+        i += sizeof *wa;
+    }
+    while (i < len && a[i] == b[i])
+        i++;
+
+    return i;
+}
+
 void
 mwrite(struct memfile *mf, const void *buf, unsigned int num)
 {
@@ -221,7 +236,28 @@ mwrite(struct memfile *mf, const void *buf, unsigned int num)
         mf->pos += num;
     } else {
         /* calculate and record the diff as well */
-        while (num--) {
+        while (num) {
+            /* Fast path: once nothing but copies are pending, a run of bytes
+               that match the old file just extends the copy. This has exactly
+               the same effect as going round the loop below once per byte. */
+            if (!mf->pending_seeks && !mf->pending_edits &&
+                mf->relativepos < mf->relativeto->pos) {
+                unsigned int run = num;
+
+                if (run > mf->relativeto->pos - mf->relativepos)
+                    run = mf->relativeto->pos - mf->relativepos;
+                run = mdiff_common_prefix(
+                    mf->buf + mf->pos,
+                    mf->relativeto->buf + mf->relativepos, run);
+
+                mf->pending_copies += run;
+                mf->pos += run;
+                mf->relativepos += run;
+                num -= run;
+                if (!num)
+                    break;
+            }
+
             if (mf->relativepos < mf->relativeto->pos &&
                 mf->buf[mf->pos] == mf->relativeto->buf[mf->relativepos]) {
 
@@ -242,6 +278,7 @@ mwrite(struct memfile *mf, const void *buf, unsigned int num)
             }
             mf->pos++;
             mf->relativepos++;
+            num--;
         }
     }
 }
@@ -719,10 +756,10 @@ mdiffflush(struct memfile *mf, boolean eof)
            this point will be edited or seeked away) */
         fprintf(debuglog, "] pos %d, last copy %d:%08lx%+d anchor %d\n> ",
                 mf->pos,
-                mf->last_tag ? mf->last_tag->tagtype : -1,
-                mf->last_tag ? mf->last_tag->tagdata : 0,
+                mf->last_tag.pos >= 0 ? (int)mf->last_tag.tagtype : -1,
+                mf->last_tag.pos >= 0 ? mf->last_tag.tagdata : 0,
                 mf->pos - (int)mf->pending_edits -
-                (mf->last_tag ? mf->last_tag->pos : 0),
+                (mf->last_tag.pos >= 0 ? mf->last_tag.pos : 0),
                 mf->coord_relative_to);
     }
 
@@ -1181,6 +1218,111 @@ mdiffapply(char *diff, long difflen, struct memfile *diff_base,
     }
 }
 
+/* The tag tables. A save has thousands of tags, and a new save is made every
+   turn, so the table is a single allocation rather than one per tag. When a
+   memfile is freed, we keep its table for the next memfile to be created;
+   the save that's about to be freed is normally the one from two turns ago, so
+   in the steady state no allocation is needed at all. */
+static struct memfile_tag *spare_tags = NULL;
+static int spare_tagcap = 0;
+
+static void
+mtag_table_new(struct memfile *mf, int cap)
+{
+    int i;
+
+    if (spare_tags && spare_tagcap >= cap) {
+        mf->tags = spare_tags;
+        cap = spare_tagcap;
+        spare_tags = NULL;
+        spare_tagcap = 0;
+    } else
+        mf->tags = malloc(cap * sizeof *mf->tags);
+
+    mf->tagcap = cap;
+    mf->tagcount = 0;
+    for (i = 0; i < cap; i++)
+        mf->tags[i].pos = -1;
+}
+
+static void
+mtag_table_free(struct memfile *mf)
+{
+    if (mf->tags && mf->tagcap > spare_tagcap) {
+        free(spare_tags);
+        spare_tags = mf->tags;
+        spare_tagcap = mf->tagcap;
+    } else
+        free(mf->tags);
+
+    mf->tags = NULL;
+    mf->tagcap = 0;
+    mf->tagcount = 0;
+}
+
+static int
+mtag_slot(const struct memfile *mf, long tagdata, enum memfile_tagtype tagtype)
+{
+    /* Fibonacci hashing; the top bits are the best mixed. */
+    uint64_t h = ((uint64_t)tagdata * 64 + (int)tagtype) *
+        UINT64_C(0x9E3779B97F4A7C15);
+    return (h >> 32) & (mf->tagcap - 1);
+}
+
+/* Returns the slot the tag is in, or the empty slot where it would go. */
+static struct memfile_tag *
+mtag_probe(const struct memfile *mf, long tagdata, enum memfile_tagtype tagtype)
+{
+    int i = mtag_slot(mf, tagdata, tagtype);
+
+    while (mf->tags[i].pos != -1 &&
+           (mf->tags[i].tagtype != tagtype || mf->tags[i].tagdata != tagdata))
+        i = (i + 1) & (mf->tagcap - 1);
+
+    return mf->tags + i;
+}
+
+/* Adds a tag to the table, replacing any existing tag with the same tagdata
+   and tagtype. */
+static void
+mtag_insert(struct memfile *mf, const struct memfile_tag *tag)
+{
+    struct memfile_tag *slot;
+
+    /* Keep the table at most 3/4 full, so that probe sequences stay short. */
+    if (mf->tagcount >= mf->tagcap / 4 * 3) {
+        struct memfile_tag *oldtags = mf->tags;
+        int oldcap = mf->tagcap, i;
+
+        mf->tagcap *= 2;
+        mf->tags = malloc(mf->tagcap * sizeof *mf->tags);
+        for (i = 0; i < mf->tagcap; i++)
+            mf->tags[i].pos = -1;
+        for (i = 0; i < oldcap; i++)
+            if (oldtags[i].pos != -1)
+                *mtag_probe(mf, oldtags[i].tagdata,
+                            oldtags[i].tagtype) = oldtags[i];
+        free(oldtags);
+    }
+
+    slot = mtag_probe(mf, tag->tagdata, tag->tagtype);
+    if (slot->pos == -1)
+        mf->tagcount++;
+    *slot = *tag;
+}
+
+static const struct memfile_tag *
+mfindtag(const struct memfile *mf, long tagdata, enum memfile_tagtype tagtype)
+{
+    const struct memfile_tag *tag;
+
+    if (!mf->tags)
+        return NULL;
+
+    tag = mtag_probe(mf, tagdata, tagtype);
+    return tag->pos == -1 ? NULL : tag;
+}
+
 /* Tagging memfiles. This remembers the correspondence between the tag
    and the file location. For a diff memfile, it also sets relativepos
    to the pos of the tag in relativeto, if it exists, and adds a seek
@@ -1188,23 +1330,14 @@ mdiffapply(char *diff, long difflen, struct memfile *diff_base,
 void
 mtag(struct memfile *mf, long tagdata, enum memfile_tagtype tagtype)
 {
-    /* 619 is chosen here because it's a prime number, and it's approximately
-       in the golden ratio with MEMFILE_HASHTABLE_SIZE. */
-    int bucket = (tagdata * 619 + (int)tagtype) % MEMFILE_HASHTABLE_SIZE;
-    struct memfile_tag *tag = malloc(sizeof (struct memfile_tag));
-
-    tag->next = mf->tags[bucket];
-    tag->tagdata = tagdata;
-    tag->tagtype = tagtype;
-    tag->pos = mf->pos;
-    mf->tags[bucket] = tag;
-    mf->last_tag = tag;
+    const struct memfile_tag *tag;
+
+    mf->last_tag = (struct memfile_tag)
+        {.tagdata = tagdata, .tagtype = tagtype, .pos = mf->pos};
+    mtag_insert(mf, &mf->last_tag);
 
     if (mf->relativeto) {
-        for (tag = mf->relativeto->tags[bucket]; tag; tag = tag->next) {
-            if (tag->tagtype == tagtype && tag->tagdata == tagdata)
-                break;
-        }
+        tag = mfindtag(mf->relativeto, tagdata, tagtype);
         if (tag && mf->relativepos != tag->pos) {
             int offset = mf->relativepos - tag->pos;
 
@@ -1217,6 +1350,61 @@ mtag(struct memfile *mf, long tagdata, enum memfile_tagtype tagtype)
     }
 }
 
+/* Returns the file position of the given tag, or -1 if the memfile doesn't
+   contain it. */
+long
+mtagpos(const struct memfile *mf, long tagdata, enum memfile_tagtype tagtype)
+{
+    const struct memfile_tag *tag = mfindtag(mf, tagdata, tagtype);
+
+    return tag ? tag->pos : -1;
+}
+
+/* Appends len bytes to a diff memfile, taking them from the file it's relative
+   to, starting at relativepos (so the caller will normally mtag first to move
+   relativepos to the right place). The resulting file and diff are the same as
+   if those bytes had been passed to mwrite(), but we already know that they're
+   all copies and so don't need to compare them one at a time. Any tags in the
+   copied region are copied too, so that later diffs against this file can
+   still find them. */
+void
+mcopyrelative(struct memfile *mf, long len)
+{
+    struct memfile *from = mf->relativeto;
+    long offset;
+    int i;
+
+    if (!from || len < 0 || mf->relativepos + len > from->pos)
+        panic("mcopyrelative: copying from outside the base file");
+
+    offset = mf->pos - mf->relativepos;
+    for (i = 0; i < from->tagcap; i++) {
+        struct memfile_tag tag = from->tags[i];
+
+        if (tag.pos == -1 || tag.pos < mf->relativepos ||
+            tag.pos >= mf->relativepos + len)
+            continue;
+
+        tag.pos += offset;
+        mtag_insert(mf, &tag);
+    }
+
+    if (!len)
+        return;
+
+    expand_memfile(mf, mf->pos + len);
+    memcpy(mf->buf + mf->pos, from->buf + mf->relativepos, len);
+
+    /* This is what mwrite does for the first byte of a copy; the remaining
+       bytes just increase the count. */
+    if (mf->pending_seeks || mf->pending_edits)
+        mdiffflush(mf, 0);
+
+    mf->pending_copies += len;
+    mf->pos += len;
+    mf->relativepos += len;
+}
+
 void
 mread(struct memfile *mf, void *buf, unsigned int len)
 {
@@ -1334,12 +1522,13 @@ mequal(struct memfile *mf1, struct memfile *mf2, const char **difference_reason)
         /* Determine where the desyncs are. */
         for (off = 0; off < len; off++) {
             if (p1[off] != p2[off]) {
-                struct memfile_tag *tag = NULL, *titer;
-                for (bin = 0; bin < MEMFILE_HASHTABLE_SIZE; bin++)
-                    for (titer = mf2->tags[bin]; titer; titer = titer->next)
-                        if (titer->pos <= off)
-                            if (!tag || tag->pos < titer->pos)
-                                tag = titer;
+                const struct memfile_tag *tag = NULL, *titer;
+                for (bin = 0; bin < mf2->tagcap; bin++) {
+                    titer = mf2->tags + bin;
+                    if (titer->pos != -1 && titer->pos <= off)
+                        if (!tag || tag->pos < titer->pos)
+                            tag = titer;
+                }
 
                 if (!tag) {
 
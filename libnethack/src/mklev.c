@@ -906,8 +906,11 @@ mklev(d_level * levnum)
     int ln = ledger_no(levnum);
     struct level *lev;
 
-    if (levels[ln])
+    /* The caller wants the level in order to do something to it. */
+    if (levels[ln]) {
+        mark_level_changed(levels[ln]);
         return levels[ln];
+    }
 
     if (getbones(levnum))
         return levels[ln];      /* initialized in getbones->getlev */
@@ -1234,6 +1234,7 @@ place_object(struct obj *otmp, struct level *lev, int x, int y)
     if (!isok(x, y))
         panic("placing object at bad position");
 
+    mark_level_changed(lev);
     obj_no_longer_held(otmp);
     if (otmp->otyp == BOULDER && lev == level)
         block_point(x, y);      /* vision */
@@ -1374,6 +1375,7 @@ remove_object(struct obj *otmp)
 
     if (otmp->where != OBJ_FLOOR)
         panic("remove_object: obj not on floor");
+    mark_level_changed(otmp->olev);
     extract_nexthere(otmp, &otmp->olev->objects[x][y]);
     extract_nobj(otmp, &otmp->olev->objlist,
                  &turnstate.floating_objects, OBJ_FREE);
@@ -1439,10 +1441,12 @@ obj_extract_self(struct obj *obj)
                      &turnstate.floating_objects, OBJ_FREE);
         break;
     case OBJ_BURIED:
+        mark_level_changed(obj->olev);
         extract_nobj(obj, &obj->olev->buriedobjlist,
                      &turnstate.floating_objects, OBJ_FREE);
         break;
     case OBJ_ONBILL:
+        mark_level_changed(obj->olev);
         extract_nobj(obj, &obj->olev->billobjs,
                      &turnstate.floating_objects, OBJ_FREE);
         break;
@@ -1569,6 +1573,7 @@ add_to_buried(struct obj *obj)
     if (obj->where != OBJ_FREE)
         panic("add_to_buried: obj not free");
 
+    mark_level_changed(obj->olev);
     extract_nobj(obj, &turnstate.floating_objects,
                  &obj->olev->buriedobjlist, OBJ_BURIED);
 }
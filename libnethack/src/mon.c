@@ -1582,6 +1582,7 @@ m_detach(struct monst *mtmp, const struct permonst *mptr)
     /* to prevent an infinite relobj-flooreffects-hmon-killed loop */
     mtmp->mtrapped = 0;
     mtmp->mhp = 0;      /* simplify some tests: force mhp to 0 */
+    mark_level_changed(mtmp->dlevel);
     relobj(mtmp, 0, FALSE);
     if (isok(mtmp->mx, mtmp->my))
         mtmp->dlevel->monsters[mtmp->mx][mtmp->my] = NULL;
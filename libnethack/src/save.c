@@ -29,6 +29,7 @@ static void save_flags(struct memfile *mf);
 static void save_autopickup_rules(struct memfile *mf,
                                   struct nh_autopickup_rules *ar);
 static void freefruitchn(void);
+static boolean copy_unchanged_level(struct memfile *mf, xchar levnum);
 
 
 /*
@@ -121,7 +122,9 @@ savegame(struct memfile *mf)
             continue;
         mtag(mf, ltmp, MTAG_LEVELS);
         mwrite8(mf, ltmp);      /* level number */
-        savelev(mf, ltmp);      /* actual level */
+        if (!copy_unchanged_level(mf, ltmp))
+            savelev(mf, ltmp);  /* actual level */
+        mtag(mf, ltmp, MTAG_LEVEL_END);
     }
     savegamestate(mf);
 
@@ -130,6 +133,60 @@ savegame(struct memfile *mf)
 }
 
 
+/* Most turns only change the current level, but savegame() is called every
+   turn, and saving every level is slow once many have been visited. So when
+   saving a diff against the binary save, levels that haven't changed since
+   that binary save was made are copied from it rather than being saved
+   again. Returns TRUE if it did that, FALSE if the level needs saving. The
+   caller only allows this (via program_state.copy_unchanged_levels) when the
+   save will be compared against one that copies nothing, before it's used.
+
+   This depends on being told about changes. The current level is always saved
+   (and is marked as changed when it stops being current, in goto_level); any
+   code that changes some other level must use mark_level_changed(). This is
+   done in the functions that move objects, monsters, traps, engravings, timers
+   and light sources to and from a level, and conservatively wherever a pointer
+   into another level is handed out (find_oid, mklev, deliver_object). A missed
+   mark is caught by the stale-level check that every save with copied levels
+   gets (see log.c), rather than silently undoing the change.
+
+   Unless the levels are saved relative to lastmoves, the save format of a level
+   depends on the current turn number, so in that case we can't copy them. */
+static boolean
+copy_unchanged_level(struct memfile *mf, xchar levnum)
+{
+    struct level *lev = levels[levnum];
+    long start, end;
+
+    if (!program_state.copy_unchanged_levels || !mf->relativeto ||
+        lev == level || !lev->in_binary_save ||
+        lev->flags.purge_monsters || flags.save_encoding != saveenc_levelrel)
+        return FALSE;
+
+    /* The level starts just after its level number. */
+    start = mtagpos(mf->relativeto, levnum, MTAG_LEVELS) + 1;
+    end = mtagpos(mf->relativeto, levnum, MTAG_LEVEL_END);
+    if (start <= 0 || end < start || mf->relativepos != start)
+        return FALSE;
+
+    mcopyrelative(mf, end - start);
+    return TRUE;
+}
+
+/* Called when the binary save has just been brought up to date with the
+   gamestate, either by saving the gamestate or by loading from the binary
+   save. */
+void
+note_levels_saved(void)
+{
+    xchar ltmp;
+
+    for (ltmp = 1; ltmp <= maxledgerno(); ltmp++)
+        if (levels[ltmp])
+            levels[ltmp]->in_binary_save = TRUE;
+}
+
+
 /* WARNING: Do not use save encoding functions in this function; although they
    will work on save, the restore code couldn't handle them */
 static void
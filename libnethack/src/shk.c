@@ -168,6 +168,7 @@ shkgone(struct monst *mtmp)
     char *p;
     int sx, sy;
 
+    mark_level_changed(shoplev);
     remove_damage(mtmp, TRUE);
     sroom->resident = NULL;
 
@@ -1779,10 +1780,13 @@ find_oid(unsigned id)
         if ((obj = o_on(id, mon->minvent)))
             return obj;
 
-    /* search all levels */
+    /* search all levels; the caller may well change an object found on
+       another level, so assume that it does */
     for (i = 0; i <= maxledgerno(); i++)
-        if (levels[i] && (obj = find_oid_lev(levels[i], id)))
+        if (levels[i] && (obj = find_oid_lev(levels[i], id))) {
+            mark_level_changed(levels[i]);
             return obj;
+        }
 
     /* not found at all */
     return NULL;
@@ -2099,6 +2103,7 @@ add_to_billobjs(struct obj *obj)
     if (obj->timed)
         obj_stop_timers(obj);
 
+    mark_level_changed(obj->olev);
     extract_nobj(obj, &turnstate.floating_objects,
                  &obj->olev->billobjs, OBJ_ONBILL);
 }
@@ -2945,6 +2950,7 @@ remove_damage(struct monst *shkp, boolean croaked)
     uchar saw_walls = 0;
     struct level *lev = levels[ledger_no(&ESHK(shkp)->shoplevel)];
 
+    mark_level_changed(lev);
     tmp_dam = lev->damagelist;
     tmp2_dam = 0;
     while (tmp_dam) {
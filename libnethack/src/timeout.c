@@ -1335,6 +1335,7 @@ start_timer(struct level *lev, long when, short kind, short func_index,
     gnu->needs_fixup = FALSE;
     gnu->func_index = func_index;
     gnu->arg = arg;
+    mark_level_changed(lev);
     insert_timer(lev, gnu);
 
     if (kind == TIMER_OBJECT)   /* increment object's timed count */
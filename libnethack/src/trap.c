@@ -286,6 +286,7 @@ maketrap(struct level *lev, int x, int y, int typ, enum rng rng)
     struct rm *loc;
     boolean oldplace;
 
+    mark_level_changed(lev);
     if ((ttmp = t_at(lev, x, y)) != 0) {
         if (ttmp->ttyp == MAGIC_PORTAL)
             return NULL;
@@ -4125,6 +4126,7 @@ deltrap(struct level *lev, struct trap *trap)
 {
     struct trap *ttmp;
 
+    mark_level_changed(lev);
     if (trap == lev->lev_traps)
         lev->lev_traps = lev->lev_traps->ntrap;
     else {
@@ -459,7 +459,8 @@ do_connect(const char *host, int port, const char *user, const char *pass,
 
     in_connect_disconnect = TRUE;
     sockfd = fd;
-    jmsg = json_pack("{ss,ss}", "username", user, "password", pass);
+    jmsg = json_pack("{ss,ss,si}", "username", user, "password", pass,
+                     "mapdelta", MAPDELTA_NEWEST);
     if (reg_user) {
         if (email)
             json_object_set_new(jmsg, "email", json_string(email));
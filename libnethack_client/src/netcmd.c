@@ -279,6 +279,64 @@ cmd_print_message(json_t *params, int display_only)
 }
 
 static struct nh_dbuf_entry dbuf[ROWNO][COLNO];
+
+/* Applies a map delta in MAPDELTA_RUNS form (see srv_update_screen) to dbuf. */
+static int
+unpack_dbuf_runs(json_t *jruns)
+{
+    int i, n = json_array_size(jruns), pos, runlen, mask, f, apply;
+    int fields[10];
+    json_int_t skip, len;
+    struct nh_dbuf_entry *dbe;
+
+#define NEXT_INT() json_integer_value(json_array_get(jruns, i++))
+
+    /* The first pass only checks that the runs are well-formed, so that a bad
+       delta doesn't leave the map half-updated. */
+    for (apply = 0; apply < 2; apply++) {
+        i = 0;
+        pos = 0;
+        while (i < n) {
+            /* These come from the server, so check them at full width before
+               doing any int arithmetic with them. */
+            skip = NEXT_INT();
+            len = NEXT_INT();
+            if (skip < 0 || skip > ROWNO * COLNO - pos)
+                return 0;
+            pos += skip;
+            if (len < 0 || len > ROWNO * COLNO - pos)
+                return 0;
+            runlen = len;
+
+            for (; runlen; runlen--, pos++) {
+                mask = NEXT_INT();
+                for (f = 0; f < 10; f++)
+                    fields[f] = (mask & (1 << f)) ? NEXT_INT() : 0;
+                if (i > n)
+                    return 0;
+                if (!apply)
+                    continue;
+
+                dbe = &dbuf[pos / COLNO][pos % COLNO];
+                dbe->effect = fields[0];
+                dbe->bg = fields[1];
+                dbe->trap = fields[2];
+                dbe->obj = fields[3];
+                dbe->obj_mn = fields[4];
+                dbe->mon = fields[5];
+                dbe->monflags = fields[6];
+                dbe->branding = fields[7];
+                dbe->invis = fields[8];
+                dbe->visible = fields[9];
+            }
+        }
+    }
+
+#undef NEXT_INT
+
+    return 1;
+}
+
 static json_t *
 cmd_update_screen(json_t *params, int display_only)
 {
@@ -288,6 +346,15 @@ cmd_update_screen(json_t *params, int display_only)
     json_t *jdbuf, *col, *elem;
     int ok = 1;
 
+    if (json_unpack(params, "{si,si,so!}", "ux", &ux, "uy", &uy,
+                    "dbuf_runs", &jdbuf) != -1) {
+        if (json_is_array(jdbuf) && unpack_dbuf_runs(jdbuf))
+            client_windowprocs.win_update_screen(dbuf, ux, uy);
+        else
+            print_error("Incorrect map delta in cmd_update_screen");
+        return NULL;
+    }
+
     if (json_unpack(params, "{si,si,so!}", "ux", &ux, "uy", &uy, "dbuf", &jdbuf)
         == -1) {
         print_error("Incorrect parameters in cmd_update_screen");
@@ -41,6 +41,9 @@ extern const_char_p_const_p EXPORT(nh_get_copyright_banner) (void);
 /* log.c */
 extern enum nh_log_status EXPORT(nh_get_savegame_status) (
     int fd, struct nh_game_info *si);
+extern nh_bool EXPORT(nh_convert_savegame) (
+    int infd, int outfd, enum nh_log_format format);
+extern void EXPORT(nh_get_log_sync_stats) (struct nh_log_sync_stats *stats);
 
 /* cmd.c */
 extern nh_cmd_desc_p EXPORT(nh_get_commands) (int *count);
@@ -20,6 +20,15 @@ enum authresult {
     AUTH_SUCCESS_NEW
 };
 
+/* Encodings of the map delta in update_screen. The client offers the newest
+   one it understands when it authenticates; older clients offer nothing. */
+enum nhnet_mapdelta {
+    MAPDELTA_COLUMNS,   /* nested per-column arrays, for any client */
+    MAPDELTA_RUNS       /* runs of changed cells, with only nonzero fields */
+};
+
+# define MAPDELTA_NEWEST MAPDELTA_RUNS
+
 
 struct nhnet_game {
     int gameid;
@@ -368,6 +368,28 @@ enum nh_log_status {
     LS_IN_PROGRESS      /* locking issues trying to obtain save information */
 };
 
+/* How save diffs and backups are stored in a log */
+enum nh_log_format {
+    LF_INVALID = -1,
+    LF_TEXT,            /* base 64, so the whole log is printable ASCII */
+    LF_BINARY           /* length-prefixed raw binary, ~25% smaller */
+};
+
+/* How much work loading a position from a log has taken (see log_sync), and
+   how long writing saves to the log has taken. Times are in microseconds. */
+struct nh_log_sync_stats {
+    long syncs;         /* number of times the log was synced */
+    long last_diffs;    /* save diffs replayed by the most recent sync */
+    long max_diffs;     /* most save diffs replayed by any one sync */
+    long total_diffs;   /* save diffs replayed by all syncs */
+    long total_backups; /* save backups loaded by all syncs */
+    long long sync_time;        /* time spent in all syncs */
+    long saves;                 /* save diffs and backups written */
+    long long save_time;        /* time spent saving the game for them */
+    long long diff_time;        /* time spent encoding them into the log */
+    long long check_time;       /* time spent verifying them */
+};
+
 enum autopickup_action {
     AP_GRAB,
     AP_LEAVE
@@ -539,6 +539,8 @@ extern int EI(timeout_get_wch) (int, wint_t *);
 extern void EI(uncursed_signal_getch) (void);
 extern void EI(uncursed_watch_fd) (int);
 extern void EI(uncursed_unwatch_fd) (int);
+extern void EI(uncursed_start_recording) (char *);
+extern void EI(uncursed_stop_recording) (void);
 
 /* uncursed mouse handling works differently from ncurses; the ncurses API is
    badly designed in that it can only wait on mouse actions in one window at a
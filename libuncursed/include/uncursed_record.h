@@ -0,0 +1,75 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* The 'uncursed' rendering library may be distributed under either of the
+ * following licenses:
+ *  - the NetHack General Public License
+ *  - the GNU General Public License v2 or later
+ * If you obtained uncursed as part of NetHack 4, you can find these licenses in
+ * the files libnethack/dat/license and libnethack/dat/gpl respectively.
+ */
+
+/* The format of the files written by the "record" plugin. All numbers other
+   than those in the trailer are unsigned varints (7 bits per byte, least
+   significant group first, top bit set on all bytes but the last).
+
+   The file starts with the 8 bytes of UNCREC_MAGIC, then a varint giving the
+   wall-clock time at which recording started (in seconds since the epoch).
+   After that come frames, each of which is a type byte, the number of
+   milliseconds since the previous frame, the length of the payload in bytes,
+   and then the payload:
+
+   UNCREC_KEYFRAME: the time since the start of the recording in ms, rows,
+       columns, cursor y, cursor x, cursor visibility, then every cell of the
+       screen in row-major order.
+   UNCREC_DELTA: cursor y, cursor x, cursor visibility, then any number of runs
+       of changed cells; each is the number of unchanged cells to skip (in
+       row-major order, from the end of the previous run), the number of cells
+       in the run, and the cells themselves.
+   UNCREC_BEEP: an empty payload.
+   UNCREC_INDEX: the number of keyframes, then for each, its time since the
+       start of the recording in ms and its offset in the file.
+
+   A cell is a varint n, followed by the cell's color (as returned by
+   uncursed_rhook_color_at) if n & 1 (otherwise the color is the same as the
+   previous cell in the same frame, or UNCREC_DEFAULT_COLOR for the first),
+   then n >> 1 bytes of UTF-8 text.
+
+   A keyframe is written whenever the recording starts or the terminal is
+   resized, and otherwise periodically, so that a player can seek by decoding
+   from the nearest keyframe. When a recording is stopped cleanly, it ends with
+   an index frame, followed by a trailer consisting of UNCREC_TRAILER_MAGIC and
+   the 8-byte little-endian offset of the index frame. (If the trailer is
+   missing, the keyframes can still be found by reading the frames in order,
+   using the payload lengths to skip over them.) */
+
+#define UNCREC_MAGIC "uncrec\0\1"
+#define UNCREC_MAGIC_LEN 8
+#define UNCREC_TRAILER_MAGIC "uidx"
+#define UNCREC_TRAILER_LEN 12
+#define UNCREC_EXTENSION ".uncrec"
+
+#define UNCREC_KEYFRAME 'K'
+#define UNCREC_DELTA 'D'
+#define UNCREC_BEEP 'B'
+#define UNCREC_INDEX 'I'
+
+#define UNCREC_DEFAULT_COLOR (16 | (16 << 5))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    extern void record_hook_init(int *, int *, const char *);
+    extern void record_hook_exit(void);
+    extern void record_hook_beep(void);
+    extern void record_hook_setcursorsize(int);
+    extern void record_hook_positioncursor(int, int);
+    extern void record_hook_update(int, int);
+    extern void record_hook_fullredraw(void);
+    extern void record_hook_flush(void);
+    extern void record_hook_recordkeyorcodepoint(int);
+    extern void record_hook_resized(int, int);
+    extern void record_hook_startrecording(char *);
+    extern void record_hook_stoprecording(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,58 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* The 'uncursed' rendering library may be distributed under either of the
+ * following licenses:
+ *  - the NetHack General Public License
+ *  - the GNU General Public License v2 or later
+ * If you obtained uncursed as part of NetHack 4, you can find these licenses in
+ * the files libnethack/dat/license and libnethack/dat/gpl respectively.
+ */
+
+/* The SGR escape sequence that sets the terminal's colors to a color_at value.
+   This is used by the tty plugin to draw, by the headless plugin to count the
+   bytes the tty plugin would send, and by uncrec2ttyrec to produce the same
+   output as the tty plugin; so they all share this one copy. */
+
+#ifndef UNCURSED_SGR_H
+# define UNCURSED_SGR_H
+
+# include <stdio.h>
+
+/* Big enough for any sequence uncursed_make_sgr writes, plus a NUL. */
+# define UNCURSED_SGR_MAXLEN 32
+
+/* Writes the sequence for color into buf, and returns its length. */
+static int
+uncursed_make_sgr(int color, char *buf)
+{
+    char *p = buf;
+
+    /* The general idea here is to specify bold for bright foreground, but
+       blink for bright background only on terminals without 256-color support
+       (via exploiting the "5" in the code for setting 256-color background).
+       We set the colors using the 8-color code first, then the 16-color code,
+       to get support for 16 colors without losing support for 8 colors. */
+    p += sprintf(p, "\x1b[0;");                         /* SGR reset */
+    if ((color & 31) == 16)         /* default fg */
+        p += sprintf(p, "39;");                         /* SGR default fg */
+    else if ((color & 31) >= 8)     /* bright fg */
+        /* SGR bold; SGR 8 color (fg & 8); SGR 16 color (fg) */
+        p += sprintf(p, "1;%d;%d;", (color & 31) + 22, (color & 31) + 82);
+    else    /* dark fg */
+        p += sprintf(p, "%d;", (color & 31) + 30);      /* SGR 8 color (fg) */
+    color >>= 5;
+    if (color & 32)
+        p += sprintf(p, "4;");                          /* SGR underline */
+    color &= 31;
+    if (color == 16)        /* default bg */
+        p += sprintf(p, "49m");                         /* SGR default bg */
+    else if (color >= 8)    /* bright bg */
+        /* SGR 256 color 5 /or/ SGR blink (depending on color depth);
+           SGR 8 color (bg & 8); SGR 16 color (bg) */
+        p += sprintf(p, "48;5;5;%d;%dm", color + 32, color + 92);
+    else
+        p += sprintf(p, "%dm", color + 40);             /* SGR 8 color (bg) */
+
+    return p - buf;
+}
+
+#endif
@@ -436,22 +436,16 @@ uncursed_hook_watch_fd(int fd, int watch)
             h->watch_fd(fd, watch);
 }
 
-#ifdef __GNUC__
-__attribute__ ((unused))
-#endif
 static void
 uncursed_hook_startrecording(char *fn)
 {
     struct uncursed_hooks *h;
 
     for (h = uncursed_hook_list; h; h = h->next_hook)
-        if (h->hook_type == uncursed_hook_type_recording)
+        if (h->used && h->hook_type == uncursed_hook_type_recording)
             h->startrecording(fn);
 }
 
-#ifdef __GNUC__
-__attribute__ ((unused))
-#endif
 static void
 uncursed_hook_stoprecording(void)
 {
@@ -2751,6 +2745,21 @@ uncursed_signal_getch(void)
     uncursed_hook_signal_getch();
 }
 
+/* Recording is done by recording plugins (e.g. "record"), which have to be
+   loaded via --interface; if none are loaded, these do nothing. fn has no
+   extension; each plugin adds its own. */
+void
+uncursed_start_recording(char *fn)
+{
+    uncursed_hook_startrecording(fn);
+}
+
+void
+uncursed_stop_recording(void)
+{
+    uncursed_hook_stoprecording();
+}
+
 void
 uncursed_watch_fd(int fd)
 {
@@ -0,0 +1,469 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* The 'uncursed' rendering library may be distributed under either of the
+ * following licenses:
+ *  - the NetHack General Public License
+ *  - the GNU General Public License v2 or later
+ * If you obtained uncursed as part of NetHack 4, you can find these licenses in
+ * the files libnethack/dat/license and libnethack/dat/gpl respectively.
+ */
+
+/*
+ * This is a headless backend for the uncursed rendering library, intended for
+ * benchmarking and load testing the programs that use it. It renders into a
+ * grid of cells in memory, rather than onto any sort of terminal, so that many
+ * copies of a program can run at once without the overhead of ptys and
+ * terminal emulation.
+ *
+ * Input is read from stdin as UTF-8 text, with no escape sequence parsing; EOF
+ * on stdin acts as a hangup. Delays are skipped (but counted), because a
+ * benchmark has no reason to wait for animations.
+ *
+ * For each frame (i.e. each flush that draws something), the plugin counts the
+ * cells that were drawn, the number of bytes the tty plugin would have sent
+ * to draw them, and the time spent in calls to uncursed_rhook_* (i.e. in
+ * libuncursed working out what to draw). If the environment variable
+ * UNCURSED_HEADLESS_STATS names a file, a line with the process ID, frame
+ * number and these counters is appended to it for each frame, together with
+ * running totals whenever the plugin is shut down. The screen size defaults to
+ * 80x24, and can be changed via the environment variable
+ * UNCURSED_HEADLESS_SIZE (e.g. "132x50").
+ */
+
+/* Detect OS. */
+#ifdef AIMAKE_BUILDOS_MSWin32
+# error !AIMAKE_FAIL_SILENTLY! headless.c does not work on Windows.
+#endif
+
+#define _POSIX_C_SOURCE 199309L /* for clock_gettime */
+
+#include <sys/select.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* headless.c is always linked statically. */
+#define UNCURSED_MAIN_PROGRAM
+
+#include "uncursed_hooks.h"
+#include "uncursed.h"
+#include "uncursed_headless.h"
+#include "uncursed_sgr.h"
+
+#define CSI "\x1b["
+
+struct headless_cell {
+    int color;
+    int len;
+    char utf8[CCHARW_MAX * 4];
+};
+
+static int rows = 0, cols = 0;
+static struct headless_cell *grid = NULL;
+static int cursor_y = 0, cursor_x = 0, cursor_visible = 1;
+
+/* The state a terminal would be in, had we been sending it output. */
+static int term_y = -1, term_x = -1, term_color = -1, term_cursor = -1;
+
+struct headless_counters {
+    long frames;
+    long cells;         /* cells drawn */
+    long bytes;         /* bytes the tty plugin would have output */
+    long long rhook_ns; /* time spent in uncursed_rhook_* */
+};
+static struct headless_counters frame_counters, total_counters;
+static long long skipped_delay_ms = 0;
+static FILE *statsfile = NULL;
+
+static int selfpipe[2] = { -1, -1 };
+static fd_set watchfds;
+static int watchfds_inited = 0;
+static int watchfd_max = 0;
+static int hangup = 0;
+
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/* The length of the SGR sequence that the tty plugin would send. */
+static int
+sgr_length(int color)
+{
+    char buf[UNCURSED_SGR_MAXLEN];
+
+    return uncursed_make_sgr(color, buf);
+}
+
+
+static void
+move_term_cursor(int y, int x)
+{
+    char buf[32];
+
+    if (y == term_y && x == term_x)
+        return;
+
+    frame_counters.bytes += snprintf(buf, sizeof buf, CSI "%d;%dH",
+                                     y + 1, x + 1);
+    term_y = y;
+    term_x = x;
+}
+
+
+/* Draws a cell, whether or not it needs it. */
+static void
+draw_cell(int y, int x)
+{
+    struct headless_cell *cell = grid + y * cols + x;
+    long long t = now_ns();
+    const char *s = uncursed_rhook_utf8_at(y, x);
+    int len = strlen(s);
+
+    cell->color = uncursed_rhook_color_at(y, x);
+    if (len > (int)sizeof cell->utf8)
+        len = sizeof cell->utf8;
+    cell->len = len;
+    memcpy(cell->utf8, s, len);
+    uncursed_rhook_updated(y, x);
+    frame_counters.rhook_ns += now_ns() - t;
+
+    move_term_cursor(y, x);
+    if (cell->color != term_color) {
+        frame_counters.bytes += sgr_length(cell->color);
+        term_color = cell->color;
+    }
+    frame_counters.bytes += len ? len : 1;
+    frame_counters.cells++;
+
+    /* The cursor moves right after drawing, as on a terminal. At the end of a
+       row, where terminals differ, we just assume a move will be needed. */
+    if (x + 1 < cols)
+        term_x++;
+    else
+        term_y = term_x = -1;
+}
+
+
+void
+headless_hook_init(int *h, int *w, const char *title)
+{
+    const char *size = getenv("UNCURSED_HEADLESS_SIZE");
+    const char *stats = getenv("UNCURSED_HEADLESS_STATS");
+    int newrows = 24, newcols = 80;
+
+    (void)title;
+
+    if (size && sscanf(size, "%dx%d", &newcols, &newrows) != 2)
+        newrows = newcols = 0;
+    if (newrows < 1 || newcols < 1) {
+        newrows = 24;
+        newcols = 80;
+    }
+
+    if (newrows != rows || newcols != cols || !grid) {
+        free(grid);
+        rows = newrows;
+        cols = newcols;
+        grid = calloc(rows * cols, sizeof *grid);
+        if (!grid) {
+            perror("Could not initialise uncursed headless library");
+            exit(1);
+        }
+    }
+    *h = rows;
+    *w = cols;
+
+    /* As in tty.c, signal_getch works via a self-pipe. */
+    if (selfpipe[0] == -1) {
+        if (pipe(selfpipe) != 0) {
+            perror("Could not initialise uncursed headless library");
+            exit(1);
+        }
+        fcntl(selfpipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(selfpipe[1], F_SETFL, O_NONBLOCK);
+    }
+
+    if (!watchfds_inited)
+        FD_ZERO(&watchfds);
+    watchfds_inited = 1;
+
+    if (stats && !statsfile) {
+        /* Many processes may share the file, so write it a line at a time,
+           and say which process each line is from. */
+        statsfile = fopen(stats, "a");
+        if (statsfile) {
+            setvbuf(statsfile, NULL, _IOLBF, BUFSIZ);
+            fprintf(statsfile, "# pid frame cells bytes rhook_ns\n");
+        }
+    }
+
+    term_y = term_x = term_color = term_cursor = -1;
+}
+
+
+void
+headless_hook_exit(void)
+{
+    if (!statsfile)
+        return;
+
+    fprintf(statsfile, "# pid %ld: total %ld frames, %ld cells, %ld bytes, "
+            "%lld ns in rhooks, %lld ms of delays skipped\n", (long)getpid(),
+            total_counters.frames, total_counters.cells, total_counters.bytes,
+            total_counters.rhook_ns, skipped_delay_ms);
+    fflush(statsfile);
+}
+
+
+void
+headless_hook_beep(void)
+{
+    frame_counters.bytes++;
+}
+
+
+void
+headless_hook_setcursorsize(int size)
+{
+    cursor_visible = size != 0;
+}
+
+
+void
+headless_hook_positioncursor(int y, int x)
+{
+    cursor_y = y;
+    cursor_x = x;
+}
+
+
+void
+headless_hook_update(int y, int x)
+{
+    long long t;
+    int needed;
+
+    if (y >= rows || x >= cols)
+        return;
+
+    t = now_ns();
+    needed = uncursed_rhook_needsupdate(y, x);
+    frame_counters.rhook_ns += now_ns() - t;
+
+    if (needed)
+        draw_cell(y, x);
+}
+
+
+void
+headless_hook_fullredraw(void)
+{
+    int y, x;
+
+    frame_counters.bytes += strlen(CSI "2J");
+    term_y = term_x = term_color = -1;
+
+    for (y = 0; y < rows; y++)
+        for (x = 0; x < cols; x++)
+            draw_cell(y, x);
+}
+
+
+void
+headless_hook_flush(void)
+{
+    move_term_cursor(cursor_y, cursor_x);
+    if (cursor_visible != term_cursor) {
+        frame_counters.bytes += strlen(CSI "?25h");
+        term_cursor = cursor_visible;
+    }
+
+    /* A flush that only repositions the cursor isn't a frame. */
+    if (!frame_counters.cells) {
+        total_counters.bytes += frame_counters.bytes;
+        total_counters.rhook_ns += frame_counters.rhook_ns;
+        memset(&frame_counters, 0, sizeof frame_counters);
+        return;
+    }
+
+    total_counters.frames++;
+    total_counters.cells += frame_counters.cells;
+    total_counters.bytes += frame_counters.bytes;
+    total_counters.rhook_ns += frame_counters.rhook_ns;
+
+    if (statsfile)
+        fprintf(statsfile, "%ld %ld %ld %ld %lld\n", (long)getpid(),
+                total_counters.frames, frame_counters.cells,
+                frame_counters.bytes, frame_counters.rhook_ns);
+
+    memset(&frame_counters, 0, sizeof frame_counters);
+}
+
+
+void
+headless_hook_delay(int ms)
+{
+    skipped_delay_ms += ms;
+}
+
+
+void
+headless_hook_rawsignals(int raw)
+{
+    (void)raw;
+}
+
+
+void
+headless_hook_activatemouse(int active)
+{
+    (void)active;
+}
+
+
+void
+headless_hook_signal_getch(void)
+{
+    char c = 'g';
+
+    if (write(selfpipe[1], &c, 1) < 0) {
+        fprintf(stderr, "\nlibuncursed detected: frozen process\n");
+        abort();
+    }
+}
+
+
+void
+headless_hook_watch_fd(int fd, int watch)
+{
+    if (fd >= FD_SETSIZE)
+        abort(); /* replace UB with defined, noticeable behaviour */
+
+    if (watch) {
+        FD_SET(fd, &watchfds);
+        if (fd >= watchfd_max)
+            watchfd_max = fd + 1;
+    } else {
+        FD_CLR(fd, &watchfds);
+        while (watchfd_max && !FD_ISSET(watchfd_max - 1, &watchfds))
+            watchfd_max--;
+    }
+}
+
+
+/* As in tty.c: if an fd becomes invalid, stop watching it, rather than
+   having select() fail on it. */
+static void
+unwatch_bad_fds(void)
+{
+    int i;
+
+    for (i = 0; i < watchfd_max; i++)
+        if (FD_ISSET(i, &watchfds) && fcntl(i, F_GETFD, 0) == -1)
+            headless_hook_watch_fd(i, 0);
+}
+
+
+/* Reads one UTF-8 character from stdin (which is known to be readable). */
+static int
+read_codepoint(void)
+{
+    unsigned char c;
+    int cp, extra, ret;
+
+    while ((ret = read(0, &c, 1)) == -1 && errno == EINTR)
+        ;
+    if (ret <= 0) {
+        hangup = 1;
+        return KEY_HANGUP + KEY_BIAS;
+    }
+
+    if (c == 27)
+        return KEY_ESCAPE + KEY_BIAS;
+    if (c == 127)
+        return KEY_BACKSPACE + KEY_BIAS;    /* as in tty.c */
+    if (c < 0x80)
+        return c;
+
+    if (c >= 0xf0 && c < 0xf8) {
+        cp = c & 0x07;
+        extra = 3;
+    } else if (c >= 0xe0) {
+        cp = c & 0x0f;
+        extra = 2;
+    } else if (c >= 0xc0) {
+        cp = c & 0x1f;
+        extra = 1;
+    } else
+        return KEY_INVALID + KEY_BIAS;
+
+    while (extra--) {
+        while ((ret = read(0, &c, 1)) == -1 && errno == EINTR)
+            ;
+        if (ret <= 0) {
+            hangup = 1;
+            return KEY_HANGUP + KEY_BIAS;
+        }
+        if ((c & 0xc0) != 0x80)
+            return KEY_INVALID + KEY_BIAS;
+        cp = (cp << 6) | (c & 0x3f);
+    }
+
+    if (cp >= 0x110000)
+        return KEY_INVALID + KEY_BIAS;
+    return cp;
+}
+
+
+int
+headless_hook_getkeyorcodepoint(int timeout_ms)
+{
+    struct timeval t;
+    fd_set readfds;
+    char signalcode;
+    int max, s;
+
+    for (;;) {
+        if (hangup)
+            return KEY_HANGUP + KEY_BIAS;
+
+        unwatch_bad_fds();
+        memcpy(&readfds, &watchfds, sizeof readfds);
+        FD_SET(0, &readfds);
+        FD_SET(selfpipe[0], &readfds);
+        max = selfpipe[0] > watchfd_max ? selfpipe[0] : watchfd_max;
+
+        t.tv_sec = timeout_ms / 1000;
+        t.tv_usec = (timeout_ms % 1000) * 1000;
+
+        s = select(max + 1, &readfds, 0, 0, timeout_ms >= 0 ? &t : 0);
+        if (s == 0)
+            return KEY_SILENCE + KEY_BIAS;
+        if (s < 0 && errno == EINTR)
+            continue;
+        if (s < 0) {
+            hangup = 1;
+            continue;
+        }
+
+        if (FD_ISSET(selfpipe[0], &readfds) &&
+            read(selfpipe[0], &signalcode, 1) == 1)
+            return KEY_SIGNAL + KEY_BIAS;
+        if (FD_ISSET(0, &readfds))
+            return read_codepoint();
+        return KEY_OTHERFD + KEY_BIAS;
+    }
+}
+
+/* headless.c */
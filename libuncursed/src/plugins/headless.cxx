@@ -0,0 +1,61 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c++;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* The 'uncursed' rendering library may be distributed under either of the
+ * following licenses:
+ *  - the NetHack General Public License
+ *  - the GNU General Public License v2 or later
+ * If you obtained uncursed as part of NetHack 4, you can find these licenses in
+ * the files libnethack/dat/license and libnethack/dat/gpl respectively.
+ */
+
+/* Plugin wrapper for the headless backend to the uncursed rendering library.
+   Based on tty.cxx. */
+
+/* headless.cxx is always linked statically. */
+#define UNCURSED_MAIN_PROGRAM
+
+#include "uncursed_hooks.h"
+#include "uncursed_headless.h"
+
+static struct uncursed_hooks headless_uncursed_hooks = {
+    headless_hook_init,
+    headless_hook_exit,
+    headless_hook_beep,
+    headless_hook_setcursorsize,
+    headless_hook_positioncursor,
+    NULL,
+    NULL,
+    headless_hook_update,
+    headless_hook_fullredraw,
+    headless_hook_flush,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    headless_hook_delay,
+    headless_hook_rawsignals,
+    headless_hook_activatemouse,
+    headless_hook_getkeyorcodepoint,
+    headless_hook_signal_getch,
+    headless_hook_watch_fd,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    uncursed_hook_type_input,
+    "headless",
+    0,
+    0
+};
+
+class headless_uncursed_hook_import {
+public:
+    headless_uncursed_hook_import() {
+        headless_uncursed_hooks.next_hook = uncursed_hook_list;
+        uncursed_hook_list = &headless_uncursed_hooks;
+    }
+};
+
+static headless_uncursed_hook_import importer;
@@ -0,0 +1,513 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* The 'uncursed' rendering library may be distributed under either of the
+ * following licenses:
+ *  - the NetHack General Public License
+ *  - the GNU General Public License v2 or later
+ * If you obtained uncursed as part of NetHack 4, you can find these licenses in
+ * the files libnethack/dat/license and libnethack/dat/gpl respectively.
+ */
+
+/*
+ * This is a recording backend for the uncursed rendering library. Rather than
+ * recording the bytes sent to a terminal (as ttyrec does), it records what is
+ * actually on the screen: each frame contains only the cells that changed
+ * since the previous frame, plus the cursor position. Every so often, it writes
+ * a keyframe containing the whole screen, and the file ends with an index of
+ * the keyframes, so that a player can jump to any point in the recording
+ * without having to replay everything before it. The format is described in
+ * uncursed_record.h; uncrec2ttyrec converts recordings to ttyrec.
+ *
+ * The plugin keeps its own copy of the screen as last recorded, and compares
+ * against that, rather than using uncursed_rhook_updated (which belongs to the
+ * input plugin); so it doesn't matter whether or how the input plugin draws
+ * the screen.
+ */
+
+#ifdef AIMAKE_BUILDOS_MSWin32
+# include <windows.h>
+#else
+# define _POSIX_C_SOURCE 199309L        /* for clock_gettime */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* record.c is always linked statically. */
+#define UNCURSED_MAIN_PROGRAM
+
+#include "uncursed_hooks.h"
+#include "uncursed.h"
+#include "uncursed_record.h"
+
+/* How often to write a keyframe, in milliseconds of recording and in bytes
+   of deltas since the last one; whichever comes first. */
+#define KEYFRAME_INTERVAL_MS 10000
+#define KEYFRAME_INTERVAL_BYTES 65536
+
+struct record_cell {
+    int color;
+    int len;
+    char utf8[CCHARW_MAX * 4];
+};
+
+static FILE *recfile = NULL;
+
+static int rows = 0, cols = 0;
+static struct record_cell *shadow = NULL;   /* the screen, as last recorded */
+static unsigned char *dirty = NULL;         /* cells that might have changed */
+static int any_dirty = 0;
+
+static int cursor_y = 0, cursor_x = 0, cursor_visible = 1;
+static int rec_cursor_y, rec_cursor_x, rec_cursor_visible;
+
+static long long start_ms, last_frame_ms, last_keyframe_ms;
+static long bytes_since_keyframe;
+static int need_keyframe;
+
+/* The payload of the frame being written. */
+static unsigned char *frame = NULL;
+static size_t frame_len = 0, frame_size = 0;
+static int frame_failed = 0;    /* we ran out of memory for a frame */
+
+static struct record_index_entry {
+    long long ms;
+    long offset;
+} *keyframe_index = NULL;
+static int keyframe_count = 0, keyframe_index_size = 0;
+
+
+static long long
+now_ms(void)
+{
+#ifdef AIMAKE_BUILDOS_MSWin32
+    return GetTickCount();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+#endif
+}
+
+
+static void
+frame_bytes(const void *p, size_t len)
+{
+    if (frame_failed)
+        return;
+
+    if (frame_len + len > frame_size) {
+        size_t new_size = frame_size ? frame_size * 2 : 4096;
+        unsigned char *new_frame;
+
+        if (new_size < frame_len + len)
+            new_size = frame_len + len;
+        new_frame = realloc(frame, new_size);
+        if (!new_frame) {
+            /* There's nowhere to report this; give up on the recording. */
+            frame_failed = 1;
+            record_hook_stoprecording();
+            return;
+        }
+        frame = new_frame;
+        frame_size = new_size;
+    }
+    memcpy(frame + frame_len, p, len);
+    frame_len += len;
+}
+
+
+static int
+encode_varint(unsigned long long n, unsigned char *buf)
+{
+    int len = 0;
+
+    while (n >= 0x80) {
+        buf[len++] = (n & 0x7f) | 0x80;
+        n >>= 7;
+    }
+    buf[len++] = n;
+    return len;
+}
+
+
+static void
+frame_varint(unsigned long long n)
+{
+    unsigned char buf[10];
+
+    frame_bytes(buf, encode_varint(n, buf));
+}
+
+
+static void
+file_varint(FILE *f, unsigned long long n)
+{
+    unsigned char buf[10];
+
+    fwrite(buf, 1, encode_varint(n, buf), f);
+}
+
+
+/* Writes out the frame payload that's been built up, with the given type. */
+static void
+write_frame(int type, long long ms)
+{
+    if (!recfile)
+        return;
+
+    fputc(type, recfile);
+    file_varint(recfile, ms - last_frame_ms);
+    file_varint(recfile, frame_len);
+    fwrite(frame, 1, frame_len, recfile);
+
+    bytes_since_keyframe += frame_len;
+    last_frame_ms = ms;
+    frame_len = 0;
+
+    /* A recording that can't be written is useless; and reporting errors to
+       the user would mess up the screen. So just stop quietly. */
+    if (ferror(recfile))
+        record_hook_stoprecording();
+}
+
+
+static void
+read_cell(int y, int x, struct record_cell *cell)
+{
+    const char *s = uncursed_rhook_utf8_at(y, x);
+    int len = strlen(s);
+
+    if (len > (int)sizeof cell->utf8)
+        len = sizeof cell->utf8;
+
+    cell->color = uncursed_rhook_color_at(y, x);
+    cell->len = len;
+    memcpy(cell->utf8, s, len);
+}
+
+
+static int
+cells_differ(const struct record_cell *a, const struct record_cell *b)
+{
+    return a->color != b->color || a->len != b->len ||
+        memcmp(a->utf8, b->utf8, a->len) != 0;
+}
+
+
+static void
+frame_cell(const struct record_cell *cell, int *color)
+{
+    int color_changed = cell->color != *color;
+
+    frame_varint((cell->len << 1) | color_changed);
+    if (color_changed)
+        frame_varint(cell->color);
+    frame_bytes(cell->utf8, cell->len);
+    *color = cell->color;
+}
+
+
+static void
+frame_cursor(void)
+{
+    frame_varint(cursor_y);
+    frame_varint(cursor_x);
+    frame_varint(cursor_visible);
+
+    rec_cursor_y = cursor_y;
+    rec_cursor_x = cursor_x;
+    rec_cursor_visible = cursor_visible;
+}
+
+
+static void
+write_keyframe(long long ms)
+{
+    int y, x, color = UNCREC_DEFAULT_COLOR;
+    long offset = ftell(recfile);
+
+    if (keyframe_count == keyframe_index_size) {
+        int new_size = keyframe_index_size ? keyframe_index_size * 2 : 64;
+        struct record_index_entry *new_index =
+            realloc(keyframe_index, new_size * sizeof *keyframe_index);
+
+        if (!new_index) {
+            /* The keyframes so far can still be indexed. */
+            record_hook_stoprecording();
+            return;
+        }
+        keyframe_index = new_index;
+        keyframe_index_size = new_size;
+    }
+    keyframe_index[keyframe_count].ms = ms - start_ms;
+    keyframe_index[keyframe_count].offset = offset;
+    keyframe_count++;
+
+    frame_varint(ms - start_ms);
+    frame_varint(rows);
+    frame_varint(cols);
+    frame_cursor();
+    for (y = 0; y < rows; y++)
+        for (x = 0; x < cols; x++) {
+            read_cell(y, x, shadow + y * cols + x);
+            frame_cell(shadow + y * cols + x, &color);
+        }
+
+    memset(dirty, 0, rows * cols);
+    any_dirty = 0;
+    need_keyframe = 0;
+    last_keyframe_ms = ms;
+
+    write_frame(UNCREC_KEYFRAME, ms);
+    bytes_since_keyframe = 0;
+}
+
+
+/* Writes the cells that changed since the last frame, if any. */
+static void
+write_delta(long long ms)
+{
+    struct record_cell cell;
+    int pos, end = rows * cols, changed = 0;
+    int run_start, last_end = 0, color = UNCREC_DEFAULT_COLOR;
+
+    /* First, work out which of the cells that might have changed actually
+       did; uncursed often asks to update cells that are being redrawn with
+       their old contents. */
+    if (any_dirty) {
+        for (pos = 0; pos < end; pos++) {
+            if (!dirty[pos])
+                continue;
+            read_cell(pos / cols, pos % cols, &cell);
+            if (cells_differ(&cell, shadow + pos)) {
+                shadow[pos] = cell;
+                changed = 1;
+            } else
+                dirty[pos] = 0;
+        }
+        any_dirty = 0;
+    }
+
+    if (!changed && cursor_y == rec_cursor_y && cursor_x == rec_cursor_x &&
+        cursor_visible == rec_cursor_visible)
+        return;
+
+    frame_cursor();
+    for (pos = 0; changed && pos < end; pos++) {
+        if (!dirty[pos])
+            continue;
+
+        for (run_start = pos; pos < end && dirty[pos]; pos++)
+            dirty[pos] = 0;
+        frame_varint(run_start - last_end);
+        frame_varint(pos - run_start);
+        for (; run_start < pos; run_start++)
+            frame_cell(shadow + run_start, &color);
+        last_end = pos;
+    }
+
+    write_frame(UNCREC_DELTA, ms);
+}
+
+
+static void
+set_size(int h, int w)
+{
+    if (h == rows && w == cols && shadow)
+        return;
+
+    rows = h;
+    cols = w;
+    free(shadow);
+    free(dirty);
+    shadow = calloc(rows * cols, sizeof *shadow);
+    dirty = calloc(rows * cols, 1);
+    if (!shadow || !dirty) {
+        rows = cols = 0;
+        record_hook_stoprecording();
+    }
+    need_keyframe = 1;
+}
+
+
+void
+record_hook_init(int *h, int *w, const char *title)
+{
+    (void)title;
+
+    /* The input plugin has already set the size of the screen. */
+    set_size(*h, *w);
+}
+
+
+void
+record_hook_exit(void)
+{
+    /* We may be initialized again later, so keep recording; but make sure
+       that what we have so far is on disk. */
+    if (recfile)
+        fflush(recfile);
+}
+
+
+void
+record_hook_beep(void)
+{
+    if (recfile)
+        write_frame(UNCREC_BEEP, now_ms());
+}
+
+
+void
+record_hook_setcursorsize(int size)
+{
+    cursor_visible = size != 0;
+}
+
+
+void
+record_hook_positioncursor(int y, int x)
+{
+    cursor_y = y;
+    cursor_x = x;
+}
+
+
+void
+record_hook_update(int y, int x)
+{
+    if (!recfile || y >= rows || x >= cols)
+        return;
+
+    dirty[y * cols + x] = 1;
+    any_dirty = 1;
+}
+
+
+void
+record_hook_fullredraw(void)
+{
+    if (!recfile)
+        return;
+
+    memset(dirty, 1, rows * cols);
+    any_dirty = 1;
+}
+
+
+void
+record_hook_flush(void)
+{
+    long long ms;
+
+    if (!recfile)
+        return;
+
+    ms = now_ms();
+    if (need_keyframe ||
+        ((any_dirty || cursor_y != rec_cursor_y || cursor_x != rec_cursor_x ||
+          cursor_visible != rec_cursor_visible) &&
+         (ms - last_keyframe_ms >= KEYFRAME_INTERVAL_MS ||
+          bytes_since_keyframe >= KEYFRAME_INTERVAL_BYTES)))
+        write_keyframe(ms);
+    else
+        write_delta(ms);
+}
+
+
+void
+record_hook_recordkeyorcodepoint(int k)
+{
+    /* Only the output is recorded. */
+    (void)k;
+}
+
+
+void
+record_hook_resized(int h, int w)
+{
+    set_size(h, w);
+}
+
+
+void
+record_hook_startrecording(char *fn)
+{
+    char filename[strlen(fn) + sizeof UNCREC_EXTENSION];
+
+    if (recfile)
+        record_hook_stoprecording();
+    if (!shadow)
+        return;     /* we weren't initialized */
+
+    strcpy(filename, fn);
+    strcat(filename, UNCREC_EXTENSION);
+    recfile = fopen(filename, "wb");
+    if (!recfile)
+        return;
+
+    fwrite(UNCREC_MAGIC, 1, UNCREC_MAGIC_LEN, recfile);
+    file_varint(recfile, time(NULL));
+
+    start_ms = last_frame_ms = now_ms();
+    keyframe_count = 0;
+    frame_len = 0;
+    frame_failed = 0;
+    write_keyframe(start_ms);
+}
+
+
+void
+record_hook_stoprecording(void)
+{
+    unsigned char trailer[UNCREC_TRAILER_LEN];
+    FILE *f = recfile;
+    long offset;
+    int i;
+
+    if (!f)
+        return;
+
+    /* Stop recording first, so that errors while writing the index can't
+       recurse back here. */
+    recfile = NULL;
+
+    /* A frame that was interrupted by an error can't be written. */
+    frame_len = 0;
+
+    offset = ftell(f);
+    if (keyframe_index && offset != -1) {
+        frame_varint(keyframe_count);
+        for (i = 0; i < keyframe_count; i++) {
+            frame_varint(keyframe_index[i].ms);
+            frame_varint(keyframe_index[i].offset);
+        }
+
+        /* Without the memory for the index, leave it out, as though the
+           recording had been cut off. */
+        if (!frame_failed) {
+            fputc(UNCREC_INDEX, f);
+            fputc(0, f);        /* time since the last frame is irrelevant */
+            file_varint(f, frame_len);
+            fwrite(frame, 1, frame_len, f);
+
+            memcpy(trailer, UNCREC_TRAILER_MAGIC, 4);
+            for (i = 0; i < 8; i++)
+                trailer[4 + i] =
+                    ((unsigned long long)offset >> (i * 8)) & 0xff;
+            fwrite(trailer, 1, UNCREC_TRAILER_LEN, f);
+        }
+    }
+    frame_len = 0;
+
+    fclose(f);
+
+    free(keyframe_index);
+    keyframe_index = NULL;
+    keyframe_count = keyframe_index_size = 0;
+}
+
+/* record.c */
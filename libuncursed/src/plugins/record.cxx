@@ -0,0 +1,61 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c++;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* The 'uncursed' rendering library may be distributed under either of the
+ * following licenses:
+ *  - the NetHack General Public License
+ *  - the GNU General Public License v2 or later
+ * If you obtained uncursed as part of NetHack 4, you can find these licenses in
+ * the files libnethack/dat/license and libnethack/dat/gpl respectively.
+ */
+
+/* Plugin wrapper for the recording backend to the uncursed rendering library.
+   Based on tty.cxx. */
+
+/* record.cxx is always linked statically. */
+#define UNCURSED_MAIN_PROGRAM
+
+#include "uncursed_hooks.h"
+#include "uncursed_record.h"
+
+static struct uncursed_hooks record_uncursed_hooks = {
+    record_hook_init,
+    record_hook_exit,
+    record_hook_beep,
+    record_hook_setcursorsize,
+    record_hook_positioncursor,
+    NULL,
+    NULL,
+    record_hook_update,
+    record_hook_fullredraw,
+    record_hook_flush,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    record_hook_recordkeyorcodepoint,
+    record_hook_resized,
+    record_hook_startrecording,
+    record_hook_stoprecording,
+    NULL,
+    uncursed_hook_type_recording,
+    "record",
+    0,
+    0
+};
+
+class record_uncursed_hook_import {
+public:
+    record_uncursed_hook_import() {
+        record_uncursed_hooks.next_hook = uncursed_hook_list;
+        uncursed_hook_list = &record_uncursed_hooks;
+    }
+};
+
+static record_uncursed_hook_import importer;
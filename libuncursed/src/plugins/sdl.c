@@ -114,6 +114,16 @@ static SDL_Texture *font = NULL;
 static SDL_Texture *screen = NULL;
 static SDL_Texture *rendertarget = NULL; /* most recently used render target */
 
+/* The parts of screen that have been drawn on since the last flush, which are
+   all that need copying to the window. (With hardware rendering, the window's
+   contents are lost at each present, so it's all copied anyway; but we can
+   still skip frames in which nothing changed.) */
+#define MAX_DIRTY_RECTS 64
+static SDL_Rect dirty_rects[MAX_DIRTY_RECTS];
+static int dirty_count = 0;
+static int all_dirty = 1;
+static int software_renderer = 0;
+
 
 static SDL_Texture *
 load_png_file_to_texture(const char *filename, int *w, int *h)
@@ -263,6 +273,48 @@ cleanup_nothing:
 }
 
 
+static void
+mark_dirty(int x, int y, int w, int h)
+{
+    int i;
+
+    if (all_dirty)
+        return;
+
+    /* Characters tend to be drawn left to right, so extend the last
+       rectangle if we can. */
+    if (dirty_count) {
+        SDL_Rect *last = dirty_rects + dirty_count - 1;
+
+        if (last->y == y && last->h == h && last->x + last->w == x) {
+            last->w += w;
+            return;
+        }
+    }
+
+    if (dirty_count == MAX_DIRTY_RECTS) {
+        /* Too many to keep track of; just copy everything they cover. */
+        for (i = 1; i < dirty_count; i++)
+            SDL_UnionRect(dirty_rects, dirty_rects + i, dirty_rects);
+        dirty_count = 1;
+        SDL_UnionRect(dirty_rects,
+                      &(SDL_Rect) {.x = x, .y = y, .w = w, .h = h},
+                      dirty_rects);
+        return;
+    }
+
+    dirty_rects[dirty_count++] = (SDL_Rect) {.x = x, .y = y, .w = w, .h = h};
+}
+
+
+static void
+mark_all_dirty(void)
+{
+    all_dirty = 1;
+    dirty_count = 0;
+}
+
+
 void
 sdl_hook_beep(void)
 {
@@ -401,6 +453,8 @@ update_window_sizes(int hard_update)
     SDL_RenderPresent(render);
     SDL_SetRenderTarget(render, screen);
     rendertarget = screen;
+    all_dirty = 0;
+    dirty_count = 0;
 }
 
 static void
@@ -486,6 +540,7 @@ sdl_hook_init(int *h, int *w, const char *title)
         winwidth = winheight = 0;
 
         int i, bestrender = -1, bestrenderscore = 8;
+        Uint32 bestrenderflags = 0;
 
         /* Look for desirable renderer properties. We /must/ have the ability
            to target textures. It's nice to have hardware acceleration and
@@ -526,15 +581,24 @@ sdl_hook_init(int *h, int *w, const char *title)
             if (score > bestrenderscore) {
                 bestrender = i;
                 bestrenderscore = score;
+                bestrenderflags = ri.flags;
             }
         }
 
+#ifdef SDL_HINT_RENDER_BATCHING
+        /* We draw a lot of small rectangles, mostly copied from the same font
+           texture; let SDL send them to the GPU in batches. (It only does this
+           by default if it chose the renderer itself.) */
+        SDL_SetHint(SDL_HINT_RENDER_BATCHING, "1");
+#endif
+
         if (bestrender != -1) {
             debugprintf("Chose renderer %d\n", bestrender);
             render =
                 SDL_CreateRenderer(win, bestrender,
-                                   SDL_RENDERER_ACCELERATED |
-                                   SDL_RENDERER_PRESENTVSYNC |
+                                   (bestrenderflags &
+                                    (SDL_RENDERER_ACCELERATED |
+                                     SDL_RENDERER_PRESENTVSYNC)) |
                                    SDL_RENDERER_TARGETTEXTURE);
             rendertarget = NULL;
         } else {
@@ -543,12 +607,26 @@ sdl_hook_init(int *h, int *w, const char *title)
             exit(EXIT_FAILURE);
         }
 
+        if (!render) {
+            /* The hardware renderers are listed even if there's no usable
+               GPU (e.g. with the dummy video driver); fall back to software
+               rendering in that case. */
+            debugprintf("Could not create renderer: %s\n", SDL_GetError());
+            render = SDL_CreateRenderer(win, -1, SDL_RENDERER_SOFTWARE |
+                                        SDL_RENDERER_TARGETTEXTURE);
+        }
+
         if (!render) {
             fprintf(stderr, "Error creating an SDL renderer: %s\n",
                     SDL_GetError());
             exit(EXIT_FAILURE);
         }
 
+        SDL_RendererInfo ri;
+
+        if (SDL_GetRendererInfo(render, &ri) == 0)
+            software_renderer = !!(ri.flags & SDL_RENDERER_SOFTWARE);
+
         /* We want to be able to parse text as well as keypresses. If someone
            presses, say, ' then e, we want to be able to interpret it as
            "'e" or "é" depending on their input method. */
@@ -804,14 +882,19 @@ drain_userevents(void)
 int
 sdl_hook_getkeyorcodepoint(int timeout_ms)
 {
-    /* Screen redrawing causes major lag (TODO: figure out why).
-       To avoid snowballing lag resulting by queueing up
+    /* To avoid snowballing lag resulting by queueing up
        WINDOWEVENT_EXPOSED (what causes redraws) cases,
-       only redraw once for every X events queued up. */
+       only redraw once for every X events queued up. An expose just needs
+       the screen texture copying to the window again; if the renderer lost
+       its textures, though, everything has to be drawn again. */
     int redraw = 0;
     int ret = getkeyorcodepoint_inner(timeout_ms, &redraw);
-    if (redraw)
+    if (redraw == 2)
         sdl_hook_fullredraw();
+    else if (redraw) {
+        mark_all_dirty();
+        sdl_hook_flush();
+    }
 
     return ret;
 }
@@ -894,7 +977,7 @@ getkeyorcodepoint_inner(int timeout_ms, int *redraw)
                 e.window.event == SDL_WINDOWEVENT_RESTORED)
                 resized_recently = 1;
 
-            if (e.window.event == SDL_WINDOWEVENT_EXPOSED)
+            if (e.window.event == SDL_WINDOWEVENT_EXPOSED && !*redraw)
                 *redraw = 1;
 
             if (e.window.event == SDL_WINDOWEVENT_CLOSE) {
@@ -905,6 +988,12 @@ getkeyorcodepoint_inner(int timeout_ms, int *redraw)
 
             break;
 
+        case SDL_RENDER_TARGETS_RESET:
+        case SDL_RENDER_DEVICE_RESET:
+
+            *redraw = 2;
+            break;
+
         case SDL_TEXTEDITING:
 
             key_tick_target = -1;
@@ -1368,6 +1457,7 @@ update_region(struct sdl_tile_region *r)
                                SDL_ALPHA_OPAQUE);
         SDL_RenderFillRect(render,
                            &(SDL_Rect) {.x = lt, .y = tt, .w = w, .h = h});
+        mark_dirty(lt, tt, w, h);
         if (lf < 0) {
             w -= -lf;
             lt += -lf;
@@ -1449,6 +1539,7 @@ update_cell(int y, int x, struct sdl_tile_region *current_region)
                            .y = y * fontheight,
                            .w = fontwidth,
                            .h = fontheight});
+    mark_dirty(x * fontwidth, y * fontheight, fontwidth, fontheight);
 
     /* Draw the foreground. */
     if (region) {
@@ -1561,6 +1652,7 @@ sdl_hook_fullredraw(void)
                            .w = fontwidth * winwidth,
                            .h = fontheight * winheight
                        });
+    mark_all_dirty();
 
     for (j = 0; j < winheight; j++)
         for (i = 0; i < winwidth; i++)
@@ -1571,19 +1663,35 @@ sdl_hook_fullredraw(void)
 void
 sdl_hook_flush(void)
 {
+    int i;
+
+    if (!all_dirty && !dirty_count)
+        return;         /* nothing changed since the last frame */
+
     if (rendertarget != NULL)
         SDL_SetRenderTarget(render, NULL);
     rendertarget = NULL;
-    SDL_RenderCopy(render, screen,
-                   &(SDL_Rect) {      /* source */
-                       .x = 0,
-                       .y = 0,
-                       .w = fontwidth * winwidth,
-                       .h = fontheight * winheight},
-                   &(SDL_Rect) {      /* destination */
-                       .x = 0,
-                       .y = 0,
-                       .w = fontwidth * winwidth,
-                       .h = fontheight * winheight});
+
+    /* The software renderer draws straight onto the window's surface, which
+       keeps its contents between frames, so only the changed parts need to be
+       copied. Other renderers might not preserve the window contents. */
+    if (all_dirty || !software_renderer)
+        SDL_RenderCopy(render, screen,
+                       &(SDL_Rect) {      /* source */
+                           .x = 0,
+                           .y = 0,
+                           .w = fontwidth * winwidth,
+                           .h = fontheight * winheight},
+                       &(SDL_Rect) {      /* destination */
+                           .x = 0,
+                           .y = 0,
+                           .w = fontwidth * winwidth,
+                           .h = fontheight * winheight});
+    else
+        for (i = 0; i < dirty_count; i++)
+            SDL_RenderCopy(render, screen, dirty_rects + i, dirty_rects + i);
+
     SDL_RenderPresent(render);
+    all_dirty = 0;
+    dirty_count = 0;
 }
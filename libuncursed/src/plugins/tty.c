@@ -97,10 +97,11 @@
 #include "uncursed_hooks.h"
 #include "uncursed.h"
 #include "uncursed_tty.h"
+#include "uncursed_sgr.h"
 
-/* Note: ifile only uses platform-specific read functions like read(); ofile
-   only uses stdio for output (e.g. fputs), but all output to ofile while the
-   terminal is initialized is abstracted via ofile_output anyway. Try not to
+/* Note: ifile only uses platform-specific read functions like read(); output
+   to ofile while the terminal is initialized is buffered by ofile_write, and
+   sent with write() by tty_hook_flush, rather than via stdio. Try not to
    muddle these! */
 #define ofile stdout
 #define ifile stdin
@@ -162,30 +163,70 @@ parse_utf8(char *s)
     return r;
 }
 
-static int chars_since_flush = 0;
+/* Output is collected here, and sent to the terminal in one write() when
+   uncursed flushes (normally once per frame); this is much cheaper than going
+   through stdio, and also cuts down on frames in a ttyrec. */
+static char obuf[OFILE_BUFFER_SIZE];
+static int obuf_len = 0;
+
+static void
+ofile_write(const char *s, int len)
+{
+    /* Older versions of Konsole dislike it when a write ends in the middle of
+       a UTF-8 character. Each call here is a whole character or escape
+       sequence, so we avoid that by only flushing between calls. */
+    if (obuf_len + len > OFILE_BUFFER_SIZE)
+        tty_hook_flush();
+
+    memcpy(obuf + obuf_len, s, len);
+    obuf_len += len;
+}
+
+static void
+ofile_outputs(const char *s)
+{
+    ofile_write(s, strlen(s));
+}
+
 static void
 ofile_output(const char *format, ...)
 {
+    char buf[256];
     va_list v;
+    int len;
 
     va_start(v, format);
-    chars_since_flush += vfprintf(ofile, format, v);
+    len = vsnprintf(buf, sizeof buf, format, v);
     va_end(v);
 
-    if (chars_since_flush > OFILE_BUFFER_SIZE - 200) {
-        /* Older versions of Konsole dislike it when stdio flushes in the
-           middle of a UTF-8 character. We solve the issue by flushing ourself,
-           before stdio gets the chance. We told it to flush once every
-           OFILE_BUFFER_SIZE bytes; allow some headroom on that because we often
-           send more than one byte at a time. */
-        tty_hook_flush();
-    }
+    if (len >= (int)sizeof buf)
+        len = sizeof buf - 1;
+    if (len > 0)
+        ofile_write(buf, len);
 }
 
 static void
-ofile_outputs(const char *s)
+ofile_number(int n)
 {
-    ofile_output("%s", s);
+    char buf[12];
+    int i = sizeof buf;
+
+    do {
+        buf[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+
+    ofile_write(buf + i, sizeof buf - i);
+}
+
+static void
+ofile_movecursor(int y, int x)
+{
+    ofile_outputs(CSI);
+    ofile_number(y + 1);
+    ofile_outputs(";");
+    ofile_number(x + 1);
+    ofile_outputs("H");
 }
 
 /* Linux-specific functions */
@@ -641,7 +682,7 @@ record_and_measure_terminal_size(int *h, int *w)
        with slightly worse ttyrecs. */
     if (*h != last_h || *w != last_w) {
         /* Send a terminal resize code, for watchers/recorders. */
-        fprintf(ofile, CSI "8;%d;%dt", *h, *w);
+        ofile_output(CSI "8;%d;%dt", *h, *w);
     }
 #endif
     last_h = *h;
@@ -673,7 +714,7 @@ static void
 set_charset(int y, int x)
 {
     if (x > -1)
-        fprintf(ofile, CSI "%d;%dH", y + 1, x + 1);     /* move cursor */
+        ofile_movecursor(y, x);                         /* move cursor */
 
     /* Tell the terminal the cursor status we remembered, if there is one;
        this means that anyone watching will have their cursor sync up with the
@@ -685,19 +726,19 @@ set_charset(int y, int x)
     }
 
     if (x > -1)
-        fprintf(ofile, CSI "%d;%dH", y + 1, x + 1);     /* move cursor */
+        ofile_movecursor(y, x);                         /* move cursor */
 
     ofile_outputs("\x0f");            /* select character set G0 */
 
     if (x > -1)
-        fprintf(ofile, CSI "%d;%dH", y + 1, x + 1);
+        ofile_movecursor(y, x);
 
     if (supports_utf8) {
 
         ofile_outputs("\x1b(B");      /* select default character set for G0 */
 
         if (x > -1)
-            fprintf(ofile, CSI "%d;%dH", y + 1, x + 1);
+            ofile_movecursor(y, x);
 
         ofile_outputs("\x1b%G");      /* set character set as UTF-8 */
 
@@ -706,7 +747,7 @@ set_charset(int y, int x)
         ofile_outputs("\x1b%@");      /* disable Unicode, set default
                                            character set */
         if (x > -1)
-            fprintf(ofile, CSI "%d;%dH", y + 1, x + 1);
+            ofile_movecursor(y, x);
 
         ofile_outputs("\x1b(U");      /* select null mapping, = cp437 on a PC */
     }
@@ -720,7 +761,7 @@ static int use_palette = 0;
 static void
 reset_palette(void)
 {
-    fprintf(ofile, "\r" OSC "104" ST "\r" OSC "R" ST);
+    ofile_outputs("\r" OSC "104" ST "\r" OSC "R" ST);
 }
 
 
@@ -784,7 +825,7 @@ tty_hook_positioncursor(int y, int x)
     if (last_y == y && last_x == x)
         return;
 
-    fprintf(ofile, CSI "%d;%dH", y + 1, x + 1);          /* move cursor */
+    ofile_movecursor(y, x);                              /* move cursor */
     tty_hook_flush();
 
     last_y = y;
@@ -798,7 +839,8 @@ static int getkeyorcodepoint_inner(int, int);
 static void
 clear_terminal(void)
 {
-    int i;
+    static const char nuls[8192];
+
     /* There's a bug observed on some terminals (e.g. dvtm) where they're
        waiting for something at this point. (I'm not entirely sure what; my top
        theory was BEL to terminate an xterm-like string, but that doesn't seem
@@ -806,8 +848,7 @@ clear_terminal(void)
        because it causes beeping.) We instead send eight kibibytes of NUL
        characters, which takes those terminals out of wait mode because their
        internal buffers run out of space. */
-    for (i = 0; i < 8192; i++)
-        ofile_output("%c", 0);
+    ofile_write(nuls, sizeof nuls);
 
     ofile_outputs("\x11");                               /* XON */
     tty_hook_flush();
@@ -1202,12 +1243,51 @@ tty_hook_getkeyorcodepoint(int timeout_ms)
     return getkeyorcodepoint_inner(timeout_ms, 0);
 }
 
+/* The SGR sequence for each color_at value, worked out the first time it's
+   needed. */
+#define SGR_CACHE_SIZE 2048     /* fg | bg << 5 | ul << 10 */
+static char sgr_cache[SGR_CACHE_SIZE][UNCURSED_SGR_MAXLEN];
+static int sgr_cache_len[SGR_CACHE_SIZE];
+
+static void
+draw_cell(int y, int x)
+{
+    int color = uncursed_rhook_color_at(y, x);
+
+    if (color != last_color) {
+        last_color = color;
+
+        if (color >= 0 && color < SGR_CACHE_SIZE) {
+            if (!sgr_cache_len[color])
+                sgr_cache_len[color] =
+                    uncursed_make_sgr(color, sgr_cache[color]);
+            ofile_write(sgr_cache[color], sgr_cache_len[color]);
+        } else {
+            char sgr[UNCURSED_SGR_MAXLEN];
+
+            ofile_write(sgr, uncursed_make_sgr(color, sgr));
+        }
+    }
+
+    if (supports_utf8)
+        ofile_outputs(uncursed_rhook_utf8_at(y, x));
+    else {
+        char c = uncursed_rhook_cp437_at(y, x);
+
+        ofile_write(&c, 1);
+    }
+
+    uncursed_rhook_updated(y, x);
+}
+
+/* Draws the run of characters on row y that starts at x and needs updating
+   (or all of row y, if force is set), leaving the cursor just after it. */
 static void
 update_cell(int y, int x, int force)
 {
     int j, i;
 
-    /* If we need to do a full redraw, do so. */
+    /* If we need to do a full redraw, do so, a row at a time. */
     if (terminal_contents_unknown) {
         terminal_contents_unknown = 0;
         last_color = -1;
@@ -1215,8 +1295,7 @@ update_cell(int y, int x, int force)
         last_x = -1;
 
         for (j = 0; j < last_h; j++)
-            for (i = 0; i < last_w; i++)
-                update_cell(j, i, 1);
+            update_cell(j, 0, 1);
         return;
     }
 
@@ -1228,7 +1307,7 @@ update_cell(int y, int x, int force)
         return;
 
     if (last_y != y || last_x == -1) {
-        ofile_output(CSI "%d;%dH", y + 1, x + 1);        /* move cursor */
+        ofile_movecursor(y, x);                         /* move cursor */
     } else if (last_x > x) {
         if (last_x == x + 1)
             ofile_outputs(CSI "D");                      /* move left */
@@ -1241,76 +1320,28 @@ update_cell(int y, int x, int force)
             ofile_output(CSI "%dC", x - last_x);         /* move right */
     }
 
-    int color = uncursed_rhook_color_at(y, x);
-
-    if (color != last_color) {
-        last_color = color;
-
-        /* The general idea here is to specify bold for bright foreground, but
-           blink for bright background only on terminals without 256-color
-           support (via exploiting the "5" in the code for setting 256-color
-           background). We set the colors using the 8-color code first, then
-           the 16-color code, to get support for 16 colors without losing
-           support for 8 colors. */
-        ofile_outputs(CSI "0;");                         /* SGR reset */
-        if ((color & 31) == 16)         /* default fg */
-            ofile_outputs("39;");                        /* SGR default fg */
-        else if ((color & 31) >= 8)     /* bright fg */
-            /* SGR bold; SGR 8 color (fg & 8); SGR 16 color (fg) */
-            ofile_output("1;%d;%d;", (color & 31) + 22, (color & 31) + 82);
-        else    /* dark fg */
-            ofile_output("%d;", (color & 31) + 30);      /* SGR 8 color (fg) */
-        color >>= 5;
-        if (color & 32)
-            ofile_outputs("4;");                         /* SGR underline */
-        color &= 31;
-        if (color == 16)        /* default bg */
-            ofile_outputs("49m");                        /* SGR default bg */
-        else if (color >= 8)    /* bright bg */
-            /* SGR 256 color 5 /or/ SGR blink (depending on color depth);
-               SGR 8 color (bg & 8); SGR 16 color (bg) */
-            ofile_output("48;5;5;%d;%dm", color + 32, color + 92);
-        else
-            ofile_output("%dm", color + 40);             /* SGR 8 color (bg) */
-    }
-
-    if (supports_utf8)
-        ofile_outputs(uncursed_rhook_utf8_at(y, x));
-    else
-        ofile_output("%c", uncursed_rhook_cp437_at(y, x));
-
-    uncursed_rhook_updated(y, x);
-
+    draw_cell(y, x);
     last_x = x + 1;
     last_y = y;
 
-    /* To save on output, redraw up to three characters that don't need
-       redrawing rather than skipping them. We first check to see if the second,
-       third or fourth character needs an update; if none do, then we're
-       skipping at least four characters (first character doesn't need an
-       update) or zero characters (first character needs an update), and
-       shouldn't do any redundant drawing in either case. If one of those does
-       need an update, we draw up to the first character that needs a
-       non-redundant update using redundant updates. */
-
-    int any_nearby_updates = 0;
-    for (i = last_x + 1; i < last_x + 4 && i < last_w; i++)
-        any_nearby_updates |= uncursed_rhook_needsupdate(y, i);
-
-    while (any_nearby_updates && last_x < last_w) {
-        if (uncursed_rhook_needsupdate(y, last_x))
-            break;
-        if (uncursed_rhook_color_at(y, last_x) != last_color)
-            break;
-        if (supports_utf8)
-            ofile_outputs(uncursed_rhook_utf8_at(y, last_x));
-        else
-            ofile_output("%c", uncursed_rhook_cp437_at(y, last_x));
+    /* Carry on along the row while there are characters that need updating.
+       To save on output, redraw up to three characters that don't need
+       redrawing rather than skipping them (and sending a cursor movement),
+       as long as they're the same color. */
+    while (last_x < last_w) {
+        if (!force && !uncursed_rhook_needsupdate(y, last_x)) {
+            int any_nearby_updates = 0;
 
-        /* futureproofing; we checked that the update isn't needed, so this
-           should technically always be a no-op */
-        uncursed_rhook_updated(y, last_x);
+            for (i = last_x + 1; i < last_x + 4 && i < last_w; i++)
+                any_nearby_updates |= uncursed_rhook_needsupdate(y, i);
 
+            if (!any_nearby_updates)
+                break;
+            if (uncursed_rhook_color_at(y, last_x) != last_color)
+                break;
+        }
+
+        draw_cell(y, last_x);
         last_x++;
     }
 
@@ -1337,6 +1368,17 @@ tty_hook_fullredraw(void)
 void
 tty_hook_flush(void)
 {
-    fflush(ofile);
-    chars_since_flush = 0;
+    int pos = 0, ret;
+
+    fflush(ofile);      /* just in case anything went via stdio */
+
+    while (pos < obuf_len) {
+        ret = write(fileno(ofile), obuf + pos, obuf_len - pos);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            break;      /* nothing useful we can do about it */
+        pos += ret;
+    }
+    obuf_len = 0;
 }
@@ -0,0 +1,417 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* The 'uncursed' rendering library may be distributed under either of the
+ * following licenses:
+ *  - the NetHack General Public License
+ *  - the GNU General Public License v2 or later
+ * If you obtained uncursed as part of NetHack 4, you can find these licenses in
+ * the files libnethack/dat/license and libnethack/dat/gpl respectively.
+ */
+/* Converts a recording made by the "record" plugin into a ttyrec, for use with
+   existing ttyrec players. Optionally, conversion can start partway through
+   the recording; the keyframe index is used to find the place to start, so
+   that it's not necessary to decode everything before it.
+
+   The output uses UTF-8, and the same escape sequences as the tty plugin. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uncursed.h"
+#include "uncursed_record.h"
+#include "uncursed_sgr.h"
+
+#define CSI "\x1b["
+
+struct cell {
+    int color;
+    int len;
+    char utf8[CCHARW_MAX * 4];
+};
+
+static const unsigned char *data, *data_end;
+
+static int rows, cols;
+static struct cell *screen;     /* what the recording says is on screen */
+static struct cell *shown;      /* what the ttyrec has drawn so far */
+static int have_keyframe = 0;
+static int cursor_y, cursor_x, cursor_visible;
+static int shown_cursor_visible = -1;
+
+static char *out;
+static size_t out_len, out_size;
+
+
+static void
+corrupted(void)
+{
+    fprintf(stderr, "Error: the recording is corrupted.\n");
+    exit(EXIT_FAILURE);
+}
+
+
+static unsigned long long
+read_varint(const unsigned char **p, const unsigned char *end)
+{
+    unsigned long long n = 0;
+    int shift = 0;
+
+    do {
+        if (*p >= end || shift > 63)
+            corrupted();
+        n |= (unsigned long long)(**p & 0x7f) << shift;
+        shift += 7;
+    } while (*(*p)++ & 0x80);
+
+    return n;
+}
+
+
+static void
+read_cell(const unsigned char **p, const unsigned char *end, struct cell *cell,
+          int *color)
+{
+    unsigned long long n = read_varint(p, end);
+
+    if (n & 1)
+        *color = read_varint(p, end);
+    n >>= 1;
+    if (n > sizeof cell->utf8 || n > (size_t)(end - *p))
+        corrupted();
+
+    cell->color = *color;
+    cell->len = n;
+    memcpy(cell->utf8, *p, n);
+    *p += n;
+}
+
+
+static void
+output(const char *s, size_t len)
+{
+    if (out_len + len > out_size) {
+        out_size = out_size ? out_size * 2 : 65536;
+        if (out_size < out_len + len)
+            out_size = out_len + len;
+        out = realloc(out, out_size);
+        if (!out) {
+            fprintf(stderr, "Error: out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(out + out_len, s, len);
+    out_len += len;
+}
+
+
+static void
+outputs(const char *s)
+{
+    output(s, strlen(s));
+}
+
+
+static void
+output_sgr(int color)
+{
+    char buf[UNCURSED_SGR_MAXLEN];
+
+    output(buf, uncursed_make_sgr(color, buf));
+}
+
+
+static void
+output_move(int y, int x)
+{
+    char buf[32];
+
+    output(buf, sprintf(buf, CSI "%d;%dH", y + 1, x + 1));
+}
+
+
+static void
+set_size(int h, int w)
+{
+    int i;
+
+    if (h == rows && w == cols)
+        return;
+
+    rows = h;
+    cols = w;
+    free(screen);
+    free(shown);
+    screen = calloc(rows * cols, sizeof *screen);
+    shown = calloc(rows * cols, sizeof *shown);
+    if (rows && cols && (!screen || !shown)) {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Start again from a blank screen. */
+    outputs(CSI "0m" CSI "H" CSI "2J");
+    for (i = 0; i < rows * cols; i++) {
+        shown[i].color = UNCREC_DEFAULT_COLOR;
+        shown[i].len = 1;
+        shown[i].utf8[0] = ' ';
+    }
+}
+
+
+/* Draws the differences between the screen and what's been shown. */
+static void
+output_changes(void)
+{
+    int pos, y = -1, x = -1, color = -1;
+
+    for (pos = 0; pos < rows * cols; pos++) {
+        struct cell *c = screen + pos;
+
+        if (c->color == shown[pos].color && c->len == shown[pos].len &&
+            memcmp(c->utf8, shown[pos].utf8, c->len) == 0)
+            continue;
+
+        if (y != pos / cols || x != pos % cols) {
+            y = pos / cols;
+            x = pos % cols;
+            output_move(y, x);
+        }
+        if (c->color != color) {
+            color = c->color;
+            output_sgr(color);
+        }
+        if (c->len)
+            output(c->utf8, c->len);
+        else
+            outputs(" ");
+        x++;
+
+        shown[pos] = *c;
+    }
+
+    output_move(cursor_y, cursor_x);
+    if (cursor_visible != shown_cursor_visible) {
+        outputs(cursor_visible ? CSI "?25h" : CSI "?25l");
+        shown_cursor_visible = cursor_visible;
+    }
+}
+
+
+static void
+write_ttyrec_frame(FILE *f, unsigned long long ms)
+{
+    unsigned char header[12];
+    unsigned long fields[3] = {ms / 1000, (ms % 1000) * 1000, out_len};
+    int i;
+
+    if (!out_len)
+        return;
+
+    for (i = 0; i < 12; i++)
+        header[i] = (fields[i / 4] >> ((i % 4) * 8)) & 0xff;
+    fwrite(header, 1, sizeof header, f);
+    fwrite(out, 1, out_len, f);
+    out_len = 0;
+}
+
+
+/* Returns the offset of the last keyframe at or before the given time since
+   the start of the recording (or the first keyframe, if there isn't one). */
+static size_t
+find_keyframe(const unsigned char *frames, unsigned long long target)
+{
+    const unsigned char *p, *end;
+    unsigned long long offset, ms, n, t = 0, len;
+    size_t best = frames - data;
+    int i;
+
+    /* Use the index, if the recording was stopped cleanly. */
+    if (data_end - frames >= UNCREC_TRAILER_LEN &&
+        !memcmp(data_end - UNCREC_TRAILER_LEN, UNCREC_TRAILER_MAGIC, 4)) {
+        offset = 0;
+        for (i = 0; i < 8; i++)
+            offset |= (unsigned long long)
+                data_end[i - UNCREC_TRAILER_LEN + 4] << (i * 8);
+        if (offset >= (size_t)(data_end - data) ||
+            data[offset] != UNCREC_INDEX)
+            corrupted();
+
+        p = data + offset + 1;
+        end = data_end - UNCREC_TRAILER_LEN;
+        read_varint(&p, end);
+        len = read_varint(&p, end);
+        if (len > (size_t)(end - p))
+            corrupted();
+        end = p + len;
+
+        n = read_varint(&p, end);
+        while (n--) {
+            ms = read_varint(&p, end);
+            offset = read_varint(&p, end);
+            if (ms > target)
+                break;
+            best = offset;
+        }
+        return best;
+    }
+
+    /* Otherwise, scan for it. */
+    for (p = frames; p < data_end;) {
+        const unsigned char *frame = p;
+        int type = *p++;
+
+        t += read_varint(&p, data_end);
+        len = read_varint(&p, data_end);
+        if (len > (size_t)(data_end - p) || t > target)
+            break;
+        if (type == UNCREC_KEYFRAME)
+            best = frame - data;
+        p += len;
+    }
+    return best;
+}
+
+
+static unsigned char *
+slurp(const char *filename, size_t *len)
+{
+    FILE *f = fopen(filename, "rb");
+    unsigned char *buf = NULL;
+    size_t size = 0, ret;
+
+    if (!f)
+        return NULL;
+
+    *len = 0;
+    do {
+        if (*len == size) {
+            size = size ? size * 2 : 65536;
+            buf = realloc(buf, size);
+            if (!buf) {
+                fclose(f);
+                return NULL;
+            }
+        }
+        ret = fread(buf + *len, 1, size - *len, f);
+        *len += ret;
+    } while (ret);
+
+    fclose(f);
+    return buf;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    const unsigned char *p, *end;
+    unsigned char *buf;
+    unsigned long long start_time, ms = 0, len, seek_ms = 0;
+    size_t buflen;
+    FILE *outfile;
+    int type, color, h, w;
+
+    if (argc > 2 && !strcmp(argv[1], "-s")) {
+        seek_ms = strtoull(argv[2], NULL, 10) * 1000;
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc != 3) {
+        fprintf(stderr, "Usage: uncrec2ttyrec [-s SECONDS] INFILE OUTFILE\n");
+        return EXIT_FAILURE;
+    }
+
+    buf = slurp(argv[1], &buflen);
+    if (!buf) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    data = buf;
+    data_end = buf + buflen;
+
+    if (buflen < UNCREC_MAGIC_LEN ||
+        memcmp(data, UNCREC_MAGIC, UNCREC_MAGIC_LEN) != 0) {
+        fprintf(stderr, "Error: %s is not an uncursed recording.\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    p = data + UNCREC_MAGIC_LEN;
+    start_time = read_varint(&p, data_end);
+    if (seek_ms)
+        p = data + find_keyframe(p, seek_ms);
+
+    outfile = fopen(argv[2], "wb");
+    if (!outfile) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    /* Select UTF-8. */
+    outputs("\x1b%G");
+
+    while (p < data_end) {
+        type = *p++;
+        ms += read_varint(&p, data_end);
+        len = read_varint(&p, data_end);
+
+        /* If the recording was cut short (e.g. by a crash), the last frame
+           may be incomplete; everything before it is still usable. */
+        if (type == UNCREC_INDEX || len > (size_t)(data_end - p))
+            break;
+        end = p + len;
+
+        color = UNCREC_DEFAULT_COLOR;
+        switch (type) {
+        case UNCREC_KEYFRAME:
+            ms = read_varint(&p, end);
+            h = read_varint(&p, end);
+            w = read_varint(&p, end);
+            set_size(h, w);
+            have_keyframe = 1;
+            /* fall through */
+        case UNCREC_DELTA:
+            if (!have_keyframe)
+                corrupted();    /* a delta before the first keyframe */
+            cursor_y = read_varint(&p, end);
+            cursor_x = read_varint(&p, end);
+            cursor_visible = read_varint(&p, end);
+
+            if (type == UNCREC_KEYFRAME) {
+                int i;
+
+                for (i = 0; i < rows * cols; i++)
+                    read_cell(&p, end, screen + i, &color);
+            } else {
+                unsigned long long pos = 0, count;
+
+                while (p < end) {
+                    pos += read_varint(&p, end);
+                    count = read_varint(&p, end);
+                    if (pos + count > (unsigned long long)rows * cols)
+                        corrupted();
+                    while (count--)
+                        read_cell(&p, end, screen + pos++, &color);
+                }
+            }
+
+            output_changes();
+            break;
+
+        case UNCREC_BEEP:
+            outputs("\a");
+            break;
+        }
+
+        p = end;
+        write_ttyrec_frame(outfile, start_time * 1000 + ms);
+    }
+
+    if (fclose(outfile) != 0) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    free(buf);
+    return EXIT_SUCCESS;
+}
+
+/* uncrec2ttyrec.c */
@@ -593,7 +593,11 @@ extern void write_ui_config(void);
 /* outchars.c */
 extern void init_displaychars(void);
 extern void free_displaychars(void);
+extern unsigned long long level_substitution(void);
 extern unsigned long long dbe_substitution(struct nh_dbuf_entry *dbe);
+extern void clear_glyph_cache(void);
+extern nh_bool print_cached_glyph(WINDOW *win, struct nh_dbuf_entry *dbe,
+                                  unsigned long long level_sub);
 extern void print_tile(WINDOW *win, struct curses_symdef *api_name,
                        struct curses_symdef *api_type, int offset,
                        unsigned long long substitution);
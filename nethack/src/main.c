@@ -19,6 +19,9 @@
 #define DEFAULT_NETHACKDIR "/usr/share/NetHack4/"
 
 static void process_args(int, char **);
+#ifdef UNIX
+static nh_bool convert_save(void);
+#endif
 void append_slash(char *name);
 
 struct settings settings;
@@ -32,6 +35,13 @@ nh_bool random_player = FALSE;
 
 char *override_hackdir, *override_userdir, *override_savedir;
 
+static char *record_file = NULL;
+
+#ifdef UNIX
+static enum nh_log_format convert_format = LF_INVALID;
+static const char *convert_infile, *convert_outfile;
+#endif
+
 enum menuitems {
     NEWGAME = 1,
     LOAD,
@@ -352,6 +362,21 @@ main(int argc, char *argv[])
     gamepaths = init_game_paths(argv[0]);
 
     nh_lib_init(&curses_windowprocs, (const char * const*)gamepaths);
+
+#ifdef UNIX
+    /* Like --help, this doesn't need the interface, so it can be run without
+       a terminal. */
+    if (convert_format != LF_INVALID) {
+        nh_bool ok = convert_save();
+
+        nh_lib_exit();
+        for (i = 0; i < PREFIX_COUNT; i++)
+            free(gamepaths[i]);
+        free(gamepaths);
+        exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+#endif
+
     init_curses_ui(gamepaths[DATAPREFIX]);
     init_ok = read_nh_config();
     for (i = 0; i < PREFIX_COUNT; i++)
@@ -362,11 +387,16 @@ main(int argc, char *argv[])
     process_args(argc, argv);   /* other command line options */
     init_displaychars();
 
+    if (record_file)
+        uncursed_start_recording(record_file);
+
     if (init_ok)
         mainmenu();
     else
         curses_msgwin("Could not initialize game options!", krc_notification);
 
+    if (record_file)
+        uncursed_stop_recording();
     exit_curses_ui();
     nh_lib_exit();
     free_displaychars();
@@ -376,6 +406,43 @@ main(int argc, char *argv[])
 }
 
 
+#ifdef UNIX
+/* Handles --convert-save. */
+static nh_bool
+convert_save(void)
+{
+    int infd, outfd;
+    nh_bool ok;
+
+    infd = sys_open(convert_infile, O_RDONLY, FILE_OPEN_MASK);
+    if (infd < 0) {
+        fprintf(stderr, "Error: Could not open the save file to convert.\n");
+        return FALSE;
+    }
+
+    /* Never overwrite an existing file; it might be the input. */
+    outfd = sys_open(convert_outfile, O_CREAT | O_EXCL | O_WRONLY,
+                     FILE_OPEN_MASK);
+    if (outfd < 0) {
+        close(infd);
+        fprintf(stderr,
+                "Error: Could not create the converted save file.\n");
+        return FALSE;
+    }
+
+    ok = nh_convert_savegame(infd, outfd, convert_format);
+    close(infd);
+    close(outfd);
+
+    if (!ok) {
+        unlink(convert_outfile);
+        fprintf(stderr, "Error: The save file could not be converted.\n");
+    }
+    return ok;
+}
+#endif
+
+
 static int
 str2role(const struct nh_roles_info *ri, const char *str)
 {
@@ -432,14 +499,40 @@ process_args(int argc, char *argv[])
                 puts("-H dir      override the playfield location");
                 puts("-U dir      override the user directory");
                 puts("-Z          disable suspending the process");
+                puts("--record FILE");
+                puts("            record the screen to FILE (requires");
+                puts("            --interface record)");
+#ifdef UNIX
+                puts("--convert-save text|binary INFILE OUTFILE");
+                puts("            convert a save file to the given format");
+#endif
                 puts("");
                 puts("PLUGIN can be any libuncursed plugin that is installed");
                 puts("on your system; examples may include 'tty' and 'sdl'.");
                 exit(0);
+            } else if (!strcmp(argv[0], "--record") && argc > 1) {
+                record_file = argv[1];
+                argv++;
+                argc--;
             } else if (!strcmp(argv[0], "--version")) {
                 printf("NetHack 4 version %d.%d.%d\n",
                        VERSION_MAJOR, VERSION_MINOR, PATCHLEVEL);
                 exit(0);
+#ifdef UNIX
+            } else if (!strcmp(argv[0], "--convert-save")) {
+                if (argc < 4 || (strcmp(argv[1], "text") &&
+                                 strcmp(argv[1], "binary"))) {
+                    puts("Usage: nethack4 --convert-save text|binary "
+                         "INFILE OUTFILE");
+                    exit(EXIT_FAILURE);
+                }
+                convert_format =
+                    !strcmp(argv[1], "binary") ? LF_BINARY : LF_TEXT;
+                convert_infile = argv[2];
+                convert_outfile = argv[3];
+                argv += 3;
+                argc -= 3;
+#endif
             }
             break;
 
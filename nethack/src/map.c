@@ -143,10 +143,13 @@ void
 draw_map(int cx, int cy)
 {
     int x, y, cursx, cursy, mapwinw, mapwinh;
+    unsigned long long level_sub;
 
     if (!mapwin)
         return;
 
+    level_sub = level_substitution();
+
     getyx(mapwin, cursy, cursx);
     getmaxyx(mapwin, mapwinh, mapwinw);
 
@@ -159,8 +162,6 @@ draw_map(int cx, int cy)
                        sizeof *dbyx) == 0)
                 continue; /* no need to redraw an unchanged tile */
 
-            unsigned long long substitution = dbe_substitution(dbyx);
-
             onscreen_display_buffer[y][x] = *dbyx;
 
             /* set the position for each character to prevent incorrect
@@ -207,7 +208,14 @@ draw_map(int cx, int cy)
                              (ROWNO * COLNO * 1) + x + y * COLNO, KEY_CODE_YES);
             wset_mouse_event(mapwin, uncursed_mbutton_hover, KEY_MAX + 256 + 
                              (ROWNO * COLNO * 2) + x + y * COLNO, KEY_CODE_YES);
-            
+
+            /* identical squares are very common, so reuse the rendering of
+               one drawn earlier, if possible */
+            if (print_cached_glyph(mapwin, dbyx, level_sub))
+                continue;
+
+            unsigned long long substitution = dbe_substitution(dbyx);
+
             /* draw the tile first, because doing that doesn't move the cursor;
                backgrounds are special because they can be composed from
                multiple tiles (e.g. furthest background + fountain) */
@@ -315,6 +315,7 @@ curses_set_option(const char *name, union nh_optvalue value)
     /* In case the option affects graphics; this is pretty cheap if we don't do
        it every turn */
     mark_mapwin_for_full_refresh();
+    clear_glyph_cache();
 
     if (option->type == OPTTYPE_BOOL) {
         nh_bool *var = nhlib_find_boolopt(boolopt_map, option->name);
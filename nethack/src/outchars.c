@@ -27,6 +27,31 @@ nh_bool tiletable_is_cchar = 1;
 
 static void print_tile_number(WINDOW *, int, unsigned long long);
 
+/* Working out how to draw a map square involves many string comparisons and
+   tile table searches, but the result depends only on the display buffer
+   entry, the level-wide substitutions, and the cchar drawn there if rendering
+   fails. So we remember the cchar and tiles for recently drawn squares, and
+   replay them when an identical square needs drawing again (this is common:
+   most of the map is floor, wall and corridor, and full redraws and
+   hallucination change many squares at once). Anything else the rendering
+   depends on (options, the tileset, the drawing info) must call
+   clear_glyph_cache() when it changes. */
+#define GLYPH_CACHE_SIZE 1024   /* must be a power of 2 */
+#define GLYPH_CACHE_MAX_TILES 12
+
+struct glyph_cache_entry {
+    struct nh_dbuf_entry dbe;
+    unsigned long long level_substitution;
+    unsigned long initial_cchar;
+    nh_bool valid;
+    int num_tiles;
+    unsigned long cchar;
+    unsigned long tiles[GLYPH_CACHE_MAX_TILES];
+};
+
+static struct glyph_cache_entry glyph_cache[GLYPH_CACHE_SIZE];
+static struct glyph_cache_entry *glyph_cache_filling = NULL;
+
 static struct curses_symdef *
 load_nh_symarray(const struct nh_symdef *src, int len)
 {
@@ -86,6 +111,7 @@ init_displaychars(void)
     struct nh_drawing_info *dinfo = nh_get_drawing_info();
 
     default_drawing = load_nh_drawing_info(dinfo);
+    clear_glyph_cache();
 }
 
 
@@ -126,6 +152,7 @@ free_displaychars(void)
 {
     free_drawing_info(default_drawing);
     default_drawing = NULL;
+    clear_glyph_cache();
 }
 
 
@@ -206,11 +233,41 @@ curses_notify_level_changed(int dmode)
 }
 
 
+/* The substitutions that apply to every square of the current level. */
 unsigned long long
-dbe_substitution(struct nh_dbuf_entry *dbe)
+level_substitution(void)
 {
     int ldm = settings.dungeoncolor ? curses_level_display_mode : LDM_DEFAULT;
     unsigned long long s = NHCURSES_SUB_LDM(ldm);
+    char tempsub[PL_NSIZ + 5]; /* "sub  " and a \0 */
+
+    /* Substitutions for the Quest this tile is on. */
+    if (ldm == LDM_QUESTHOME ||
+        ldm == LDM_QUESTFILL1 ||
+        ldm == LDM_QUESTLOCATE ||
+        ldm == LDM_QUESTFILL2 ||
+        ldm == LDM_QUESTGOAL) {
+        snprintf(tempsub, sizeof tempsub, "sub %.3s ",
+                 player.rolename);
+        tempsub[4] |= 32; /* convert to lowercase */
+        s |= substitution_from_name(&(const char *){tempsub});
+    }
+
+    /* Race/gender of the player. TODO: For now we do this on every tile; we
+       should only be doing it on the player's so as to not affect
+       player-monsters on other tiles. */
+    snprintf(tempsub, sizeof tempsub, "sub %s ", player.gendername);
+    s |= substitution_from_name(&(const char *){tempsub});
+    snprintf(tempsub, sizeof tempsub, "sub %s ", player.racename);
+    s |= substitution_from_name(&(const char *){tempsub});
+
+    return s;
+}
+
+unsigned long long
+dbe_substitution(struct nh_dbuf_entry *dbe)
+{
+    unsigned long long s = level_substitution();
 
     /* TODO: Do we want this behaviour (that approximates 3.4.3 behaviour) for
        the "lit" substitution? Do we want it to be customizable?
@@ -236,29 +293,66 @@ dbe_substitution(struct nh_dbuf_entry *dbe)
             s |= NHCURSES_SUB_FIGURINE;
     }
 
-    char tempsub[PL_NSIZ + 5]; /* "sub  " and a \0 */
+    return s;
+}
 
-    /* Substitutions for the Quest this tile is on. */
-    if (ldm == LDM_QUESTHOME ||
-        ldm == LDM_QUESTFILL1 ||
-        ldm == LDM_QUESTLOCATE ||
-        ldm == LDM_QUESTFILL2 ||
-        ldm == LDM_QUESTGOAL) {
-        snprintf(tempsub, sizeof tempsub, "sub %.3s ",
-                 player.rolename);
-        tempsub[4] |= 32; /* convert to lowercase */
-        s |= substitution_from_name(&(const char *){tempsub});
-    }
+void
+clear_glyph_cache(void)
+{
+    int i;
 
-    /* Race/gender of the player. TODO: For now we do this on every tile; we
-       should only be doing it on the player's so as to not affect
-       player-monsters on other tiles. */
-    snprintf(tempsub, sizeof tempsub, "sub %s ", player.gendername);
-    s |= substitution_from_name(&(const char *){tempsub});
-    snprintf(tempsub, sizeof tempsub, "sub %s ", player.racename);
-    s |= substitution_from_name(&(const char *){tempsub});
+    for (i = 0; i < GLYPH_CACHE_SIZE; i++)
+        glyph_cache[i].valid = FALSE;
+    glyph_cache_filling = NULL;
+}
 
-    return s;
+static unsigned
+glyph_cache_hash(const struct nh_dbuf_entry *dbe,
+                 unsigned long long level_sub, unsigned long cchar)
+{
+    /* FNV-1a */
+    const unsigned char *p = (const unsigned char *)dbe;
+    unsigned h = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < sizeof *dbe; i++)
+        h = (h ^ p[i]) * 16777619U;
+    h = (h ^ (unsigned)level_sub) * 16777619U;
+    h = (h ^ (unsigned)(level_sub >> 32)) * 16777619U;
+    h = (h ^ (unsigned)cchar) * 16777619U;
+
+    return h & (GLYPH_CACHE_SIZE - 1);
+}
+
+/* Draws a map square from the glyph cache, if it's there, and returns TRUE.
+   Otherwise, returns FALSE; the caller should draw the square using
+   print_tile() and friends, then print_cchar(), and the result will be added
+   to the cache. The cchar set by init_cchar() is part of the cache key. */
+nh_bool
+print_cached_glyph(WINDOW *win, struct nh_dbuf_entry *dbe,
+                   unsigned long long level_sub)
+{
+    struct glyph_cache_entry *gce =
+        glyph_cache + glyph_cache_hash(dbe, level_sub, curcchar);
+    int i;
+
+    if (gce->valid && gce->initial_cchar == curcchar &&
+        gce->level_substitution == level_sub &&
+        memcmp(&gce->dbe, dbe, sizeof *dbe) == 0) {
+        for (i = 0; i < gce->num_tiles; i++)
+            wset_tiles_tile(win, gce->tiles[i]);
+        curcchar = gce->cchar;
+        print_cchar(win);
+        return TRUE;
+    }
+
+    gce->valid = FALSE;
+    gce->dbe = *dbe;
+    gce->level_substitution = level_sub;
+    gce->initial_cchar = curcchar;
+    gce->num_tiles = 0;
+    glyph_cache_filling = gce;
+    return FALSE;
 }
 
 void
@@ -271,6 +365,12 @@ print_cchar(WINDOW *win)
     int fgcolor = (curcchar >> 21) & 0x0f;
     int bgcolor = (curcchar >> 26) & 0x07;
 
+    if (glyph_cache_filling) {
+        glyph_cache_filling->cchar = curcchar;
+        glyph_cache_filling->valid = TRUE;
+        glyph_cache_filling = NULL;
+    }
+
     attr = A_NORMAL;
 
     if (curcchar & (1UL << 30))
@@ -422,8 +522,19 @@ print_tile_number(WINDOW *win, int tileno, unsigned long long substitutions)
 
     if (tiletable_is_cchar)
         curcchar = combine_cchar(curcchar, get_tt_number(low * 16 + 12));
-    else
-        wset_tiles_tile(win, get_tt_number(low * 16 + 12));
+    else {
+        unsigned long tile = get_tt_number(low * 16 + 12);
+
+        if (glyph_cache_filling) {
+            if (glyph_cache_filling->num_tiles < GLYPH_CACHE_MAX_TILES)
+                glyph_cache_filling->tiles[glyph_cache_filling->num_tiles++] =
+                    tile;
+            else
+                glyph_cache_filling = NULL; /* too many layers to cache */
+        }
+
+        wset_tiles_tile(win, tile);
+    }
 }
 
 void
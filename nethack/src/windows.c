@@ -149,6 +149,7 @@ load_tile_file(const char *tilebase, char *store_tilename_in)
         free(tiletable);
         tiletable = NULL;
         tiletable_len = 0;
+        clear_glyph_cache();
     } else
         *store_tilename_in = '\0';
 
@@ -45,6 +45,14 @@
 #  define DEFAULT_CLIENT_TIMEOUT (15 * 60)      /* 15 minutes */
 # endif
 
+/* How often to write a user's last activity time to the database */
+# define USER_TS_INTERVAL 30   /* seconds */
+
+# define DEFAULT_POOL_SIZE 4
+# define DEFAULT_POOL_WORKER_LIFETIME (60 * 60) /* 1 hour */
+
+# define DEFAULT_METRICS_INTERVAL 15    /* seconds */
+
 
 enum getgame_result {
     GGR_NOT_FOUND,
@@ -58,6 +66,22 @@ struct settings {
     char *pidfile;
     int client_timeout;
     char *dbhost, *dbname, *dbport, *dbuser, *dbpass;
+    char *save_check;
+    char *reload_check_interval, *reload_check_sample;
+    char *reload_check_level_change;
+    char *log_format, *backup_dictionary;
+    char *backup_policy, *backup_replay_limit, *backup_disk_budget;
+    char *listen_port, *pool_size, *pool_worker_lifetime;
+    char *metrics_file, *metrics_interval;
+};
+
+
+/* The histograms kept by metrics.c */
+enum metrics_family {
+    MF_COMMAND,         /* response time, by command */
+    MF_DB_QUERY,        /* database query time, by statement */
+    MF_UPDATE_SCREEN,   /* update_screen size, by encoding */
+    MF_COUNT
 };
 
 
@@ -78,6 +102,8 @@ struct client_command {
 struct gamefile_info {
     int gid;
     char *filename;
+    enum nh_log_status status;  /* LS_INVALID if the header isn't cached yet */
+    struct nh_game_info gi;     /* cached from the log header */
 };
 
 
@@ -91,19 +117,22 @@ extern int gamefd;
 extern long gameid;
 extern const struct client_command clientcmd[];
 extern struct nh_player_info player_info;
+extern enum nhnet_mapdelta client_mapdelta;
 
 /*---------------------------------------------------------------------------*/
 
 /* auth.c */
-extern int auth_user(char *authbuf, int *reconnect_id);
+extern int auth_user(json_t *authobj, int *is_reg);
 extern void auth_send_result(int sockfd, enum authresult, int is_reg);
 
 /* clientmain.c */
+extern void init_game_library(void);
 extern noreturn void client_main(int userid, int infd, int outfd);
 extern noreturn void exit_client(const char *err, int coredumpsignal);
 extern void client_server_cancel_msg(void);
 extern void client_msg(const char *key, json_t * value);
 extern json_t *read_input(void);
+extern json_t *read_input_or_fd(int fd, int *fd_ready);
 extern void send_string_to_client(const char *jsonstr, int defer_errors);
 
 /* config.c */
@@ -120,6 +149,7 @@ extern int db_register_user(const char *name, const char *pass,
                             const char *email);
 extern int db_get_user_info(int uid, struct user_info *info);
 extern void db_update_user_ts(int uid);
+extern void db_flush_user_ts(void);
 extern int db_set_user_email(int uid, const char *email);
 extern int db_set_user_password(int uid, const char *password);
 extern long db_add_new_game(int uid, const char *filename, const char *role,
@@ -130,6 +160,8 @@ extern void db_update_game(int gameid, int moves, int depth,
                            const char *levdesc);
 extern enum getgame_result db_get_game_filename(
     int gid, char *filenamebuf, int buflen);
+extern void db_set_game_header(int gameid, enum nh_log_status status,
+                               const struct nh_game_info *gi);
 extern void db_delete_game(int uid, int gid);
 extern struct gamefile_info *db_list_games(int completed, int uid, int limit,
                                            int *count);
@@ -137,22 +169,54 @@ extern void db_add_topten_entry(int gid, int points, int hp, int maxhp,
                                 int deaths, int end_how, const char *death,
                                 const char *entrytxt);
 
+/* framing.c */
+extern int read_input_data(int fd, int limit);
+extern json_t *next_input_message(int *bad);
+
 /* log.c */
 extern void log_msg(const char *fmt, ...);
 extern int begin_logging(void);
 extern void end_logging(void);
 extern const char *addr2str(const void *sockaddr);
 
+/* metrics.c */
+extern long long metrics_now(void);
+extern int metrics_enabled(void);
+extern void metrics_observe(enum metrics_family family, const char *label,
+                            long long value);
+extern void metrics_flush(int force);
+extern void metrics_connection_opened(void);
+extern void metrics_connection_closed(void);
+extern void metrics_bytes_received(long bytes);
+extern void metrics_message_received(void);
+extern void metrics_command(const char *name);
+extern void metrics_message_sent(long bytes);
+
 /* miscsetup.c */
 extern void setup_signals(void);
 extern int init_workdir(void);
 
+/* pool.c */
+extern noreturn void run_pool(void);
+
 /* server.c */
 extern noreturn void runserver(void);
 extern noreturn void exit_server(int exitstatus, int coredumpsignal);
 
+/* spectate.c */
+extern void spectate_open(int gid);
+extern void spectate_close(void);
+extern int spectate_socket_exists(int gid);
+extern int spectators_watching(void);
+extern int spectate_listen_fd(void);
+extern void accept_spectators(void);
+extern void publish_to_spectators(json_t *display_list);
+extern int spectate_game(int gid);
+
 /* winprocs.c */
 extern json_t *get_display_data(void);
+extern json_t *get_display_snapshot(void);
+extern void add_display_list(json_t *list);
 extern void reset_cached_displaydata(void);
 extern void srv_display_buffer(const char *buf, nh_bool trymove);
 extern char srv_yn_function(const char *query, const char *rset,
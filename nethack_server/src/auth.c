@@ -50,19 +50,12 @@ is_valid_username(const char *name)
 
 
 int
-auth_user(char *authbuf, int *is_reg)
+auth_user(json_t *obj, int *is_reg)
 {
-    json_error_t err;
-    json_t *obj, *cmd, *name, *pass, *email;
+    json_t *cmd, *name, *pass, *email, *mapdelta;
     const char *namestr, *passstr, *emailstr;
     int userid = 0;
 
-    obj = json_loads(authbuf, 0, &err);
-    if (!obj) {
-        log_msg("auth packet does not look like valid JSON");
-        return 0;
-    }
-
     /* try 1: is it an auth command? */
     *is_reg = 0;
     cmd = json_object_get(obj, "auth");
@@ -79,6 +72,7 @@ auth_user(char *authbuf, int *is_reg)
     name = json_object_get(cmd, "username");
     pass = json_object_get(cmd, "password");
     email = json_object_get(cmd, "email");      /* is null for auth */
+    mapdelta = json_object_get(cmd, "mapdelta");        /* optional */
 
     if (!name || !pass) {
         log_msg("auth packet is missing name or password");
@@ -94,6 +88,12 @@ auth_user(char *authbuf, int *is_reg)
         goto err;
     }
 
+    /* Use the newest map delta encoding that both sides understand. */
+    client_mapdelta = MAPDELTA_COLUMNS;
+    if (json_is_integer(mapdelta) && json_integer_value(mapdelta) > 0)
+        client_mapdelta = json_integer_value(mapdelta) < MAPDELTA_NEWEST ?
+            json_integer_value(mapdelta) : MAPDELTA_NEWEST;
+
     if (!*is_reg) {
 
         /* authenticate against a user database */
@@ -128,11 +128,9 @@ auth_user(char *authbuf, int *is_reg)
         }
     }
 
-    json_decref(obj);
     return userid;
 
 err:
-    json_decref(obj);
     return 0;
 }
 
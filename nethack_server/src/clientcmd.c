@@ -168,6 +168,48 @@ read_json_option(json_t * jobj, struct nh_option_desc *opt)
 }
 
 
+/* Read a game's log header and cache it in the database for list_games. The
+   header only changes while the game is being played, so this is done when
+   the game is created and whenever someone stops playing it. Whether the game
+   is being played right now isn't part of the header, so it isn't cached; see
+   game_in_progress(). */
+static enum nh_log_status
+update_game_header(int gid, int fd, struct nh_game_info *gi)
+{
+    enum nh_log_status status = nh_get_savegame_status(fd, gi);
+
+    if (status != LS_INVALID && status != LS_IN_PROGRESS)
+        db_set_game_header(gid, status, gi);
+    return status;
+}
+
+
+/* Whether someone is playing a game right now. This is what
+   nh_get_savegame_status() reports as LS_IN_PROGRESS: the game's write lock
+   is held for more than a moment. Most games aren't being played, which the
+   spectator socket tells us without touching the game file; the file is only
+   looked at if the socket exists, because a process that dies leaves its
+   socket behind, but loses its locks. */
+static int
+game_in_progress(int gid, const char *filename)
+{
+    struct flock fl = {.l_type = F_RDLCK, .l_whence = SEEK_SET};
+    int fd, ret = FALSE;
+
+    if (!spectate_socket_exists(gid))
+        return FALSE;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return FALSE;
+    if (fcntl(fd, F_GETLK, &fl) != -1 && fl.l_type != F_UNLCK)
+        ret = nh_get_savegame_status(fd, NULL) == LS_IN_PROGRESS;
+    close(fd);
+
+    return ret;
+}
+
+
 /*
  * create_game: Start a new game
  * parameters: name, role, race, gend, align, playmode
@@ -179,6 +221,7 @@ ccmd_create_game(json_t * params)
     json_t *j_msg, *jarr, *jobj;
     int fd, ret, count, i, debug = 0;
     long t;
+    struct nh_game_info gi;
 
     if (json_unpack (params, "{so!}", "options", &jarr) == -1 ||
         !json_is_array(jarr))
@@ -229,7 +272,6 @@ ccmd_create_game(json_t * params)
     }
 
     ret = nh_create_game(fd, opts);
-    close(fd);
 
     if (ret == NHCREATE_OK) {
 
@@ -255,10 +297,14 @@ ccmd_create_game(json_t * params)
                             ri->racenames[race], ri->gendnames[gend],
                             ri->alignnames[align], mode, name,
                             player_info.level_desc);
+        if (gameid)
+            update_game_header(gameid, fd, &gi);
+        close(fd);
         log_msg("%s has created a new game (%d) as %s", user_info.username,
                 gameid, name);
         j_msg = json_pack("{si}", "return", gameid);
     } else {
+        close(fd);
         unlink(filename);
         log_msg("%s tried to create a new game (%d) as %s, but the creation %s",
                 user_info.username, gameid, name, ret == NHCREATE_FAIL ?
@@ -289,7 +335,7 @@ static const char *const play_status_names[] = {
 static void
 ccmd_play_game(json_t * params)
 {
-    int gid, fd, status, followmode;
+    int gid, fd, status, followmode, spectating;
     char filename[1024];
     enum getgame_result ggr;
     struct nh_game_info unused;
@@ -337,7 +383,16 @@ ccmd_play_game(json_t * params)
             user_info.username, verb, gid, filename);
     gameid = gid;
     gamefd = fd;
-    status = nh_play_game(fd, followmode);
+    status = -1;
+    if (followmode == FM_WATCH)
+        status = spectate_game(gid);
+    spectating = status != -1;
+    if (!spectating) {
+        if (followmode == FM_PLAY)
+            spectate_open(gid);
+        status = nh_play_game(fd, followmode);
+        spectate_close();
+    }
     gameid = -1;
     gamefd = -1;
     log_msg("User '%s' stopped %sing game %d, file %s: %s",
@@ -357,8 +412,13 @@ ccmd_play_game(json_t * params)
 
     client_msg("play_game", json_pack("{si}", "return", status));
 
+    /* A live spectator never loaded the game, so has nothing to update. */
+    if (spectating)
+        return;
+
     db_update_game(gid, player_info.moves, player_info.z,
                    player_info.level_desc);
+    update_game_header(gid, fd, &unused);
 
     /* move the finished game to its final resting place */
     if (status == GAME_OVER) {
@@ -410,8 +470,6 @@ ccmd_list_games(json_t * params)
 {
     int completed, limit, show_all, count, i, fd;
     struct gamefile_info *files;
-    enum nh_log_status status;
-    struct nh_game_info gi;
     json_t *jarr, *jobj;
 
     if (json_unpack
@@ -423,31 +481,37 @@ ccmd_list_games(json_t * params)
     if (limit > 100)
         limit = 100; /* try to prevent DOS to some extent */
 
-    /* step 1: get a list of files from the db. */
+    /* The database caches the information from each game's log header. */
     files =
         db_list_games(completed, show_all ? -user_info.uid : user_info.uid,
                       limit, &count);
 
     jarr = json_array();
-    /* step 2: get extra info for each file. */
     for (i = 0; i < count; i++) {
-        fd = open(files[i].filename, O_RDWR);
-        if (fd == -1) {
-            log_msg("Game file %s could not be opened in ccmd_list_games.",
-                    files[i].filename);
-            continue;
-        }
+        struct nh_game_info *gi = &files[i].gi;
+
+        /* Games from before the cache existed need their header read once. */
+        if (files[i].status == LS_INVALID) {
+            fd = open(files[i].filename, O_RDWR);
+            if (fd == -1) {
+                log_msg("Game file %s could not be opened in ccmd_list_games.",
+                        files[i].filename);
+                free(files[i].filename);
+                continue;
+            }
+            files[i].status = update_game_header(files[i].gid, fd, gi);
+            close(fd);
+        } else if (files[i].status == LS_SAVED &&
+                   game_in_progress(files[i].gid, files[i].filename))
+            files[i].status = LS_IN_PROGRESS;
 
-        status = nh_get_savegame_status(fd, &gi);
         jobj = json_pack(
             "{si,si,si,ss,ss,ss,ss,ss,ss}", "gameid", files[i].gid, "status",
-            status, "playmode", gi.playmode, "plname", gi.name, "plrole",
-            gi.plrole, "plrace", gi.plrace, "plgend", gi.plgend, "plalign",
-            gi.plalign, "game_state", gi.game_state);
+            files[i].status, "playmode", gi->playmode, "plname", gi->name,
+            "plrole", gi->plrole, "plrace", gi->plrace, "plgend", gi->plgend,
+            "plalign", gi->plalign, "game_state", gi->game_state);
         json_array_append_new(jarr, jobj);
-        free((void *)files[i].filename);
-
-        close(fd);
+        free(files[i].filename);
     }
     free(files);
 
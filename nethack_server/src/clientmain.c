@@ -12,20 +12,26 @@
 #endif
 
 #include "nhserver.h"
-#include <ctype.h>
+#include <time.h>
 
 #define DEFAULT_NETHACKDIR "/usr/share/NetHack4/"
 
-#define COMMBUF_SIZE (1024 * 1024)
-
 static int infd, outfd;
 int gamefd;
 long gameid;    /* id in the database */
 struct user_info user_info;
 static int can_send_msg;
+static int game_library_initialized;
 static volatile sig_atomic_t currently_sending_message;
 static volatile sig_atomic_t send_server_cancel;
 
+/* Messages to the client are built here; it's reused for every message, so
+   sending one doesn't need to allocate memory once it's big enough. */
+static char *outbuf;
+static size_t outbuf_len, outbuf_size;
+
+static const char server_cancel_msg[] = "{\"server_cancel\":{}}";
+
 static char **
 init_game_paths(void)
 {
@@ -84,25 +90,39 @@ init_game_paths(void)
     return pathlist_copy;
 }
 
+/* Initializes the game engine, if that hasn't been done already. (Pool workers
+   do this before they have a client.) */
+void
+init_game_library(void)
+{
+    char **gamepaths;
+    int i;
+
+    if (game_library_initialized)
+        return;
+
+    gamepaths = init_game_paths();
+    nh_lib_init(&server_windowprocs, (const char *const *)gamepaths);
+    for (i = 0; i < PREFIX_COUNT; i++)
+        free(gamepaths[i]);
+    free(gamepaths);
+
+    game_library_initialized = TRUE;
+}
+
 /* The low-level function responsible for doing the actual sending. This is
-   async-signal-safe if the second argument is TRUE (this happens in signal
+   async-signal-safe if the last argument is TRUE (this happens in signal
    handlers; also during exits for any reason, to prevent the exit code running
    recursively). */
-void
-send_string_to_client(const char *jsonstr, int defer_errors)
+static void
+send_buffer_to_client(const char *buf, int len, int defer_errors)
 {
-    int len = strlen(jsonstr);
     int pos = 0;
     int ret;
 
     currently_sending_message++;
     do {
-        /* For NetHack 4.3, we separate the messages we send with NUL characters
-           (which are not legal in JSON), so that the client can more easily
-           find the boundary between messages. (NitroHack relied on separating
-           messages using the boundary between packets, which doesn't work in
-           practice.) The NUL is added using the terminating NUL of jsonstr. */
-        ret = write(outfd, jsonstr + pos, len + 1 - pos);
+        ret = write(outfd, buf + pos, len - pos);
         if (ret == -1 && (errno == EINTR || errno == EAGAIN))
             continue;
         else if (ret == -1 || ret == 0) {   /* bad news */
@@ -123,6 +143,17 @@ send_string_to_client(const char *jsonstr, int defer_errors)
     currently_sending_message--;
 }
 
+void
+send_string_to_client(const char *jsonstr, int defer_errors)
+{
+    /* For NetHack 4.3, we separate the messages we send with NUL characters
+       (which are not legal in JSON), so that the client can more easily find
+       the boundary between messages. (NitroHack relied on separating messages
+       using the boundary between packets, which doesn't work in practice.) The
+       NUL is added using the terminating NUL of jsonstr. */
+    send_buffer_to_client(jsonstr, strlen(jsonstr) + 1, defer_errors);
+}
+
 /* Server cancels work differently from other messages; they can be sent out of
    sequence, can be sent from signal handlers, and don't have a response.
 
@@ -141,41 +172,122 @@ client_server_cancel_msg(void)
 
     int save_errno = errno;
 
-    send_string_to_client("{\"server_cancel\":{}}", TRUE);
+    send_string_to_client(server_cancel_msg, TRUE);
 
     errno = save_errno;
 }
 
+/* Appends to outbuf; also used as a callback for json_dump_callback. */
+static int
+outbuf_append(const char *data, size_t len, void *unused)
+{
+    if (outbuf_len + len > outbuf_size) {
+        size_t newsize = outbuf_size ? outbuf_size * 2 : 65536;
+        char *newbuf;
+
+        if (newsize < outbuf_len + len)
+            newsize = outbuf_len + len;
+        newbuf = realloc(outbuf, newsize);
+        if (!newbuf) {
+            /* Don't try to tell the client about it; that needs outbuf. */
+            can_send_msg = FALSE;
+            exit_client("Out of memory building a message", 0);
+        }
+        outbuf = newbuf;
+        outbuf_size = newsize;
+    }
+    memcpy(outbuf + outbuf_len, data, len);
+    outbuf_len += len;
+    return 0;
+}
+
+static void
+outbuf_append_str(const char *str)
+{
+    outbuf_append(str, strlen(str), NULL);
+}
+
+/* Appends the display data to outbuf. With metrics on, it's written an item at
+   a time, so that the size of each update_screen can be recorded as it goes
+   into the message, rather than serializing it a second time to measure it. */
+static void
+outbuf_append_display_data(json_t *display_data)
+{
+    size_t i, start;
+    json_t *item, *jmsg;
+
+    if (!metrics_enabled()) {
+        json_dump_callback(display_data, outbuf_append, NULL, JSON_COMPACT);
+        return;
+    }
+
+    outbuf_append_str("[");
+    for (i = 0; i < json_array_size(display_data); i++) {
+        item = json_array_get(display_data, i);
+        if (i)
+            outbuf_append_str(",");
+
+        jmsg = json_object_get(item, "update_screen");
+        if (!jmsg) {
+            json_dump_callback(item, outbuf_append, NULL, JSON_COMPACT);
+            continue;
+        }
+
+        outbuf_append_str("{\"update_screen\":");
+        start = outbuf_len;
+        json_dump_callback(jmsg, outbuf_append, NULL, JSON_COMPACT);
+        metrics_observe(MF_UPDATE_SCREEN, json_object_get(jmsg, "dbuf_runs") ?
+                        "runs" : "columns", outbuf_len - start);
+        outbuf_append_str("}");
+    }
+    outbuf_append_str("]");
+}
+
 static void
 client_msg_core(const char *key, json_t *value, nh_bool from_exit)
 {
-    char *jsonstr;
-    json_t *jval, *display_data;
+    json_t *display_data;
 
     currently_sending_message = 1;
 
-    jval = json_object();
+    /* The message is {"display":[...],"key":value}; it's written straight into
+       outbuf, rather than building another object to serialize. */
+    outbuf_len = 0;
+    outbuf_append_str("{");
 
     /* send out display data whenever anything else goes out */
     display_data = get_display_data();
     if (display_data) {
-        json_object_set_new(jval, "display", display_data);
-        display_data = NULL;
+        outbuf_append_str("\"display\":");
+        outbuf_append_display_data(display_data);
+        json_decref(display_data);
+        outbuf_append_str(",");
     }
 
     /* actual message content */
-    json_object_set_new(jval, key, value);
-    jsonstr = json_dumps(jval, JSON_COMPACT);
-    json_decref(jval);
+    outbuf_append_str("\"");
+    outbuf_append_str(key);
+    outbuf_append_str("\":");
+    json_dump_callback(value, outbuf_append, NULL,
+                       JSON_COMPACT | JSON_ENCODE_ANY);
+    json_decref(value);
+    outbuf_append("}", 2, NULL);        /* including the terminating NUL */
+
+    /* If a server cancel is already waiting to go out, it can go in the same
+       write as this message. */
+    if (send_server_cancel && can_send_msg) {
+        send_server_cancel = 0;
+        outbuf_append(server_cancel_msg, sizeof server_cancel_msg, NULL);
+    }
 
-    if (can_send_msg)
-        send_string_to_client(jsonstr, from_exit);
+    if (can_send_msg) {
+        send_buffer_to_client(outbuf, outbuf_len, from_exit);
+        metrics_message_sent(outbuf_len);
+    }
 
     /* this message is sent; don't send another */
     can_send_msg = FALSE;
 
-    free(jsonstr);
-
     currently_sending_message = 0;
 
     if (send_server_cancel) {
@@ -198,6 +310,8 @@ exit_client(const char *err, int coredumpsignal)
 
     if (err)
         log_msg("Client error: %s. Exit.", err);
+    if (!sigsegv_flag)
+        metrics_connection_closed();
 
     if (outfd != -1) {
         exit_obj = json_object();
@@ -215,6 +329,9 @@ exit_client(const char *err, int coredumpsignal)
         infd = outfd = -1;
     }
 
+    if (!sigsegv_flag)
+        db_flush_user_ts();
+
     termination_flag = 3;       /* make sure the command loop exits if
                                    nh_exit_game jumps there */
     if (!sigsegv_flag)
@@ -231,69 +348,76 @@ exit_client(const char *err, int coredumpsignal)
 }
 
 
+/* Reads the next message from the client. If fd is not -1 and becomes readable
+   first, returns NULL with *fd_ready set instead. While waiting, this also lets
+   new spectators connect. */
 json_t *
-read_input(void)
+read_input_or_fd(int fd, int *fd_ready)
 {
-    int ret, datalen, done;
-    static char commbuf[COMMBUF_SIZE];
-    char *bp;
+    int ret = 0, bad, nfds;
+    time_t deadline = time(NULL) + settings.client_timeout;
+    long remaining;
     json_t *jval = NULL;
-    json_error_t err;
-    struct pollfd pfd[1] =
-        { {infd, POLLIN | POLLRDHUP | POLLERR | POLLHUP, 0} };
-
-    done = FALSE;
-    datalen = 0;
-    while (!done && !termination_flag) {
-        ret = poll(pfd, 1, settings.client_timeout * 1000);
-        if (ret == 0)
-            exit_client("Inactivity timeout", 0);
+    struct pollfd pfd[3] = {
+        {infd, POLLIN | POLLRDHUP | POLLERR | POLLHUP, 0},
+        {spectate_listen_fd(), POLLIN, 0},
+        {fd, POLLIN | POLLRDHUP | POLLERR | POLLHUP, 0},
+    };
 
-        ret = read(infd, &commbuf[datalen], COMMBUF_SIZE - datalen - 1);
+    if (fd_ready)
+        *fd_ready = FALSE;
+
+    while (!termination_flag) {
+        /* the client may have sent several commands at once */
+        jval = next_input_message(&bad);
+        if (bad)
+            exit_client("Bad JSON data received", 0);
+        if (jval)
+            break;
+
+        nfds = fd == -1 ? 2 : 3;
+        remaining = deadline - time(NULL);
+        if (remaining > 0)
+            ret = poll(pfd, nfds, remaining * 1000);
+        if (remaining <= 0 || ret == 0)
+            exit_client("Inactivity timeout", 0);
         if (ret == -1)
             continue;   /* sone signals will set termination_flag, others won't 
                          */
-        else if (ret == 0)
-            exit_client("Input pipe lost", 0);
-        datalen += ret;
-
-        if (commbuf[datalen - ret] == '\033') {
-            /* this is a request to reset the buffer when recovering from a
-               connection error. After such an error it simply isn't possible
-               to know what data actually arrived. */
-            /* do a memmove in case there was already some new legitimate data
-               queued after the '\033' reset request. */
-            memmove(commbuf, &commbuf[datalen - ret + 1], ret - 1);
-            datalen = ret - 1;
-            /* also reset the cached display data to make sure all display
-               state is re-sent */
-            continue;
-        }
 
-        commbuf[datalen] = '\0';        /* terminate the string */
-        bp = &commbuf[datalen - 1];
-        while (isspace(*bp))
-            bp--;
-
-        jval = NULL;
-        if (*bp == '}') {       /* possibly the end of the json object */
-            jval = json_loads(commbuf, JSON_REJECT_DUPLICATES, &err);
-            if (jval)
-                done = TRUE;
-            else if (err.position < datalen)
-                exit_client("Bad JSON data received", 0);
+        if (pfd[1].revents)
+            accept_spectators();
+        if (nfds > 2 && pfd[2].revents) {
+            *fd_ready = TRUE;
+            return NULL;
         }
+        if (!pfd[0].revents)
+            continue;
 
-        if (!jval && datalen >= COMMBUF_SIZE - 1)
+        ret = read_input_data(infd, 0);
+        if (ret == -2)
             exit_client("Max allowed input length exceeded", 0);
-        /* too much data received */
+        else if (ret == -1)
+            continue;
+        else if (ret == 0)
+            exit_client("Input pipe lost", 0);
+        metrics_bytes_received(ret);
     }
     /* message received; now it's our turn to send */
+    if (jval)
+        metrics_message_received();
     can_send_msg = TRUE;
     return jval;
 }
 
 
+json_t *
+read_input(void)
+{
+    return read_input_or_fd(-1, NULL);
+}
+
+
 static void
 client_main_loop(void)
 {
@@ -320,6 +444,7 @@ client_main_loop(void)
         value = json_object_iter_value(iter);
         for (i = 0; clientcmd[i].name; i++)
             if (!strcmp(clientcmd[i].name, key)) {
+                metrics_command(clientcmd[i].name);
                 clientcmd[i].func(value);
                 break;
             }
@@ -348,23 +473,24 @@ client_main_loop(void)
 noreturn void
 client_main(int userid, int _infd, int _outfd)
 {
-    char **gamepaths;
-    int i;
+    int one = 1;
 
     infd = _infd;
     outfd = _outfd;
     gamefd = -1;
 
+    /* Each message is sent with a single write, and the client has to see all
+       of it before it can respond, so waiting to fill a packet would only add
+       latency. (This fails harmlessly if the client isn't using TCP.) */
+    setsockopt(outfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
     if (!db_get_user_info(userid, &user_info)) {
         log_msg("get_user_info error for uid %d!", userid);
         exit_client("database error", SIGABRT);
     }
 
-    gamepaths = init_game_paths();
-    nh_lib_init(&server_windowprocs, (const char *const *)gamepaths);
-    for (i = 0; i < PREFIX_COUNT; i++)
-        free(gamepaths[i]);
-    free(gamepaths);
+    init_game_library();
+    metrics_connection_opened();
 
     client_main_loop();
 
@@ -39,7 +39,21 @@ struct { const char *const name; size_t offset; } settings_map[] = {
     SETTINGS_MAP_ENTRY(dbport),
     SETTINGS_MAP_ENTRY(dbuser),
     SETTINGS_MAP_ENTRY(dbpass),
-    SETTINGS_MAP_ENTRY(dbname)
+    SETTINGS_MAP_ENTRY(dbname),
+    SETTINGS_MAP_ENTRY(save_check),
+    SETTINGS_MAP_ENTRY(reload_check_interval),
+    SETTINGS_MAP_ENTRY(reload_check_sample),
+    SETTINGS_MAP_ENTRY(reload_check_level_change),
+    SETTINGS_MAP_ENTRY(log_format),
+    SETTINGS_MAP_ENTRY(backup_dictionary),
+    SETTINGS_MAP_ENTRY(backup_policy),
+    SETTINGS_MAP_ENTRY(backup_replay_limit),
+    SETTINGS_MAP_ENTRY(backup_disk_budget),
+    SETTINGS_MAP_ENTRY(listen_port),
+    SETTINGS_MAP_ENTRY(pool_size),
+    SETTINGS_MAP_ENTRY(pool_worker_lifetime),
+    SETTINGS_MAP_ENTRY(metrics_file),
+    SETTINGS_MAP_ENTRY(metrics_interval)
 };
 
 static int
@@ -8,16 +8,14 @@
 
 #include "nhserver.h"
 
+#include <time.h>
+
 #if defined(LIBPQFE_IN_SUBDIR)
 # include <postgresql/libpq-fe.h>
 #else
 # include <libpq-fe.h>
 #endif
 
-/* prepared statement names */
-#define PREP_AUTH       "auth_user"
-#define PREP_REGISTER   "register_user"
-
 /* SQL statements used */
 static const char SQL_init_user_table[] =
     "CREATE TABLE users(" "uid SERIAL PRIMARY KEY, "
@@ -34,7 +32,21 @@ static const char SQL_init_games_table[] =
     "depth integer NOT NULL, " "level_desc text NOT NULL, "
     "done boolean NOT NULL DEFAULT FALSE, "
     "owner integer NOT NULL REFERENCES users (uid), " "ts timestamp NOT NULL, "
-    "start_ts timestamp NOT NULL" ");";
+    "start_ts timestamp NOT NULL, " "log_status integer, "
+    "plrole text NOT NULL DEFAULT '', " "plrace text NOT NULL DEFAULT '', "
+    "plgend text NOT NULL DEFAULT '', " "plalign text NOT NULL DEFAULT '', "
+    "game_state text NOT NULL DEFAULT ''" ");";
+
+/* Games tables created by older versions of the server don't have the columns
+   that cache the log header; add them (log_status stays NULL until the header
+   is first read). */
+static const char SQL_upgrade_games_table[] =
+    "ALTER TABLE games " "ADD COLUMN IF NOT EXISTS log_status integer, "
+    "ADD COLUMN IF NOT EXISTS plrole text NOT NULL DEFAULT '', "
+    "ADD COLUMN IF NOT EXISTS plrace text NOT NULL DEFAULT '', "
+    "ADD COLUMN IF NOT EXISTS plgend text NOT NULL DEFAULT '', "
+    "ADD COLUMN IF NOT EXISTS plalign text NOT NULL DEFAULT '', "
+    "ADD COLUMN IF NOT EXISTS game_state text NOT NULL DEFAULT '';";
 
 static const char SQL_init_topten_table[] =
     "CREATE TABLE topten(" "gid integer PRIMARY KEY REFERENCES games (gid), "
@@ -66,7 +78,8 @@ static const char SQL_get_user_info[] =
     "SELECT name, can_debug " "FROM   users " "WHERE  uid = $1::bigint";
 
 static const char SQL_update_user_ts[] =
-    "UPDATE users " "SET ts = 'now' " "WHERE uid = $1::integer;";
+    "UPDATE users " "SET ts = to_timestamp($2::bigint)::timestamp "
+    "WHERE uid = $1::integer;";
 
 static const char SQL_set_user_email[] =
     "UPDATE users " "SET email = $2::text " "WHERE uid = $1::integer;";
@@ -91,11 +104,18 @@ static const char SQL_update_game[] =
     "SET ts = 'now', moves = $2::integer, depth = $3::integer, level_desc = "
     "$4::text WHERE gid = $1::integer;";
 
+static const char SQL_set_game_header[] =
+    "UPDATE games "
+    "SET log_status = $2::integer, mode = $3::integer, plname = $4::text, "
+    "plrole = $5::text, plrace = $6::text, plgend = $7::text, "
+    "plalign = $8::text, game_state = $9::text WHERE gid = $1::integer;";
+
 static const char SQL_set_game_done[] =
     "UPDATE games " "SET done = TRUE " "WHERE gid = $1::integer;";
 
 static const char SQL_list_games[] =
-    "SELECT g.gid, g.filename, u.name "
+    "SELECT g.gid, g.filename, u.name, g.log_status, g.mode, g.plname, "
+    "       g.plrole, g.plrace, g.plgend, g.plalign, g.game_state "
     "FROM games AS g JOIN users AS u ON g.owner = u.uid "
     "WHERE (u.uid = $1::integer OR $1::integer = 0 OR"
     "       ($1::integer < 0 AND u.uid <> -($1::integer))) "
@@ -109,8 +129,200 @@ static const char SQL_add_topten_entry[] =
     "$5::integer, $6::integer, $7::text, $8::text);";
 
 
+/* All the statements used after startup are prepared once per connection, in
+   check_database; this maps them to their names. */
+enum db_statement {
+    STMT_AUTH,
+    STMT_REGISTER,
+    STMT_LAST_REG_ID,
+    STMT_GET_USER_INFO,
+    STMT_UPDATE_USER_TS,
+    STMT_SET_USER_EMAIL,
+    STMT_SET_USER_PASSWORD,
+    STMT_ADD_GAME,
+    STMT_DELETE_GAME,
+    STMT_LAST_GAME_ID,
+    STMT_UPDATE_GAME,
+    STMT_SET_GAME_HEADER,
+    STMT_SET_GAME_DONE,
+    STMT_LIST_GAMES,
+    STMT_ADD_TOPTEN_ENTRY,
+    STMT_COUNT
+};
+
+static const struct {
+    const char *name;
+    const char *sql;
+} db_statements[STMT_COUNT] = {
+    [STMT_AUTH]              = {"auth_user",         SQL_auth_user},
+    [STMT_REGISTER]          = {"register_user",     SQL_register_user},
+    [STMT_LAST_REG_ID]       = {"last_reg_id",       SQL_last_reg_id},
+    [STMT_GET_USER_INFO]     = {"get_user_info",     SQL_get_user_info},
+    [STMT_UPDATE_USER_TS]    = {"update_user_ts",    SQL_update_user_ts},
+    [STMT_SET_USER_EMAIL]    = {"set_user_email",    SQL_set_user_email},
+    [STMT_SET_USER_PASSWORD] = {"set_user_password", SQL_set_user_password},
+    [STMT_ADD_GAME]          = {"add_game",          SQL_add_game},
+    [STMT_DELETE_GAME]       = {"delete_game",       SQL_delete_game},
+    [STMT_LAST_GAME_ID]      = {"last_game_id",      SQL_last_game_id},
+    [STMT_UPDATE_GAME]       = {"update_game",       SQL_update_game},
+    [STMT_SET_GAME_HEADER]   = {"set_game_header",   SQL_set_game_header},
+    [STMT_SET_GAME_DONE]     = {"set_game_done",     SQL_set_game_done},
+    [STMT_LIST_GAMES]        = {"list_games",        SQL_list_games},
+    [STMT_ADD_TOPTEN_ENTRY]  = {"add_topten_entry",  SQL_add_topten_entry},
+};
+
+
 static PGconn *conn;
 
+/* Writes whose results we don't need (e.g. updating a game's status when the
+   player changes level) are sent without waiting for the server, using
+   libpq's pipeline mode; this counts the ones that haven't finished yet. Any
+   query that does need a result waits for them first, so the database still
+   sees everything in order. */
+static int async_pending;
+
+static void db_finish_async(void);
+static int prepare_statements(void);
+
+
+/* Runs a prepared statement, and returns its result. All parameters are in
+   text format. */
+static PGresult *
+db_exec(enum db_statement stmt, int nparams, const char *const *params)
+{
+    PGresult *res;
+    long long start;
+
+    db_finish_async();
+
+    start = metrics_now();
+    res = PQexecPrepared(conn, db_statements[stmt].name, nparams, params,
+                         NULL, NULL, 0);
+    metrics_observe(MF_DB_QUERY, db_statements[stmt].name,
+                    metrics_now() - start);
+    return res;
+}
+
+
+/* Collects the results of asynchronous writes, logging any errors. If block is
+   FALSE, this only collects results that have already arrived. */
+static void
+db_collect_async(int block)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+    PGresult *res;
+    int statement_ended = FALSE;
+
+    while (async_pending) {
+        if (PQstatus(conn) == CONNECTION_BAD) {
+            log_msg("lost database connection with %d writes pending",
+                    async_pending);
+            async_pending = 0;
+            return;
+        }
+        if (!block) {
+            PQflush(conn);
+            if (!PQconsumeInput(conn) || PQisBusy(conn))
+                return;
+        }
+
+        /* In pipeline mode, NULL marks the end of one statement's results;
+           a second NULL in a row means that nothing else is in the pipeline,
+           so the count is wrong, and waiting for more would never end. */
+        res = PQgetResult(conn);
+        if (!res) {
+            if (statement_ended) {
+                log_msg("database pipeline empty with %d writes pending",
+                        async_pending);
+                async_pending = 0;
+                return;
+            }
+            statement_ended = TRUE;
+            continue;
+        }
+        statement_ended = FALSE;
+
+        switch (PQresultStatus(res)) {
+        case PGRES_PIPELINE_SYNC:
+            async_pending--;
+            break;
+        case PGRES_COMMAND_OK:
+        case PGRES_TUPLES_OK:
+        case PGRES_PIPELINE_ABORTED:    /* the error was already logged */
+            break;
+        default:
+            log_msg("asynchronous database write failed: %s",
+                    PQresultErrorMessage(res));
+            break;
+        }
+        PQclear(res);
+    }
+#endif
+}
+
+
+static void
+db_finish_async(void)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+    if (!conn || PQpipelineStatus(conn) == PQ_PIPELINE_OFF)
+        return;
+
+    PQsetnonblocking(conn, 0);
+    PQflush(conn);
+    db_collect_async(TRUE);
+    if (!PQexitPipelineMode(conn))
+        log_msg("could not leave pipeline mode: %s", PQerrorMessage(conn));
+#endif
+}
+
+
+/* Runs a prepared statement whose result we don't need, without waiting for it
+   to finish if possible. what is used in error messages. */
+static void
+db_exec_async(enum db_statement stmt, int nparams, const char *const *params,
+              const char *what)
+{
+#ifdef LIBPQ_HAS_PIPELINING
+    if (PQpipelineStatus(conn) == PQ_PIPELINE_OFF &&
+        (PQsetnonblocking(conn, 1) != 0 || !PQenterPipelineMode(conn)))
+        PQsetnonblocking(conn, 0);      /* fall back to waiting */
+    else if (!PQsendQueryPrepared(conn, db_statements[stmt].name, nparams,
+                                  params, NULL, NULL, 0)) {
+        log_msg("%s error: %s", what, PQerrorMessage(conn));
+        db_finish_async();
+        return;
+    } else {
+        /* Each write has its own sync point, so that one failing doesn't
+           cause the others to be skipped. Without one, the server wouldn't
+           send the write's result, and waiting for it would never end; so if
+           we can't send it, even while blocking, we leave pipeline mode the
+           only way we can, by reconnecting. */
+        if (PQpipelineSync(conn) ||
+            (PQsetnonblocking(conn, 0) == 0 && PQpipelineSync(conn))) {
+            async_pending++;
+            db_collect_async(FALSE);
+            return;
+        }
+
+        log_msg("%s error: %s; reconnecting to the database", what,
+                PQerrorMessage(conn));
+        async_pending = 0;
+        PQreset(conn);
+        if (PQstatus(conn) != CONNECTION_OK || !prepare_statements())
+            log_msg("could not reconnect to the database: %s",
+                    PQerrorMessage(conn));
+        return;
+    }
+#endif
+
+    PGresult *res = db_exec(stmt, nparams, params);
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK)
+        log_msg("%s error: %s", what, PQerrorMessage(conn));
+    PQclear(res);
+}
+
 
 /*
  * init the database connection.
@@ -133,6 +345,7 @@ init_database(void)
 
 err:
     PQfinish(conn);
+    conn = NULL;
     return FALSE;
 }
 
@@ -168,6 +381,29 @@ check_create_table(const char *tablename, const char *create_stmt)
 }
 
 
+/* Prepares the statements in db_statements on the connection. */
+static int
+prepare_statements(void)
+{
+    PGresult *res;
+    int i;
+
+    for (i = 0; i < STMT_COUNT; i++) {
+        res = PQprepare(conn, db_statements[i].name, db_statements[i].sql, 0,
+                        NULL);
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            fprintf(stderr, "prepare statement %s failed: %s",
+                    db_statements[i].name, PQerrorMessage(conn));
+            PQclear(res);
+            return FALSE;
+        }
+        PQclear(res);
+    }
+
+    return TRUE;
+}
+
+
 /*
  * check the database tables and create them if necessary. Also check for the
  * existence of the crypt function
@@ -198,29 +434,23 @@ check_database(void)
         !check_create_table("topten", SQL_init_topten_table))
         goto err;
 
-    /* 
-     * Create prepared statements
-     */
-    res = PQprepare(conn, PREP_REGISTER, SQL_register_user, 0, NULL);
+    res = PQexec(conn, SQL_upgrade_games_table);
     if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-        fprintf(stderr, "prepare statement failed: %s", PQerrorMessage(conn));
+        fprintf(stderr, "Failed to upgrade table games: %s",
+                PQerrorMessage(conn));
         PQclear(res);
         goto err;
     }
     PQclear(res);
 
-    res = PQprepare(conn, PREP_AUTH, SQL_auth_user, 0, NULL);
-    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-        fprintf(stderr, "prepare statement failed: %s", PQerrorMessage(conn));
-        PQclear(res);
+    if (!prepare_statements())
         goto err;
-    }
-    PQclear(res);
 
     return TRUE;
 
 err:
     PQfinish(conn);
+    conn = NULL;
     return FALSE;
 }
 
@@ -228,6 +458,10 @@ err:
 void
 close_database(void)
 {
+    if (!conn)
+        return;
+
+    db_finish_async();
     PQfinish(conn);
     conn = NULL;
 }
@@ -241,7 +475,7 @@ db_auth_user(const char *name, const char *pass)
     int uid, auth_ok, col;
     const char *uidstr;
 
-    res = PQexecPrepared(conn, PREP_AUTH, 2, params, NULL, NULL, 0);
+    res = db_exec(STMT_AUTH, 2, params);
     if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
         log_msg("db_auth_user failed: %s\n", PQerrorMessage(conn));
         PQclear(res);
@@ -268,7 +502,7 @@ db_register_user(const char *name, const char *pass, const char *email)
     int uid;
     const char *uidstr;
 
-    res = PQexecPrepared(conn, PREP_REGISTER, 3, params, NULL, NULL, 0);
+    res = db_exec(STMT_REGISTER, 3, params);
     if (PQresultStatus(res) != PGRES_COMMAND_OK) {
         log_msg("db_register_user failed: %s", PQerrorMessage(conn));
         PQclear(res);
@@ -276,7 +510,7 @@ db_register_user(const char *name, const char *pass, const char *email)
     }
     PQclear(res);
 
-    res = PQexec(conn, SQL_last_reg_id);
+    res = db_exec(STMT_LAST_REG_ID, 0, NULL);
     if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
         log_msg("db_register_user get last id failed: %s",
                 PQerrorMessage(conn));
@@ -297,14 +531,11 @@ db_get_user_info(int uid, struct user_info *info)
     PGresult *res;
     char uidstr[16];
     const char *const params[] = { uidstr };
-    const int paramFormats[] = { 0 };   /* text format */
     int col;
 
     snprintf(uidstr, sizeof(uidstr), "%d", uid);
 
-    res =
-        PQexecParams(conn, SQL_get_user_info, 1, NULL, params, NULL,
-                     paramFormats, 0);
+    res = db_exec(STMT_GET_USER_INFO, 1, params);
     if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
         log_msg("db_get_user_info error: %s", PQerrorMessage(conn));
         PQclear(res);
@@ -324,21 +555,41 @@ db_get_user_info(int uid, struct user_info *info)
 }
 
 
+/* The user's timestamp is updated for every command they send, which would be
+   a lot of database traffic. Instead, we remember the time of the most recent
+   command, and write it out at most once every USER_TS_INTERVAL seconds (and
+   when the client exits, via db_flush_user_ts). */
+static int ts_pending_uid;
+static time_t ts_pending, ts_flushed;
+
 void
 db_update_user_ts(int uid)
 {
-    PGresult *res;
-    char uidstr[16];
-    const char *const params[] = { uidstr };
-    const int paramFormats[] = { 0 };   /* text format */
+    ts_pending_uid = uid;
+    ts_pending = time(NULL);
 
-    snprintf(uidstr, sizeof(uidstr), "%d", uid);
-    res =
-        PQexecParams(conn, SQL_update_user_ts, 1, NULL, params, NULL,
-                     paramFormats, 0);
-    if (PQresultStatus(res) != PGRES_COMMAND_OK)
-        log_msg("update_user_ts error: %s", PQerrorMessage(conn));
-    PQclear(res);
+    if (ts_pending - ts_flushed >= USER_TS_INTERVAL)
+        db_flush_user_ts();
+    else if (async_pending)
+        db_collect_async(FALSE);
+}
+
+
+void
+db_flush_user_ts(void)
+{
+    char uidstr[16], tsstr[32];
+    const char *const params[] = { uidstr, tsstr };
+
+    if (!ts_pending_uid || !conn)
+        return;
+
+    snprintf(uidstr, sizeof(uidstr), "%d", ts_pending_uid);
+    snprintf(tsstr, sizeof(tsstr), "%lld", (long long)ts_pending);
+    db_exec_async(STMT_UPDATE_USER_TS, 2, params, "update_user_ts");
+
+    ts_flushed = ts_pending;
+    ts_pending_uid = 0;
 }
 
 
@@ -348,14 +599,11 @@ db_set_user_email(int uid, const char *email)
     PGresult *res;
     char uidstr[16];
     const char *const params[] = { uidstr, email };
-    const int paramFormats[] = { 0, 0 };
     const char *numrows;
 
     snprintf(uidstr, sizeof(uidstr), "%d", uid);
 
-    res =
-        PQexecParams(conn, SQL_set_user_email, 2, NULL, params, NULL,
-                     paramFormats, 0);
+    res = db_exec(STMT_SET_USER_EMAIL, 2, params);
     numrows = PQcmdTuples(res);
     if (PQresultStatus(res) == PGRES_COMMAND_OK && atoi(numrows) == 1) {
         PQclear(res);
@@ -372,14 +620,11 @@ db_set_user_password(int uid, const char *password)
     PGresult *res;
     char uidstr[16];
     const char *const params[] = { uidstr, password };
-    const int paramFormats[] = { 0, 0 };
     const char *numrows;
 
     snprintf(uidstr, sizeof(uidstr), "%d", uid);
 
-    res =
-        PQexecParams(conn, SQL_set_user_password, 2, NULL, params, NULL,
-                     paramFormats, 0);
+    res = db_exec(STMT_SET_USER_PASSWORD, 2, params);
     numrows = PQcmdTuples(res);
     if (PQresultStatus(res) == PGRES_COMMAND_OK && atoi(numrows) == 1) {
         PQclear(res);
@@ -401,24 +646,22 @@ db_add_new_game(int uid, const char *filename, const char *role,
     const char *const params[] = { filename, role, race, gend,
         align, modestr, uidstr, plname, levdesc
     };
-    const int paramFormats[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
     const char *gameid_str;
     int gid;
 
     snprintf(uidstr, sizeof(uidstr), "%d", uid);
     snprintf(modestr, sizeof(modestr), "%d", mode);
 
-    res =
-        PQexecParams(conn, SQL_add_game, 9, NULL, params, NULL, paramFormats,
-                     0);
+    res = db_exec(STMT_ADD_GAME, 9, params);
     if (PQresultStatus(res) != PGRES_COMMAND_OK) {
         log_msg("db_add_new_game error while adding (%s - %s): %s", plname,
                 filename, PQerrorMessage(conn));
         PQclear(res);
         return 0;
     }
+    PQclear(res);
 
-    res = PQexec(conn, SQL_last_game_id);
+    res = db_exec(STMT_LAST_GAME_ID, 0, NULL);
     if (PQresultStatus(res) != PGRES_TUPLES_OK || PQntuples(res) == 0) {
         PQclear(res);
         return 0;
@@ -435,41 +678,44 @@ db_add_new_game(int uid, const char *filename, const char *role,
 void
 db_update_game(int game, int moves, int depth, const char *levdesc)
 {
-    PGresult *res;
     char gidstr[16], movesstr[16], depthstr[16];
     const char *const params[] = { gidstr, movesstr, depthstr, levdesc };
-    const int paramFormats[] = { 0, 0, 0, 0 };
 
     snprintf(gidstr, sizeof(gidstr), "%d", game);
     snprintf(movesstr, sizeof(movesstr), "%d", moves);
     snprintf(depthstr, sizeof(depthstr), "%d", depth);
 
-    res =
-        PQexecParams(conn, SQL_update_game, 4, NULL, params, NULL, paramFormats,
-                     0);
-    if (PQresultStatus(res) != PGRES_COMMAND_OK)
-        log_msg("update_game_ts error: %s", PQerrorMessage(conn));
-    PQclear(res);
+    db_exec_async(STMT_UPDATE_GAME, 4, params, "update_game_ts");
+}
+
+/* Cache the information from a game's log header, so that listing games
+   doesn't need to open the files. */
+void
+db_set_game_header(int game, enum nh_log_status status,
+                   const struct nh_game_info *gi)
+{
+    char gidstr[16], statusstr[16], modestr[16];
+    const char *const params[] = { gidstr, statusstr, modestr, gi->name,
+        gi->plrole, gi->plrace, gi->plgend, gi->plalign, gi->game_state
+    };
+
+    snprintf(gidstr, sizeof(gidstr), "%d", game);
+    snprintf(statusstr, sizeof(statusstr), "%d", status);
+    snprintf(modestr, sizeof(modestr), "%d", gi->playmode);
+
+    db_exec_async(STMT_SET_GAME_HEADER, 9, params, "set_game_header");
 }
 
 void
 db_delete_game(int uid, int gid)
 {
-    PGresult *res;
     char uidstr[16], gidstr[16];
     const char *const params[] = { uidstr, gidstr };
-    const int paramFormats[] = { 0, 0 };
 
     snprintf(uidstr, sizeof(uidstr), "%d", uid);
     snprintf(gidstr, sizeof(gidstr), "%d", gid);
 
-    res =
-        PQexecParams(conn, SQL_delete_game, 2, NULL, params, NULL, paramFormats,
-                     0);
-    if (PQresultStatus(res) != PGRES_COMMAND_OK)
-        log_msg("db_delete_game error: %s", PQerrorMessage(conn));
-
-    PQclear(res);
+    db_exec_async(STMT_DELETE_GAME, 2, params, "db_delete_game");
 }
 
 
@@ -477,11 +723,11 @@ static struct gamefile_info *
 db_game_name_core(int completed, int uid, int gid, int limit, int *count)
 {
     PGresult *res;
-    int i, gidcol, fncol, ucol;
+    int i, gidcol, fncol, ucol, lscol, modecol, namecol, rolecol, racecol,
+        gendcol, aligncol, statecol;
     struct gamefile_info *files;
     char uidstr[16], gidstr[16], complstr[16], limitstr[16];
     const char *const params[] = { uidstr, complstr, gidstr, limitstr };
-    const int paramFormats[] = { 0, 0, 0, 0 };
     const char *const fmtstr = completed ? "%s/completed/%s/%s" :
         "%s/save/%s/%s";
 
@@ -493,9 +739,7 @@ db_game_name_core(int completed, int uid, int gid, int limit, int *count)
     snprintf(complstr, sizeof(complstr), "%d", !!completed);
     snprintf(limitstr, sizeof(limitstr), "%d", limit);
 
-    res =
-        PQexecParams(conn, SQL_list_games, 4, NULL, params, NULL, paramFormats,
-                     0);
+    res = db_exec(STMT_LIST_GAMES, 4, params);
     if (PQresultStatus(res) != PGRES_TUPLES_OK) {
         log_msg("list_games error: %s", PQerrorMessage(conn));
         PQclear(res);
@@ -507,10 +751,34 @@ db_game_name_core(int completed, int uid, int gid, int limit, int *count)
     gidcol = PQfnumber(res, "gid");
     fncol = PQfnumber(res, "filename");
     ucol = PQfnumber(res, "name");
+    lscol = PQfnumber(res, "log_status");
+    modecol = PQfnumber(res, "mode");
+    namecol = PQfnumber(res, "plname");
+    rolecol = PQfnumber(res, "plrole");
+    racecol = PQfnumber(res, "plrace");
+    gendcol = PQfnumber(res, "plgend");
+    aligncol = PQfnumber(res, "plalign");
+    statecol = PQfnumber(res, "game_state");
 
     files = malloc(sizeof (struct gamefile_info) * (*count));
     for (i = 0; i < *count; i++) {
+        struct nh_game_info *gi = &files[i].gi;
+
         files[i].gid = atoi(PQgetvalue(res, i, gidcol));
+        files[i].status = PQgetisnull(res, i, lscol) ? LS_INVALID :
+            atoi(PQgetvalue(res, i, lscol));
+
+        memset(gi, 0, sizeof *gi);
+        gi->playmode = atoi(PQgetvalue(res, i, modecol));
+        strncpy(gi->name, PQgetvalue(res, i, namecol), sizeof gi->name - 1);
+        strncpy(gi->plrole, PQgetvalue(res, i, rolecol), sizeof gi->plrole - 1);
+        strncpy(gi->plrace, PQgetvalue(res, i, racecol), sizeof gi->plrace - 1);
+        strncpy(gi->plgend, PQgetvalue(res, i, gendcol), sizeof gi->plgend - 1);
+        strncpy(gi->plalign, PQgetvalue(res, i, aligncol),
+                sizeof gi->plalign - 1);
+        strncpy(gi->game_state, PQgetvalue(res, i, statecol),
+                sizeof gi->game_state - 1);
+
         files[i].filename = malloc(strlen(fmtstr) +
                                    strlen(settings.workdir) +
                                    strlen(PQgetvalue(res, i, fncol)) +
@@ -555,13 +823,11 @@ void
 db_add_topten_entry(int gid, int points, int hp, int maxhp, int deaths,
                     int end_how, const char *death, const char *entrytxt)
 {
-    PGresult *res;
     char gidstr[16], pointstr[16], hpstr[16], maxhpstr[16], dcountstr[16],
         endstr[16];
     const char *const params[] = { gidstr, pointstr, hpstr, maxhpstr,
         dcountstr, endstr, death, entrytxt
     };
-    const int paramFormats[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
 
     snprintf(gidstr, sizeof(gidstr), "%d", gid);
     snprintf(pointstr, sizeof(pointstr), "%d", points);
@@ -570,22 +836,10 @@ db_add_topten_entry(int gid, int points, int hp, int maxhp, int deaths,
     snprintf(dcountstr, sizeof(dcountstr), "%d", deaths);
     snprintf(endstr, sizeof(endstr), "%d", end_how);
 
-    res =
-        PQexecParams(conn, SQL_add_topten_entry, 8, NULL, params, NULL,
-                     paramFormats, 0);
-    if (PQresultStatus(res) != PGRES_COMMAND_OK)
-        log_msg("add_topten_entry error: %s", PQerrorMessage(conn));
-    PQclear(res);
+    db_exec_async(STMT_ADD_TOPTEN_ENTRY, 8, params, "add_topten_entry");
 
-    /* note: the params and paramFormats arrays are re-used, but only the 1.
-       entry matters */
-    res =
-        PQexecParams(conn, SQL_set_game_done, 1, NULL, params, NULL,
-                     paramFormats, 0);
-    if (PQresultStatus(res) != PGRES_COMMAND_OK)
-        log_msg("set_game_done error: %s", PQerrorMessage(conn));
-    PQclear(res);
-    return;
+    /* note: the params array is re-used, but only the 1. entry matters */
+    db_exec_async(STMT_SET_GAME_DONE, 1, params, "set_game_done");
 }
 
 /* db_pgsql.c */
@@ -0,0 +1,124 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* The NetHack server may be freely redistributed under the terms of either:
+ *  - the NetHack license
+ *  - the GNU General Public license v2 or later
+ */
+
+#include "nhserver.h"
+#include <ctype.h>
+
+/* Splitting the client's input into messages. The protocol has no framing:
+   the client just sends one JSON object after another. Rather than trying to
+   parse the whole buffer whenever it might end with a complete object, we scan
+   each byte once, keeping track of nesting and strings, so that we know exactly
+   where each object ends. Each message is then parsed exactly once, and any
+   data after it (e.g. the next command, if the client didn't wait for a
+   response) stays in the buffer for next time.
+
+   The auth command and everything after it go through the same buffer, so it
+   doesn't matter how either is split into packets. */
+
+#define INPUTBUF_SIZE (1024 * 1024)
+
+static char inputbuf[INPUTBUF_SIZE];
+static int input_len;       /* bytes in inputbuf */
+static int scan_pos;        /* bytes of inputbuf that have been scanned */
+static int scan_depth;      /* nesting depth of objects and arrays at scan_pos */
+static int scan_in_string, scan_escaped;
+
+
+static void
+discard_input(int len)
+{
+    memmove(inputbuf, inputbuf + len, input_len - len);
+    input_len -= len;
+    scan_pos = 0;
+    scan_depth = 0;
+    scan_in_string = scan_escaped = FALSE;
+}
+
+
+/* Reads whatever data is available from fd (which should be readable, or this
+   will block) into the input buffer, up to a total of limit bytes buffered (0
+   for as much as fits). Returns the result of read(), or -2 if the buffer is
+   already full. */
+int
+read_input_data(int fd, int limit)
+{
+    int ret;
+
+    if (limit <= 0 || limit > INPUTBUF_SIZE)
+        limit = INPUTBUF_SIZE;
+    if (input_len >= limit)
+        return -2;
+
+    ret = read(fd, inputbuf + input_len, limit - input_len);
+    if (ret > 0)
+        input_len += ret;
+    return ret;
+}
+
+
+/* Returns the next message in the input buffer, or NULL if there isn't a
+   complete one yet. *bad is set if the input can't possibly be valid. */
+json_t *
+next_input_message(int *bad)
+{
+    json_t *jval;
+    json_error_t err;
+    char c;
+
+    *bad = FALSE;
+    while (scan_pos < input_len) {
+        c = inputbuf[scan_pos++];
+
+        if (c == '\033') {
+            /* A request to reset the buffer when recovering from a connection
+               error. After such an error it simply isn't possible to know what
+               data actually arrived, so drop everything before it. */
+            discard_input(scan_pos);
+            continue;
+        }
+
+        if (scan_in_string) {
+            if (scan_escaped)
+                scan_escaped = FALSE;
+            else if (c == '\\')
+                scan_escaped = TRUE;
+            else if (c == '"')
+                scan_in_string = FALSE;
+            continue;
+        }
+
+        if (scan_depth == 0) {
+            /* between messages */
+            if (isspace((unsigned char)c) || c == '\0') {
+                discard_input(scan_pos);
+                continue;
+            }
+            if (c != '{') {
+                *bad = TRUE;
+                return NULL;
+            }
+        }
+
+        if (c == '"')
+            scan_in_string = TRUE;
+        else if (c == '{' || c == '[')
+            scan_depth++;
+        else if (c == '}' || c == ']') {
+            if (--scan_depth == 0) {
+                jval = json_loadb(inputbuf, scan_pos, JSON_REJECT_DUPLICATES,
+                                  &err);
+                discard_input(scan_pos);
+                if (!jval)
+                    *bad = TRUE;
+                return jval;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* framing.c */
@@ -0,0 +1,482 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* The NetHack server may be freely redistributed under the terms of either:
+ *  - the NetHack license
+ *  - the GNU General Public license v2 or later
+ */
+
+#include "nhserver.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <time.h>
+
+/* Performance metrics. If metrics_file is set, the server measures how long it
+   takes to respond to each message from the client, how long database queries
+   take, how big the map updates it sends are, and how much time the game
+   engine spends writing and checking saves; and every metrics_interval seconds,
+   it writes the totals to metrics_file in the Prometheus text format (so that
+   e.g. the node_exporter textfile collector can pick them up).
+
+   Each connection has its own process, and the totals have to cover all of
+   them; so they're kept in a file in the workdir that every process maps into
+   memory, and updated with atomic operations. Whichever process notices that
+   the metrics file is due for a refresh writes it. */
+
+#define METRICS_MAGIC 0x4e344d31        /* "N4M1"; change with the layout */
+#define METRICS_BUCKETS 16
+#define METRICS_MAX_SERIES 128
+#define METRICS_LABEL_LEN 32
+
+enum metrics_counter {
+    MC_CONNECTIONS,
+    MC_MESSAGES_RECEIVED,
+    MC_MESSAGES_SENT,
+    MC_BYTES_RECEIVED,
+    MC_BYTES_SENT,
+    MC_SAVES,
+    MC_SAVE_TIME,
+    MC_DIFF_TIME,
+    MC_CHECK_TIME,
+    MC_SYNCS,
+    MC_SYNC_TIME,
+    MC_SYNC_DIFFS,
+    MC_SYNC_BACKUPS,
+    MC_COUNT
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+    int microseconds;   /* reported in seconds */
+} counter_desc[MC_COUNT] = {
+    [MC_CONNECTIONS]        = {"connections_total",
+                               "Client connections handled.", FALSE},
+    [MC_MESSAGES_RECEIVED]  = {"messages_received_total",
+                               "Messages received from clients.", FALSE},
+    [MC_MESSAGES_SENT]      = {"messages_sent_total",
+                               "Messages sent to clients.", FALSE},
+    [MC_BYTES_RECEIVED]     = {"received_bytes_total",
+                               "Bytes received from clients.", FALSE},
+    [MC_BYTES_SENT]         = {"sent_bytes_total",
+                               "Bytes sent to clients.", FALSE},
+    [MC_SAVES]              = {"saves_total",
+                               "Save diffs and backups written.", FALSE},
+    [MC_SAVE_TIME]          = {"save_seconds_total",
+                               "Time spent saving the game.", TRUE},
+    [MC_DIFF_TIME]          = {"save_encode_seconds_total",
+                               "Time spent diffing and writing saves.", TRUE},
+    [MC_CHECK_TIME]         = {"save_check_seconds_total",
+                               "Time spent verifying new saves.", TRUE},
+    [MC_SYNCS]              = {"log_syncs_total",
+                               "Times a game was loaded from its log.", FALSE},
+    [MC_SYNC_TIME]          = {"log_sync_seconds_total",
+                               "Time spent loading games from logs.", TRUE},
+    [MC_SYNC_DIFFS]         = {"log_sync_diffs_total",
+                               "Save diffs replayed loading games.", FALSE},
+    [MC_SYNC_BACKUPS]       = {"log_sync_backups_total",
+                               "Save backups read loading games.", FALSE},
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+    const char *label;
+    int microseconds;
+    long long bounds[METRICS_BUCKETS];  /* upper bounds; then +Inf */
+} family_desc[MF_COUNT] = {
+    [MF_COMMAND] = {
+        "response_seconds",
+        "Time from receiving a message from the client to the next response.",
+        "command", TRUE,
+        {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+         250000, 500000, 1000000, 2500000, 5000000, 10000000}},
+    [MF_DB_QUERY] = {
+        "db_query_seconds", "Time taken by database queries.",
+        "query", TRUE,
+        {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+         250000, 500000, 1000000, 2500000, 5000000, 10000000}},
+    [MF_UPDATE_SCREEN] = {
+        "update_screen_bytes", "Size of map updates sent to clients.",
+        "encoding", FALSE,
+        {64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536,
+         131072, 262144, 524288, 1048576, 2097152}},
+};
+
+struct metrics_series {
+    atomic_int family;  /* 0 if unused, otherwise the family + 1 */
+    char label[METRICS_LABEL_LEN];
+    atomic_ullong buckets[METRICS_BUCKETS + 1];
+    atomic_ullong sum;
+};
+
+struct metrics_shared {
+    unsigned magic;
+    unsigned size;
+    atomic_llong last_written;  /* when metrics_file was last written */
+    atomic_ullong counters[MC_COUNT];
+    struct metrics_series series[METRICS_MAX_SERIES];
+};
+
+static struct metrics_shared *metrics;
+static int metrics_fd = -1, metrics_tried, metrics_interval;
+
+/* This process's connection, for the summary logged when it ends. */
+static long long conn_start, conn_response_time;
+static long conn_messages, conn_bytes_received, conn_bytes_sent;
+
+/* The message we're responding to; see metrics_message_received. */
+static long long message_time;
+static const char *message_command;
+
+static struct nh_log_sync_stats prev_log_stats;
+
+
+long long
+metrics_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+
+static int
+open_metrics(void)
+{
+    char path[1024];
+    struct stat st;
+    void *map;
+
+    if (metrics_tried)
+        return metrics != NULL;
+    metrics_tried = TRUE;
+
+    if (!settings.metrics_file)
+        return FALSE;
+
+    metrics_interval = settings.metrics_interval ?
+        atoi(settings.metrics_interval) : 0;
+    if (metrics_interval <= 0)
+        metrics_interval = DEFAULT_METRICS_INTERVAL;
+
+    snprintf(path, sizeof path, "%s/metrics.dat", settings.workdir);
+    metrics_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (metrics_fd == -1) {
+        log_msg("Could not open %s: %s", path, strerror(errno));
+        return FALSE;
+    }
+
+    /* Whoever gets here first lays out the file; a file from a different
+       version of the server is started again from zero. */
+    flock(metrics_fd, LOCK_EX);
+    if (fstat(metrics_fd, &st) == -1 ||
+        (st.st_size != sizeof *metrics &&
+         (ftruncate(metrics_fd, 0) == -1 ||
+          ftruncate(metrics_fd, sizeof *metrics) == -1))) {
+        log_msg("Could not set up %s: %s", path, strerror(errno));
+        flock(metrics_fd, LOCK_UN);
+        close(metrics_fd);
+        metrics_fd = -1;
+        return FALSE;
+    }
+
+    map = mmap(NULL, sizeof *metrics, PROT_READ | PROT_WRITE, MAP_SHARED,
+               metrics_fd, 0);
+    if (map == MAP_FAILED) {
+        log_msg("Could not map %s: %s", path, strerror(errno));
+        flock(metrics_fd, LOCK_UN);
+        close(metrics_fd);
+        metrics_fd = -1;
+        return FALSE;
+    }
+    metrics = map;
+
+    if (metrics->magic != METRICS_MAGIC || metrics->size != sizeof *metrics) {
+        memset(metrics, 0, sizeof *metrics);
+        metrics->magic = METRICS_MAGIC;
+        metrics->size = sizeof *metrics;
+    }
+    flock(metrics_fd, LOCK_UN);
+
+    nh_get_log_sync_stats(&prev_log_stats);
+    return TRUE;
+}
+
+
+int
+metrics_enabled(void)
+{
+    return open_metrics();
+}
+
+
+static void
+count(enum metrics_counter c, unsigned long long n)
+{
+    atomic_fetch_add_explicit(&metrics->counters[c], n, memory_order_relaxed);
+}
+
+
+/* Finds the series for the given label of a family, creating it if need be.
+   Series are only ever added at the end, under the file lock, so the first
+   unused one marks the end of the list. */
+static struct metrics_series *
+find_series(enum metrics_family family, const char *label)
+{
+    struct metrics_series *s;
+    int i, locked = FALSE;
+
+    for (i = 0; i < METRICS_MAX_SERIES; i++) {
+        s = &metrics->series[i];
+        if (atomic_load_explicit(&s->family, memory_order_acquire) == 0) {
+            if (!locked) {
+                /* someone else might be adding the same series */
+                flock(metrics_fd, LOCK_EX);
+                locked = TRUE;
+                i--;
+                continue;
+            }
+            snprintf(s->label, sizeof s->label, "%s", label);
+            atomic_store_explicit(&s->family, family + 1,
+                                  memory_order_release);
+            break;
+        }
+        if (atomic_load_explicit(&s->family, memory_order_relaxed) ==
+            family + 1 && !strncmp(s->label, label, METRICS_LABEL_LEN - 1))
+            break;
+    }
+
+    if (locked)
+        flock(metrics_fd, LOCK_UN);
+    return i < METRICS_MAX_SERIES ? s : NULL;
+}
+
+
+/* Records one measurement (in microseconds or bytes) in a histogram. */
+void
+metrics_observe(enum metrics_family family, const char *label,
+                long long value)
+{
+    struct metrics_series *s;
+    int b;
+
+    if (!open_metrics() || !(s = find_series(family, label)))
+        return;
+
+    for (b = 0; b < METRICS_BUCKETS; b++)
+        if (value <= family_desc[family].bounds[b])
+            break;
+    atomic_fetch_add_explicit(&s->buckets[b], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->sum, value, memory_order_relaxed);
+}
+
+
+/* Adds whatever the game engine has done since last time to the totals. */
+static void
+note_log_stats(void)
+{
+    struct nh_log_sync_stats st;
+
+    nh_get_log_sync_stats(&st);
+    count(MC_SAVES, st.saves - prev_log_stats.saves);
+    count(MC_SAVE_TIME, st.save_time - prev_log_stats.save_time);
+    count(MC_DIFF_TIME, st.diff_time - prev_log_stats.diff_time);
+    count(MC_CHECK_TIME, st.check_time - prev_log_stats.check_time);
+    count(MC_SYNCS, st.syncs - prev_log_stats.syncs);
+    count(MC_SYNC_TIME, st.sync_time - prev_log_stats.sync_time);
+    count(MC_SYNC_DIFFS, st.total_diffs - prev_log_stats.total_diffs);
+    count(MC_SYNC_BACKUPS, st.total_backups - prev_log_stats.total_backups);
+    prev_log_stats = st;
+}
+
+
+static void
+print_value(FILE *f, unsigned long long value, int microseconds)
+{
+    if (microseconds)
+        fprintf(f, "%llu.%06llu\n", value / 1000000, value % 1000000);
+    else
+        fprintf(f, "%llu\n", value);
+}
+
+
+static void
+write_metrics_file(void)
+{
+    char tmpname[1024];
+    struct metrics_series *s;
+    unsigned long long n;
+    FILE *f;
+    int c, fam, i, b;
+
+    snprintf(tmpname, sizeof tmpname, "%s.%d", settings.metrics_file,
+             (int)getpid());
+    f = fopen(tmpname, "w");
+    if (!f) {
+        log_msg("Could not write %s: %s", tmpname, strerror(errno));
+        return;
+    }
+
+    for (c = 0; c < MC_COUNT; c++) {
+        fprintf(f, "# HELP nethack4_%s %s\n# TYPE nethack4_%s counter\n"
+                "nethack4_%s ", counter_desc[c].name, counter_desc[c].help,
+                counter_desc[c].name, counter_desc[c].name);
+        print_value(f, atomic_load(&metrics->counters[c]),
+                    counter_desc[c].microseconds);
+    }
+
+    for (fam = 0; fam < MF_COUNT; fam++) {
+        fprintf(f, "# HELP nethack4_%s %s\n# TYPE nethack4_%s histogram\n",
+                family_desc[fam].name, family_desc[fam].help,
+                family_desc[fam].name);
+
+        for (i = 0; i < METRICS_MAX_SERIES; i++) {
+            s = &metrics->series[i];
+            c = atomic_load_explicit(&s->family, memory_order_acquire);
+            if (c == 0)
+                break;
+            if (c != fam + 1)
+                continue;
+
+            n = 0;
+            for (b = 0; b <= METRICS_BUCKETS; b++) {
+                n += atomic_load_explicit(&s->buckets[b],
+                                          memory_order_relaxed);
+                fprintf(f, "nethack4_%s_bucket{%s=\"%s\",le=\"",
+                        family_desc[fam].name, family_desc[fam].label,
+                        s->label);
+                if (b == METRICS_BUCKETS)
+                    fprintf(f, "+Inf");
+                else if (family_desc[fam].microseconds)
+                    fprintf(f, "%g", family_desc[fam].bounds[b] / 1e6);
+                else
+                    fprintf(f, "%lld", family_desc[fam].bounds[b]);
+                fprintf(f, "\"} %llu\n", n);
+            }
+            fprintf(f, "nethack4_%s_sum{%s=\"%s\"} ", family_desc[fam].name,
+                    family_desc[fam].label, s->label);
+            print_value(f, atomic_load_explicit(&s->sum, memory_order_relaxed),
+                        family_desc[fam].microseconds);
+            fprintf(f, "nethack4_%s_count{%s=\"%s\"} %llu\n",
+                    family_desc[fam].name, family_desc[fam].label, s->label,
+                    n);
+        }
+    }
+
+    if (fclose(f) == EOF || rename(tmpname, settings.metrics_file) == -1) {
+        log_msg("Could not write %s: %s", settings.metrics_file,
+                strerror(errno));
+        unlink(tmpname);
+    }
+}
+
+
+/* Writes metrics_file if it's due (or if force is set), and nobody else is
+   doing it. */
+void
+metrics_flush(int force)
+{
+    long long now = time(NULL), last;
+
+    if (!open_metrics())
+        return;
+
+    note_log_stats();
+
+    last = atomic_load(&metrics->last_written);
+    if (!force && now < last + metrics_interval)
+        return;
+    if (!atomic_compare_exchange_strong(&metrics->last_written, &last, now))
+        return;
+
+    write_metrics_file();
+}
+
+
+void
+metrics_connection_opened(void)
+{
+    if (!open_metrics())
+        return;
+
+    count(MC_CONNECTIONS, 1);
+    conn_start = metrics_now();
+}
+
+
+/* Logs a summary of the connection that just ended. */
+void
+metrics_connection_closed(void)
+{
+    if (!open_metrics() || !conn_start)
+        return;
+
+    log_msg("Connection summary: %.1fs, %ld messages, %.3fs responding, "
+            "%ld bytes in, %ld bytes out",
+            (metrics_now() - conn_start) / 1e6, conn_messages,
+            conn_response_time / 1e6, conn_bytes_received, conn_bytes_sent);
+    conn_start = 0;
+}
+
+
+void
+metrics_bytes_received(long bytes)
+{
+    if (!open_metrics())
+        return;
+
+    count(MC_BYTES_RECEIVED, bytes);
+    conn_bytes_received += bytes;
+}
+
+
+/* Called when a complete message arrives from the client; the time until the
+   next message is sent back is recorded as the response time for whatever
+   metrics_command later says the message was. (The command isn't taken from
+   the message itself, so that a client can't invent labels.) */
+void
+metrics_message_received(void)
+{
+    if (!open_metrics())
+        return;
+
+    count(MC_MESSAGES_RECEIVED, 1);
+    conn_messages++;
+    message_time = metrics_now();
+    message_command = NULL;
+}
+
+
+void
+metrics_command(const char *name)
+{
+    message_command = name;
+}
+
+
+void
+metrics_message_sent(long bytes)
+{
+    long long elapsed;
+
+    if (!open_metrics())
+        return;
+
+    count(MC_MESSAGES_SENT, 1);
+    count(MC_BYTES_SENT, bytes);
+    conn_bytes_sent += bytes;
+
+    if (message_command) {
+        elapsed = metrics_now() - message_time;
+        metrics_observe(MF_COMMAND, message_command, elapsed);
+        conn_response_time += elapsed;
+        message_command = NULL;
+    }
+
+    metrics_flush(FALSE);
+}
+
+/* metrics.c */
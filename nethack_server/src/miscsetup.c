@@ -136,6 +136,10 @@ init_workdir(void)
     if (!create_dir(dirbuf))
         return FALSE;
 
+    snprintf(dirbuf, sizeof(dirbuf), "%s/spectate/", settings.workdir);
+    if (!create_dir(dirbuf))
+        return FALSE;
+
     return TRUE;
 }
 
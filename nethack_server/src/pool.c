@@ -0,0 +1,263 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* The NetHack server may be freely redistributed under the terms of either:
+ *  - the NetHack license
+ *  - the GNU General Public license v2 or later
+ */
+
+#include "nhserver.h"
+
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+
+/* The worker pool. Normally, inetd starts a new server process for each
+   connection, which then has to log into the database and initialize the game
+   engine before it can even look at the authentication data; when many players
+   connect at once (e.g. after a server restart), that's a lot of work all at
+   the same time. If listen_port is set, the server instead listens for
+   connections itself, and keeps pool_size "warm" worker processes that have
+   already done that work waiting for connections.
+
+   Each worker handles one connection, exactly as if it had been started by
+   inetd on that connection; then it exits, and the supervisor starts another
+   one. (The game engine isn't designed to be reinitialized within a process,
+   so there's no way to reuse a worker.) Idle workers are recycled after
+   pool_worker_lifetime seconds, so that they don't hold database connections
+   open forever. */
+
+static int pool_size, pool_worker_lifetime;
+
+static int
+open_listen_socket(void)
+{
+    struct addrinfo hints, *res, *ai;
+    int fd = -1, pass, one = 1, zero = 0, err;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    err = getaddrinfo(NULL, settings.listen_port, &hints, &res);
+    if (err) {
+        fprintf(stderr, "Error: bad listen_port %s: %s.\n",
+                settings.listen_port, gai_strerror(err));
+        return -1;
+    }
+
+    /* Prefer IPv6, with IPv4 connections accepted on the same socket. */
+    for (pass = 0; pass < 2 && fd == -1; pass++) {
+        for (ai = res; ai && fd == -1; ai = ai->ai_next) {
+            if ((ai->ai_family == AF_INET6) != (pass == 0))
+                continue;
+
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd == -1)
+                continue;
+
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+            if (ai->ai_family == AF_INET6)
+                setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof zero);
+
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) == -1 ||
+                listen(fd, SOMAXCONN) == -1) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+    freeaddrinfo(res);
+
+    if (fd == -1) {
+        fprintf(stderr, "Error: could not listen on port %s: %s.\n",
+                settings.listen_port, strerror(errno));
+        return -1;
+    }
+
+    /* All the idle workers wait on the same socket; only one of them will get
+       any given connection, and the others mustn't block in accept(). */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+
+static noreturn void
+pool_worker(int listenfd, int notifyfd)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    time_t deadline;
+    pid_t pid = getpid();
+    int fd, ret;
+
+    /* Do the slow parts of starting up now, before there's a client waiting. */
+    setup_signals();
+    if (!init_database() || !check_database()) {
+        log_msg("Pool worker could not connect to the database.");
+        exit_server(EXIT_FAILURE, 0);
+    }
+    init_game_library();
+
+    deadline = time(NULL) + pool_worker_lifetime;
+    for (;;) {
+        struct pollfd pfd = {listenfd, POLLIN, 0};
+        long remaining = deadline - time(NULL);
+
+        if (termination_flag)
+            exit_server(EXIT_SUCCESS, 0);
+        if (remaining <= 0) {
+            log_msg("Recycling idle pool worker.");
+            exit_server(EXIT_SUCCESS, 0);
+        }
+
+        /* A long lifetime could overflow poll's int timeout; waking up
+           early just means going round the loop again. */
+        ret = poll(&pfd, 1, remaining > INT_MAX / 1000 ?
+                   INT_MAX : remaining * 1000);
+        if (ret <= 0)
+            continue;   /* timeout, or a signal */
+
+        addrlen = sizeof addr;
+        fd = accept(listenfd, (struct sockaddr *)&addr, &addrlen);
+        if (fd == -1)
+            continue;   /* most likely, another worker got there first */
+        break;
+    }
+
+    /* Tell the supervisor we're busy, so that it can replace us. */
+    close(listenfd);
+    while (write(notifyfd, &pid, sizeof pid) == -1 && errno == EINTR)
+        ;
+    close(notifyfd);
+
+    log_msg("Pool worker accepted a connection from %s.", addr2str(&addr));
+
+    /* From here on, this is just like being started by inetd. */
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    dup2(fd, 0);
+    dup2(fd, 1);
+    if (fd > 1)
+        close(fd);
+
+    runserver();
+}
+
+
+static int
+remove_pid(pid_t *pids, int *count, pid_t pid)
+{
+    int i;
+
+    for (i = 0; i < *count; i++) {
+        if (pids[i] == pid) {
+            pids[i] = pids[--*count];
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+/* Workers that took a connection are busy now; each one sent us its pid. */
+static void
+read_busy_workers(int notifyfd, pid_t *idle, int *idle_count)
+{
+    pid_t busy[64];
+    int i, ret;
+
+    while ((ret = read(notifyfd, busy, sizeof busy)) > 0)
+        for (i = 0; i < ret / (int)sizeof *busy; i++)
+            remove_pid(idle, idle_count, busy[i]);
+}
+
+
+noreturn void
+run_pool(void)
+{
+    int listenfd, notify[2], idle_count = 0, i, status;
+    pid_t *idle, pid;
+    FILE *pidfile;
+
+    pool_size = settings.pool_size ? atoi(settings.pool_size) : 0;
+    if (pool_size <= 0)
+        pool_size = DEFAULT_POOL_SIZE;
+    pool_worker_lifetime = settings.pool_worker_lifetime ?
+        atoi(settings.pool_worker_lifetime) : 0;
+    if (pool_worker_lifetime <= 0)
+        pool_worker_lifetime = DEFAULT_POOL_WORKER_LIFETIME;
+
+    listenfd = open_listen_socket();
+    if (listenfd == -1 || pipe(notify) == -1)
+        exit_server(EXIT_FAILURE, 0);
+    fcntl(notify[0], F_SETFL, fcntl(notify[0], F_GETFL) | O_NONBLOCK);
+
+    pidfile = fopen(settings.pidfile, "w");
+    if (pidfile) {
+        fprintf(pidfile, "%d\n", (int)getpid());
+        fclose(pidfile);
+    }
+
+    /* Each worker opens its own database connection; connections can't be
+       shared between processes. */
+    close_database();
+
+    /* The supervisor has no client to pass messages on to; the workers set up
+       their own signal handlers. */
+    signal(SIGUSR1, SIG_IGN);
+    signal(SIGUSR2, SIG_IGN);
+
+    log_msg("Listening on port %s with %d pool workers.", settings.listen_port,
+            pool_size);
+
+    idle = malloc(pool_size * sizeof *idle);
+
+    while (!termination_flag) {
+        int worker_failed = FALSE;
+
+        while (idle_count < pool_size && !termination_flag) {
+            pid = fork();
+            if (pid == 0) {
+                free(idle);
+                close(notify[0]);
+                pool_worker(listenfd, notify[1]);
+            } else if (pid == -1) {
+                log_msg("Could not start a pool worker: %s", strerror(errno));
+                break;
+            }
+            idle[idle_count++] = pid;
+        }
+
+        struct pollfd pfd = {notify[0], POLLIN, 0};
+
+        if (poll(&pfd, 1, 1000) > 0)
+            read_busy_workers(notify[0], idle, &idle_count);
+
+        /* Reap workers that exited. If an idle worker exited, it was either
+           recycled or failed to start up; in the latter case, wait a bit
+           before replacing it, rather than fork-bombing a broken database. (A
+           worker that had a connection has told us so before exiting, so check
+           the pipe again first.) */
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            read_busy_workers(notify[0], idle, &idle_count);
+            if (remove_pid(idle, &idle_count, pid) &&
+                !(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS))
+                worker_failed = TRUE;
+        }
+
+        if (worker_failed)
+            sleep(1);
+    }
+
+    /* Busy workers are running someone's game, and keep going until it ends,
+       just like under inetd. Idle workers can go now. */
+    for (i = 0; i < idle_count; i++)
+        kill(idle[i], SIGTERM);
+    free(idle);
+
+    close(listenfd);
+    log_msg("Pool supervisor shutting down.");
+    exit_server(EXIT_SUCCESS, 0);
+}
+
+/* pool.c */
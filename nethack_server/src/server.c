@@ -8,20 +8,17 @@
 
 #include "nhserver.h"
 
-#include <ctype.h>
 #include <sys/select.h>
 
 #define AUTH_MAXLEN 4096
-#define AUTHBUFSIZE (AUTH_MAXLEN + 2)
 
 static int outfd = 1; /* stdout */
 static int infd = 0;  /* stdin */
 
-/* Used for reading from the socket before the connection is fully authed.  This
-   uses a smaller timeout, and requires the auth to be a single packet (TODO:
-   Does this make sense?) */
-static int
-timeouted_read(int fd, void *buf, int buflen)
+/* Used for waiting for data from the socket before the connection is fully
+   authed. This uses a smaller timeout. */
+static void
+timeouted_wait(int fd)
 {
     struct timeval timeout = {.tv_sec = 15, .tv_usec = 0};
     fd_set readfds;
@@ -34,14 +31,12 @@ timeouted_read(int fd, void *buf, int buflen)
         ready_fds = select(fd + 1, &readfds, NULL, NULL, &timeout);
     } while (ready_fds < 0 && errno == EINTR);
 
-    if (ready_fds == 1) {
-        return read(fd, buf, buflen);
-    } else if (ready_fds == 0) {
+    if (ready_fds == 0) {
         /* Timeout. This is a silent disconnection; we want the other end of
            the connection to stay dormant until it tries to send something. */
         log_msg("Timeout during authentication. Disconnecting.");
         exit_server(EXIT_SUCCESS, 0);
-    } else {
+    } else if (ready_fds < 0) {
         /* Error. */
         log_msg("Failed to read from socket, error %s", strerror(errno));
         exit_server(EXIT_FAILURE, 0);
@@ -55,44 +50,58 @@ newclient(int userid)
 
     db_get_user_info(userid, &info);
     setenv("NH4SERVERUSER", info.username, 1);
+    if (settings.save_check)
+        setenv("NH4SAVECHECK", settings.save_check, 1);
+    if (settings.reload_check_interval)
+        setenv("NH4RELOADINTERVAL", settings.reload_check_interval, 1);
+    if (settings.reload_check_sample)
+        setenv("NH4RELOADSAMPLE", settings.reload_check_sample, 1);
+    if (settings.reload_check_level_change)
+        setenv("NH4RELOADLEVELCHANGE", settings.reload_check_level_change, 1);
+    if (settings.log_format)
+        setenv("NH4LOGFORMAT", settings.log_format, 1);
+    if (settings.backup_dictionary)
+        setenv("NH4BACKUPDICTIONARY", settings.backup_dictionary, 1);
+    if (settings.backup_policy)
+        setenv("NH4BACKUPPOLICY", settings.backup_policy, 1);
+    if (settings.backup_replay_limit)
+        setenv("NH4BACKUPREPLAYLIMIT", settings.backup_replay_limit, 1);
+    if (settings.backup_disk_budget)
+        setenv("NH4BACKUPDISKBUDGET", settings.backup_disk_budget, 1);
     client_main(userid, outfd, infd);
 }
 
 static int
 auth_connection(void)
 {
-    int pos, is_reg, authlen, userid;
-    char authbuf[AUTHBUFSIZE];
+    int is_reg, userid, bad, ret;
+    json_t *authobj;
+
+    /* The auth data may arrive in any number of packets; what follows it is
+       left in the input buffer for client_main. */
+    while (!(authobj = next_input_message(&bad))) {
+        if (bad) {
+            log_msg("authentication failed due to bad JSON");
+            return -1;
+        }
 
-    authlen = timeouted_read(infd, authbuf, AUTHBUFSIZE - 1);
-    if (authlen <= 0) {
-        return -1;
+        timeouted_wait(infd);
+        ret = read_input_data(infd, AUTH_MAXLEN);
+        if (ret == -2) {        /* did we receive too much data? */
+            log_msg("Auth buffer overrun attempt? Peer disconnected.");
+            return -1;
+        }
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
     }
 
     log_msg("Auth data received.");
 
-    authbuf[authlen] = '\0';    /* make it safe to use as a string */
-
-    /* did we receive too much data? */
-    if (authlen >= AUTH_MAXLEN) {
-        log_msg("Auth buffer overrun attempt? Peer disconnected.");
-        return -1;
-    }
-
-    /* check the end of the received auth data: a JSON object always ends with
-       '}'; TODO: we're assuming the auth arrives in a single packet here,
-       which is silly and unwarranted */
-    pos = authlen - 1;
-    while (pos > 0 && isspace(authbuf[pos]))
-        pos--;
-
-    if (authbuf[pos] != '}') {  /* not the end of JSON auth data */
-        log_msg("authentication failed due to incomplete JSON");
-        return -1;
-    }
-
     /* ready to authenticate the user here */
-    userid = auth_user(authbuf, &is_reg);
+    userid = auth_user(authobj, &is_reg);
+    json_decref(authobj);
     if (userid <= 0) {
         if (!userid) {
             log_msg("Authentication failed: unknown user");
@@ -133,6 +142,7 @@ exit_server(int exitstatus, int coredumpsignal)
     }
 
     /* shutdown */
+    metrics_flush(TRUE);
     end_logging();
     close_database();
     free_config();
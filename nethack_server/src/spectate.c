@@ -0,0 +1,378 @@
+/* vim:set cin ft=c sw=4 sts=4 ts=8 et ai cino=Ls\:0t0(0 : -*- mode:c;fill-column:80;tab-width:8;c-basic-offset:4;indent-tabs-mode:nil;c-file-style:"k&r" -*-*/
+/* The NetHack server may be freely redistributed under the terms of either:
+ *  - the NetHack license
+ *  - the GNU General Public license v2 or later
+ */
+
+#include "nhserver.h"
+
+/* Live spectating. Watching a game normally means running the game engine in
+   FM_WATCH mode, which follows the player by reading the save file and
+   replaying every turn; with many people watching the same game, that's a lot
+   of processes all simulating the same thing.
+
+   Instead, the process playing a game listens on a Unix socket named after the
+   game (in the "spectate" directory of the workdir), and sends everything that
+   it displays to the player down it: each batch of display data is serialized
+   once, and the same string is written to every spectator. A spectator is first
+   sent a snapshot of the current map, status and inventory. Anyone who falls
+   too far behind to keep up is disconnected, rather than making the player
+   wait.
+
+   A process watching a game connects to that socket if it exists, and just
+   passes the display data on to its client, using server cancels to interrupt
+   the client's request for a command, just as the game engine does when
+   watching. If nobody is playing the game, there's no socket, and watching
+   falls back to the game engine; likewise if the player's process stops
+   sending display data (because the player detached, or the spectator fell
+   behind). */
+
+static int listen_fd = -1;
+static ino_t listen_ino;
+static char listen_path[sizeof ((struct sockaddr_un *)0)->sun_path];
+static int *spectators, spectator_count;
+
+static char *feedbuf;
+static int feedbuf_len, feedbuf_size;
+
+
+static int
+spectate_addr(int gid, struct sockaddr_un *addr)
+{
+    int len;
+
+    memset(addr, 0, sizeof *addr);
+    addr->sun_family = AF_UNIX;
+    len = snprintf(addr->sun_path, sizeof addr->sun_path, "%s/spectate/%d",
+                   settings.workdir, gid);
+    return len < sizeof addr->sun_path;
+}
+
+
+/* Whether the game might be being played right now: the playing process opens
+   the game's spectator socket before it starts and removes it when it stops.
+   This only looks at the spectate directory, not at the game. A process that
+   dies leaves its socket behind, and a process that couldn't open one (which
+   it logs) has none, so this is only a hint. */
+int
+spectate_socket_exists(int gid)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (!spectate_addr(gid, &addr))
+        return TRUE;    /* we can't tell */
+
+    return stat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode);
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* The playing process */
+
+void
+spectate_open(int gid)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+
+    if (!spectate_addr(gid, &addr)) {
+        log_msg("Spectator socket path for game %d is too long.", gid);
+        return;
+    }
+
+    /* A socket left behind by an earlier session is stale: the game can't be
+       played by two processes at once. */
+    unlink(addr.sun_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof addr) == -1 ||
+        listen(fd, 16) == -1 || stat(addr.sun_path, &st) == -1) {
+        log_msg("Could not open spectator socket %s: %s", addr.sun_path,
+                strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    listen_fd = fd;
+    listen_ino = st.st_ino;
+    strcpy(listen_path, addr.sun_path);
+}
+
+
+void
+spectate_close(void)
+{
+    struct stat st;
+
+    while (spectator_count)
+        close(spectators[--spectator_count]);
+    free(spectators);
+    spectators = NULL;
+
+    if (listen_fd == -1)
+        return;
+    close(listen_fd);
+    listen_fd = -1;
+
+    /* Don't remove the socket of a newer session of the same game. */
+    if (stat(listen_path, &st) == 0 && st.st_ino == listen_ino)
+        unlink(listen_path);
+}
+
+
+int
+spectators_watching(void)
+{
+    return spectator_count > 0;
+}
+
+
+int
+spectate_listen_fd(void)
+{
+    return listen_fd;
+}
+
+
+/* Sends a message, plus its terminating NUL, to a spectator without blocking.
+   Returns FALSE if the spectator couldn't take all of it. */
+static int
+send_to_spectator(int fd, const char *msg, int len)
+{
+    int pos = 0, ret;
+
+    while (pos < len + 1) {
+        ret = send(fd, msg + pos, len + 1 - pos, MSG_NOSIGNAL);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return FALSE;
+        pos += ret;
+    }
+    return TRUE;
+}
+
+
+void
+accept_spectators(void)
+{
+    json_t *snapshot;
+    char *msg;
+    int fd;
+
+    if (listen_fd == -1)
+        return;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) != -1) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        snapshot = get_display_snapshot();
+        msg = json_dumps(snapshot, JSON_COMPACT);
+        json_decref(snapshot);
+
+        if (!send_to_spectator(fd, msg, strlen(msg))) {
+            close(fd);
+        } else {
+            spectators = realloc(spectators,
+                                 sizeof *spectators * (spectator_count + 1));
+            spectators[spectator_count++] = fd;
+        }
+        free(msg);
+    }
+}
+
+
+void
+publish_to_spectators(json_t *display_list)
+{
+    char *msg;
+    int i, len;
+
+    if (spectator_count) {
+        msg = json_dumps(display_list, JSON_COMPACT);
+        len = strlen(msg);
+        for (i = spectator_count - 1; i >= 0; i--) {
+            if (!send_to_spectator(spectators[i], msg, len)) {
+                close(spectators[i]);
+                spectators[i] = spectators[--spectator_count];
+            }
+        }
+        free(msg);
+    }
+
+    /* Spectators who connected meanwhile get a snapshot that includes what was
+       just published. */
+    accept_spectators();
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* The watching process */
+
+/* Reads display data from the player's process, and queues it for the client.
+   Returns FALSE when the feed ends. */
+static int
+read_spectator_feed(int fd)
+{
+    char *end, *newbuf;
+    int ret, len, newsize;
+    json_t *list;
+
+    if (feedbuf_size - feedbuf_len < 4096) {
+        newsize = feedbuf_size ? feedbuf_size * 2 : 65536;
+        newbuf = realloc(feedbuf, newsize);
+        if (!newbuf) {
+            log_msg("Out of memory reading spectator feed");
+            return FALSE;
+        }
+        feedbuf = newbuf;
+        feedbuf_size = newsize;
+    }
+
+    ret = read(fd, feedbuf + feedbuf_len, feedbuf_size - feedbuf_len);
+    if (ret == -1 && errno == EINTR)
+        return TRUE;
+    if (ret <= 0)
+        return FALSE;
+    feedbuf_len += ret;
+
+    /* Messages are separated by NULs, as on the client connection. */
+    while ((end = memchr(feedbuf, '\0', feedbuf_len))) {
+        len = end - feedbuf + 1;
+        list = json_loads(feedbuf, 0, NULL);
+        if (json_is_array(list))
+            add_display_list(list);
+        if (list)
+            json_decref(list);
+
+        memmove(feedbuf, feedbuf + len, feedbuf_len - len);
+        feedbuf_len -= len;
+    }
+
+    return TRUE;
+}
+
+
+/* Passes the feed on to the client until the client stops watching, returning
+   the play status, or until the feed ends, returning -1. */
+static int
+relay_spectator_feed(int fd)
+{
+    int status = GAME_DETACHED;
+    int requesting = FALSE, cancelled = FALSE, feed_open = TRUE;
+    int fd_ready, etype, i;
+    json_t *jmsg, *jval;
+    const char *key, *cmd;
+    char buf[BUFSZ];
+
+    feedbuf_len = 0;
+
+    for (;;) {
+        if (!requesting) {
+            /* The client has answered its request, so the game engine can
+               take over from here. Its map updates will be relative to an
+               empty map, so clear the client's to match. */
+            if (!feed_open) {
+                jmsg = json_pack("[{s{si,si,si}}]", "update_screen",
+                                 "ux", -1, "uy", -1, "dbuf", 0);
+                add_display_list(jmsg);
+                json_decref(jmsg);
+                return -1;
+            }
+            client_msg("request_command",
+                       json_pack("{sb,sb,sb}", "debug", 0, "completed", 1,
+                                 "interrupted", 0));
+            requesting = TRUE;
+            cancelled = FALSE;
+        }
+
+        jmsg = read_input_or_fd(feed_open ? fd : -1, &fd_ready);
+        if (fd_ready) {
+            if (!read_spectator_feed(fd))
+                feed_open = FALSE;
+            if (!cancelled) {
+                /* the client will answer its request with "servercancel" */
+                client_server_cancel_msg();
+                cancelled = TRUE;
+            }
+            continue;
+        }
+        if (!jmsg)
+            break;
+
+        key = json_object_iter_key(json_object_iter(jmsg));
+        jval = json_object_get(jmsg, key ? key : "");
+
+        if (key && !strcmp(key, "request_command")) {
+            if (json_unpack(jval, "{ss*}", "command", &cmd) == -1)
+                exit_client("Bad set of parameters for request_command", 0);
+            if (strcmp(cmd, "servercancel") != 0 && strlen(cmd) < 60) {
+                snprintf(buf, sizeof buf,
+                         "Command '%s' is unavailable while watching.", cmd);
+                add_display_list(json_pack("[{s{si,ss}}]", "print_message",
+                                           "channel", msgc_cancelled,
+                                           "msg", buf));
+            }
+            requesting = FALSE;
+
+        } else if (key && !strcmp(key, "exit_game")) {
+            /* as for the game engine, which never quits a watched game */
+            if (json_unpack(jval, "{si*}", "exit_type", &etype) == -1)
+                exit_client("Bad set of parameters for exit_game", 0);
+            status = etype == EXIT_RESTART ? CLIENT_RESTART : GAME_DETACHED;
+            json_decref(jmsg);
+            break;
+
+        } else {
+            for (i = 0; key && clientcmd[i].name; i++)
+                if (!strcmp(clientcmd[i].name, key))
+                    break;
+            if (!key || !clientcmd[i].name || !clientcmd[i].can_run_async)
+                exit_client("Command sent out of sequence", 0);
+            metrics_command(clientcmd[i].name);
+            clientcmd[i].func(jval);
+        }
+
+        json_decref(jmsg);
+    }
+
+    return status;
+}
+
+
+/* Watches a game via its player's spectator socket. Returns -1 if nobody is
+   playing the game right now, or if the feed ends before the client stops
+   watching; the caller should watch using the game engine instead. */
+int
+spectate_game(int gid)
+{
+    struct sockaddr_un addr;
+    int fd, status;
+
+    if (!spectate_addr(gid, &addr))
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    log_msg("User '%s' is spectating game %d live", user_info.username, gid);
+    status = relay_spectator_feed(fd);
+    close(fd);
+
+    if (status == -1)
+        log_msg("Live feed of game %d ended; following it from its save file",
+                gid);
+
+    return status;
+}
+
+/* spectate.c */
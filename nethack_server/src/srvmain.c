@@ -58,6 +58,9 @@ main(int argc, char *argv[])
         !begin_logging())
         return 1;
 
+    if (settings.listen_port)
+        run_pool(); /* does not return */
+
     log_msg("new process spawned");
 
     runserver(); /* does not return */
@@ -45,11 +45,14 @@ static void srv_server_cancel(void);
 /*---------------------------------------------------------------------------*/
 
 struct nh_player_info player_info;
+enum nhnet_mapdelta client_mapdelta;
 static struct nh_dbuf_entry prev_dbuf[ROWNO][COLNO];
 static int prev_invent_icount, prev_floor_icount;
 static struct nh_objitem *prev_invent;
 static const struct nh_dbuf_entry zero_dbuf;    /* an entry of all zeroes */
 static json_t *display_data, *jinvent_items, *jfloor_items;
+static json_t *spectator_data;
+static int prev_ux, prev_uy, prev_displaymode = -1;
 
 struct nh_window_procs server_windowprocs = {
     srv_pause,
@@ -104,9 +107,10 @@ client_request(const char *funcname, json_t * request_msg)
                context. For some commands, we can and should process them even
                with the game waiting for input. Otherwise, tell the client to
                behave itself. */
-            if (clientcmd[i].can_run_async)
+            if (clientcmd[i].can_run_async) {
+                metrics_command(clientcmd[i].name);
                 clientcmd[i].func(json_object_iter_value(iter));
-            else {
+            } else {
                 exit_client("Command sent out of sequence", 0);
                 break;
             }
@@ -123,21 +127,48 @@ client_request(const char *funcname, json_t * request_msg)
         json_incref(jobj);
     json_decref(jret);
 
+    /* the game's reaction to this is the response time we care about */
+    metrics_command(funcname);
+
     return jobj;
 }
 
 
 static void
-add_display_data(const char *key, json_t * data)
+append_display_item(json_t **list, const char *key, json_t *data)
 {
     json_t *tmpobj;
 
-    if (!display_data)
-        display_data = json_array();
+    if (!*list)
+        *list = json_array();
 
     tmpobj = json_object();
     json_object_set_new(tmpobj, key, data);
-    json_array_append_new(display_data, tmpobj);
+    json_array_append_new(*list, tmpobj);
+}
+
+
+static void
+add_display_data(const char *key, json_t * data)
+{
+    /* Spectators see everything that's displayed to the player. */
+    if (spectators_watching())
+        append_display_item(&spectator_data, key, json_incref(data));
+    append_display_item(&display_data, key, data);
+}
+
+
+/* Display data from somewhere other than the game engine, i.e. a spectator
+   feed; it's sent to the client in the same way. */
+void
+add_display_list(json_t *list)
+{
+    size_t i;
+
+    if (!display_data)
+        display_data = json_array();
+    for (i = 0; i < json_array_size(list); i++)
+        json_array_append(display_data, json_array_get(list, i));
 }
 
 
@@ -156,6 +187,13 @@ get_display_data(void)
     }
     dd = display_data;
     display_data = NULL;
+
+    if (spectator_data) {
+        publish_to_spectators(spectator_data);
+        json_decref(spectator_data);
+        spectator_data = NULL;
+    }
+
     return dd;
 }
 
@@ -194,17 +232,13 @@ srv_display_buffer(const char *buf, nh_bool trymove)
 }
 
 
-static void
-srv_update_status(struct nh_player_info *pi)
+/* The fields of pi that differ from oi, or all of them if all is set. */
+static json_t *
+json_player_info(const struct nh_player_info *pi,
+                 const struct nh_player_info *oi, int all)
 {
     json_t *jobj, *jarr;
-    struct nh_player_info *oi = &player_info;
-    int i, all;
-
-    if (!memcmp(&player_info, pi, sizeof (struct nh_player_info)))
-        return;
-
-    all = !player_info.plname[0];
+    int i;
 
     /* only send fields that have changed since the last transmission */
     jobj = json_object();
@@ -278,6 +312,19 @@ srv_update_status(struct nh_player_info *pi)
             json_array_append_new(jarr, json_string(pi->statusitems[i]));
         json_object_set_new(jobj, "statusitems", jarr);
     }
+    return jobj;
+}
+
+
+static void
+srv_update_status(struct nh_player_info *pi)
+{
+    json_t *jobj;
+
+    if (!memcmp(&player_info, pi, sizeof (struct nh_player_info)))
+        return;
+
+    jobj = json_player_info(pi, &player_info, !player_info.plname[0]);
     player_info = *pi;
 
     add_display_data("update_status", jobj);
@@ -292,11 +339,92 @@ srv_print_message(enum msg_channel msgc, const char *msg)
     add_display_data("print_message", jobj);
 }
 
+/* Appends a changed map cell in MAPDELTA_RUNS form: a bitmask of which fields
+   are nonzero, followed by just those fields. An empty cell is a single 0. */
 static void
-srv_update_screen(struct nh_dbuf_entry dbuf[ROWNO][COLNO], int ux, int uy)
+append_packed_dbe(json_t *jarr, const struct nh_dbuf_entry *dbe)
 {
-    int i, x, y, samedbe, samecols, zerodbe, zerocols, is_same, is_zero;
-    json_t *jmsg, *jdbuf, *dbufcol, *dbufent;
+    const int fields[] = {
+        dbe->effect, dbe->bg, dbe->trap, dbe->obj, dbe->obj_mn, dbe->mon,
+        dbe->monflags, dbe->branding, dbe->invis, dbe->visible
+    };
+    int i, mask = 0;
+
+    for (i = 0; i < sizeof fields / sizeof *fields; i++)
+        if (fields[i])
+            mask |= 1 << i;
+
+    json_array_append_new(jarr, json_integer(mask));
+    for (i = 0; i < sizeof fields / sizeof *fields; i++)
+        if (fields[i])
+            json_array_append_new(jarr, json_integer(fields[i]));
+}
+
+
+/* The map delta in MAPDELTA_RUNS form. The cells are taken in row-major order;
+   the delta is a list of runs, each being the number of unchanged cells to
+   skip, the number of changed cells that follow, and the packed cells.
+   Returns NULL if nothing changed. */
+static json_t *
+pack_dbuf_runs(struct nh_dbuf_entry dbuf[ROWNO][COLNO],
+               struct nh_dbuf_entry prev[ROWNO][COLNO], int *all_zero)
+{
+    int x, y, skip = 0, runlen = 0, runpos = 0;
+    json_t *jdbuf = json_array();
+
+    *all_zero = TRUE;
+    for (y = 0; y < ROWNO; y++) {
+        for (x = 0; x < COLNO; x++) {
+            if (memcmp(&dbuf[y][x], &zero_dbuf, sizeof (dbuf[y][x])))
+                *all_zero = FALSE;
+
+            if (!memcmp(&dbuf[y][x], &prev[y][x], sizeof (dbuf[y][x]))) {
+                skip++;
+                runlen = 0;
+                continue;
+            }
+
+            if (!runlen) {
+                /* start a new run; its length is filled in as it grows */
+                json_array_append_new(jdbuf, json_integer(skip));
+                runpos = json_array_size(jdbuf);
+                json_array_append_new(jdbuf, json_integer(0));
+                skip = 0;
+            }
+            json_array_set_new(jdbuf, runpos, json_integer(++runlen));
+            append_packed_dbe(jdbuf, &dbuf[y][x]);
+        }
+    }
+
+    if (!json_array_size(jdbuf)) {
+        json_decref(jdbuf);
+        return NULL;
+    }
+    return jdbuf;
+}
+
+
+/* The update_screen message for the change from prev to dbuf, in the given
+   encoding, or NULL if nothing changed. */
+static json_t *
+json_update_screen(struct nh_dbuf_entry dbuf[ROWNO][COLNO],
+                   struct nh_dbuf_entry prev[ROWNO][COLNO], int ux, int uy,
+                   enum nhnet_mapdelta format)
+{
+    int x, y, samedbe, samecols, zerodbe, zerocols, is_same, is_zero;
+    json_t *jdbuf, *dbufcol, *dbufent;
+
+    if (format == MAPDELTA_RUNS) {
+        jdbuf = pack_dbuf_runs(dbuf, prev, &is_zero);
+        if (!jdbuf)
+            return NULL; /* nothing changed */
+
+        if (is_zero) {
+            json_decref(jdbuf);
+            return json_pack("{si,si,si}", "ux", ux, "uy", uy, "dbuf", 0);
+        }
+        return json_pack("{si,si,so}", "ux", ux, "uy", uy, "dbuf_runs", jdbuf);
+    }
 
     samecols = 0;
     zerocols = 0;
@@ -314,7 +442,7 @@ srv_update_screen(struct nh_dbuf_entry dbuf[ROWNO][COLNO], int ux, int uy)
                 is_zero = TRUE;
                 json_array_append_new(dbufcol, json_integer(0));
             }
-            if (!memcmp(&dbuf[y][x], &prev_dbuf[y][x], sizeof (dbuf[y][x]))) {
+            if (!memcmp(&dbuf[y][x], &prev[y][x], sizeof (dbuf[y][x]))) {
                 samedbe++;
                 is_same = TRUE;
                 if (!is_zero)
@@ -352,19 +480,36 @@ srv_update_screen(struct nh_dbuf_entry dbuf[ROWNO][COLNO], int ux, int uy)
 
     if (samecols == COLNO) {
         json_decref(jdbuf);
-        return; /* no point in sending out a message that nothing changed */
+        return NULL;    /* no point in sending a message that nothing changed */
     } else if (zerocols == COLNO) {
         json_decref(jdbuf);
-        jmsg =
-            json_pack("{si,si,so}", "ux", ux, "uy", uy, "dbuf",
-                      json_integer(0));
+        return json_pack("{si,si,so}", "ux", ux, "uy", uy, "dbuf",
+                         json_integer(0));
     } else
-        jmsg = json_pack("{si,si,so}", "ux", ux, "uy", uy, "dbuf", jdbuf);
+        return json_pack("{si,si,so}", "ux", ux, "uy", uy, "dbuf", jdbuf);
+}
+
 
-    add_display_data("update_screen", jmsg);
+static void
+srv_update_screen(struct nh_dbuf_entry dbuf[ROWNO][COLNO], int ux, int uy)
+{
+    json_t *jmsg = json_update_screen(dbuf, prev_dbuf, ux, uy, client_mapdelta);
 
-    for (i = 0; i < ROWNO; i++)
-        memcpy(&prev_dbuf[i], &dbuf[i], sizeof (dbuf[i]));
+    if (!jmsg)
+        return;
+
+    /* Spectators may have older clients than the player, so they get the
+       encoding that every client understands. */
+    if (spectators_watching())
+        append_display_item(
+            &spectator_data, "update_screen",
+            client_mapdelta == MAPDELTA_COLUMNS ? json_incref(jmsg) :
+            json_update_screen(dbuf, prev_dbuf, ux, uy, MAPDELTA_COLUMNS));
+    append_display_item(&display_data, "update_screen", jmsg);
+
+    memcpy(prev_dbuf, dbuf, sizeof prev_dbuf);
+    prev_ux = ux;
+    prev_uy = uy;
 }
 
 
@@ -378,6 +523,7 @@ srv_delay_output(void)
 static void
 srv_level_changed(int displaymode)
 {
+    prev_displaymode = displaymode;
     add_display_data("level_changed", json_integer(displaymode));
 }
 
@@ -720,7 +866,9 @@ reset_cached_displaydata(void)
         json_decref(jinvent_items);
     if (jfloor_items)
         json_decref(jfloor_items);
-    display_data = jinvent_items = jfloor_items = NULL;
+    if (spectator_data)
+        json_decref(spectator_data);
+    display_data = jinvent_items = jfloor_items = spectator_data = NULL;
 
     if (prev_invent)
         free(prev_invent);
@@ -729,6 +877,42 @@ reset_cached_displaydata(void)
 
     memset(&player_info, 0, sizeof (player_info));
     memset(&prev_dbuf, 0, sizeof (prev_dbuf));
+    prev_ux = prev_uy = 0;
+    prev_displaymode = -1;
+}
+
+
+/* Display data that brings a new spectator up to date with what the player can
+   currently see, based on what was last sent to the player. */
+json_t *
+get_display_snapshot(void)
+{
+    static struct nh_dbuf_entry empty_dbuf[ROWNO][COLNO];
+    json_t *list = json_array(), *jobj, *jarr;
+    int i;
+
+    if (prev_displaymode != -1)
+        append_display_item(&list, "level_changed",
+                            json_integer(prev_displaymode));
+    if (player_info.plname[0])
+        append_display_item(&list, "update_status",
+                            json_player_info(&player_info, &player_info, TRUE));
+
+    jobj = json_update_screen(prev_dbuf, empty_dbuf, prev_ux, prev_uy,
+                              MAPDELTA_COLUMNS);
+    if (jobj)
+        append_display_item(&list, "update_screen", jobj);
+
+    if (prev_invent) {
+        jarr = json_array();
+        for (i = 0; i < prev_invent_icount; i++)
+            json_array_append_new(jarr, json_objitem(prev_invent + i));
+        append_display_item(&list, "list_items",
+                            json_pack("{so,si,si}", "items", jarr, "icount",
+                                      prev_invent_icount, "invent", 1));
+    }
+
+    return list;
 }
 
 /* winprocs.c */
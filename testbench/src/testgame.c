@@ -911,8 +911,23 @@ test_getdir(const char *prompt, nh_bool gridbug)
                     tap_bail("junk after 'Dm' command");
             }
             /* fall through */
+        } else if (isdigit((unsigned char)curcmd_ptr[1])) {
+            char *endptr;
+            long dir = strtol(curcmd_ptr + 1, &endptr, 10);
+            if (dir > DIR_SELF)
+                tap_bail("bad direction number in 'D' command");
+            curcmd_ptr = endptr;
+            if (*curcmd_ptr) {
+                if (*curcmd_ptr == ',')
+                    curcmd_ptr++;
+                else
+                    tap_bail("junk after 'D' command");
+            }
+            if (test_verbose)
+                tap_comment("getdir reply (specified): %s", dirnames[dir]);
+            return dir;
         } else {
-            tap_bail("'D' unimplemented (except 'Dm')");
+            tap_bail("'D' must be followed by 'm' or a number");
         }
     }
 
@@ -7,6 +7,7 @@
 # error !AIMAKE_FAIL_SILENTLY! Testing on Windows is not yet supported.
 #endif
 
+#include "tap.h"
 #include "testgame.h"
 #include "pm.h"
 #include "onames.h"
@@ -98,12 +99,44 @@ round_robin_test(unsigned long long seed, unsigned long long skip,
     shutdown_test_system();
 }
 
+/* Games that leave levels and come back to them, with the save checks done by
+   a separate process. That's the mode in which unchanged levels are copied
+   from one save to the next, and the check process compares each such save
+   against one saved from scratch, reporting any level that was copied when it
+   had changed in the paniclog (which fails the test). */
+static void
+level_copy_test(unsigned long long seed, unsigned long long count,
+                bool verbose)
+{
+    static const char *const level_copy_commands[] = {
+        /* dig a hole and fall through it, then go back to the level with the
+           hole, then on to a new level */
+        "wish,\"Z - wand of digging\",zap,OZ,D9,wait,wait,"
+        "levelteleport,\"1\",wait,wait,levelteleport,\"3\",wait,wait",
+        /* drop items, visit other levels, then come back for them */
+        "wish,\"Z - 3 daggers\",drop,OZ,levelteleport,\"2\",wait,wait,"
+        "levelteleport,\"1\",wait,wait,levelteleport,\"2\",wait",
+    };
+    const int cmdcount =
+        sizeof level_copy_commands / sizeof *level_copy_commands;
+    unsigned long long i;
+
+    if (setenv("NH4SAVECHECK", "async", 1))
+        tap_bail_errno("Setting the save check mode");
+
+    init_test_system(seed, "wgfn", count);
+    for (i = 0; i < count; i++)
+        play_test_game(level_copy_commands[i % cmdcount], verbose);
+    shutdown_test_system();
+}
+
 int
 main(int argc, char **argv)
 {
     unsigned long long seed = time(NULL);
     unsigned long long limit = -(1ULL);
     unsigned long long skip = 0;
+    unsigned long long levelcopy = 0;
     char *endptr;
 
     while (argc > 1) {
@@ -125,7 +158,11 @@ main(int argc, char **argv)
                     "    testsuite.\n\n"
                     "  --stdoutbuffer count\n"
                     "    Adjust the size of the buffer used on stdout (0 =\n"
-                    "    use line buffering for stdout)\n");
+                    "    use line buffering for stdout)\n\n"
+                    "  --levelcopy count\n"
+                    "    Instead of the usual tests, play the given number\n"
+                    "    of games that revisit levels, checking that levels\n"
+                    "    copied between saves were really unchanged.\n");
             return (strcmp(argv[1], "--help") ? EXIT_FAILURE : 0);
         }
 
@@ -143,6 +180,8 @@ main(int argc, char **argv)
             skip = parsevalue;
         else if (strcmp(argv[1], "--stdoutbuffer") == 0)
             setvbuf(stdout, NULL, parsevalue ? _IOFBF : _IOLBF, parsevalue);
+        else if (strcmp(argv[1], "--levelcopy") == 0)
+            levelcopy = parsevalue;
         else {
             fprintf(stderr, "Unknown option '%s'\n", argv[1]);
             return EXIT_FAILURE;
@@ -152,6 +191,9 @@ main(int argc, char **argv)
         argc -= 2;
     }
 
-    round_robin_test(seed, skip, limit, limit < 10);
+    if (levelcopy)
+        level_copy_test(seed, levelcopy, levelcopy < 10);
+    else
+        round_robin_test(seed, skip, limit, limit < 10);
     return 0;
 }